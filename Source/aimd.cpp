@@ -0,0 +1,179 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include "aimd.h"
+#include "shard.h"
+
+using namespace std;
+
+int fixed_connections = 0;
+
+struct aimd_host
+{
+    double connections = AIMD_INITIAL_CONNECTIONS; //window of URLs fetched at the same time
+    double depth = 1;                              //window of requests in flight on one connection
+    int active = 0;                                //connections in use right now
+
+    //current interval
+    chrono::steady_clock::time_point interval_start = chrono::steady_clock::now();
+    long long interval_bytes = 0;
+    long long interval_wait_us = 0;
+    int interval_responses = 0;
+    int interval_peak_active = 0;
+    int interval_peak_pipelined = 0;               //most requests in flight on one connection
+    bool interval_congested = false;
+
+    double base_wait_us = 0;  //lowest average wait of an interval so far, 0 = none yet
+    double last_goodput = 0;  //bytes per second of the previous interval
+};
+
+//the hosts of each shard (shard.h) have a table and a lock of their own, so shards never wait for each other here
+struct alignas(64) aimd_shard
+{
+    map<string, aimd_host> hosts;
+    mutex hosts_m;
+};
+
+static aimd_shard shards[MAX_SHARDS];
+
+static thread_local string current_host = "";
+
+//end the interval if it is over and move the windows, the lock of its shard is held
+static void adjustWindows(aimd_host &host)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    long long elapsed_us = chrono::duration_cast<chrono::microseconds>(now - host.interval_start).count();
+    if (elapsed_us < AIMD_INTERVAL_MS * 1000LL)
+        return;
+    if (host.interval_responses == 0 && !host.interval_congested)
+        return; //nothing measured yet, the interval goes on
+
+    double goodput = host.interval_bytes * 1000000.0 / elapsed_us;
+    double average_wait_us = (host.interval_responses > 0) ? (double)host.interval_wait_us / host.interval_responses : 0;
+
+    bool queueing = host.base_wait_us > 0 && host.interval_responses > 0 &&
+        average_wait_us > host.base_wait_us * AIMD_LATENCY_TOLERANCE + AIMD_LATENCY_SLACK_US;
+
+    if (host.interval_congested || queueing)
+    {
+        host.connections = (max)(1.0, host.connections * AIMD_DECREASE);
+        host.depth = (max)(1.0, host.depth * AIMD_DECREASE);
+    }
+    else if (goodput >= host.last_goodput * AIMD_GOODPUT_DROP)
+    {
+        //only a window that limited the transfer grows (otherwise it would climb without being tested)
+        if (host.interval_peak_active >= (int)host.connections)
+            host.connections = (min)((double)AIMD_MAX_CONNECTIONS, host.connections + 1);
+        if (host.interval_peak_pipelined >= (int)host.depth)
+            host.depth = (min)((double)AIMD_MAX_PIPELINE_DEPTH, host.depth + 1);
+    }
+
+    if (host.interval_responses > 0 && (host.base_wait_us == 0 || average_wait_us < host.base_wait_us))
+        host.base_wait_us = average_wait_us;
+    host.last_goodput = goodput;
+
+    host.interval_start = now;
+    host.interval_bytes = 0;
+    host.interval_wait_us = 0;
+    host.interval_responses = 0;
+    host.interval_peak_active = host.active;
+    host.interval_peak_pipelined = 0;
+    host.interval_congested = false;
+}
+
+void aimdUseHost(const string &host)
+{
+    current_host = host;
+}
+
+void aimdRecordResponse(int status_code, chrono::steady_clock::time_point wait_start)
+{
+    if (fixed_connections > 0 || current_host == "")
+        return;
+
+    long long wait_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - wait_start).count();
+
+    aimd_shard &shard = shards[shardOfHost(current_host)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    aimd_host &host = shard.hosts[current_host];
+    if (status_code == 0 || status_code == 503 || status_code == 429) //no status line, overloaded or rate limited
+        host.interval_congested = true;
+    else
+    {
+        host.interval_wait_us += wait_us;
+        host.interval_responses++;
+    }
+    adjustWindows(host);
+}
+
+void aimdRecordBody(long long bytes)
+{
+    if (fixed_connections > 0 || current_host == "")
+        return;
+
+    aimd_shard &shard = shards[shardOfHost(current_host)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    aimd_host &host = shard.hosts[current_host];
+    host.interval_bytes += bytes;
+    adjustWindows(host);
+}
+
+void aimdRecordFailure()
+{
+    if (fixed_connections > 0 || current_host == "")
+        return;
+
+    aimd_shard &shard = shards[shardOfHost(current_host)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    aimd_host &host = shard.hosts[current_host];
+    host.interval_congested = true;
+    adjustWindows(host);
+}
+
+int aimdPipelineDepth()
+{
+    if (fixed_connections > 0 || current_host == "")
+        return 1;
+
+    aimd_shard &shard = shards[shardOfHost(current_host)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    return (int)shard.hosts[current_host].depth;
+}
+
+void aimdRecordPipelined(int in_flight)
+{
+    if (fixed_connections > 0 || current_host == "")
+        return;
+
+    aimd_shard &shard = shards[shardOfHost(current_host)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    aimd_host &host = shard.hosts[current_host];
+    host.interval_peak_pipelined = (max)(host.interval_peak_pipelined, in_flight);
+}
+
+bool aimdTryAcquireConnection(const string &host_name)
+{
+    aimd_shard &shard = shards[shardOfHost(host_name)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    aimd_host &host = shard.hosts[host_name];
+
+    int window = (fixed_connections > 0) ? fixed_connections : (int)host.connections;
+    if (host.active >= window)
+        return false;
+
+    host.active++;
+    host.interval_peak_active = (max)(host.interval_peak_active, host.active);
+    return true;
+}
+
+void aimdReleaseConnection(const string &host_name)
+{
+    aimd_shard &shard = shards[shardOfHost(host_name)];
+    lock_guard<mutex> lock(shard.hosts_m);
+    aimd_host &host = shard.hosts[host_name];
+    if (host.active > 0)
+        host.active--;
+}
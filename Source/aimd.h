@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include "client.h"
+
+//Adaptive concurrency per host (additive increase, multiplicative decrease)
+//Every host ("host:port" as written in the URL) has two windows: the number of URLs fetched from it at the same
+//time, each on its own connection (fetchAll() in fetch.h waits for room before starting one), and the pipeline depth,
+//the number of requests sent ahead on one connection while the files of a folder are downloaded.
+//The engine reports every status line with the time spent waiting for it, every body and every failure. Once per
+//AIMD_INTERVAL_MS the host's goodput (body bytes per second) and average wait of that interval are compared:
+//- a failure (refused, reset, closed or timed out connection) or a 503/429 halves both windows
+//- a wait above AIMD_LATENCY_TOLERANCE times the lowest interval average seen (requests queue up at the server)
+//  halves them as well
+//- otherwise, as long as goodput has not dropped, each window that was actually filled grows by one
+//--connections=N pins the windows instead (N connections, no pipelining).
+//ref: https://www.rfc-editor.org/rfc/rfc5681#section-3.1 (the TCP congestion window this is modelled after),
+//https://www.rfc-editor.org/rfc/rfc9112#section-9.3.2 (HTTP/1.1 pipelining)
+
+#define AIMD_INITIAL_CONNECTIONS 4      //what the client always used: four URLs at a time
+#define AIMD_MAX_CONNECTIONS 32
+#define AIMD_MAX_PIPELINE_DEPTH 8
+#define AIMD_INTERVAL_MS 250
+#define AIMD_DECREASE 0.5               //factor applied to both windows on congestion
+#define AIMD_LATENCY_TOLERANCE 2.0      //waits this many times the baseline count as queueing at the server
+#define AIMD_LATENCY_SLACK_US 2000      //and only if they are this much above it (loopback and LAN jitter)
+#define AIMD_GOODPUT_DROP 0.9           //goodput below this fraction of the previous interval stops the increase
+
+extern int fixed_connections; //0 = adaptive, N = always N connections per host and no pipelining (--connections)
+
+//the host this thread's requests go to from now on (set for every URL and redirect hop, like useTLS)
+void aimdUseHost(const string &host);
+
+//reports about this thread's host, called by the engine
+void aimdRecordResponse(int status_code, chrono::steady_clock::time_point wait_start);
+void aimdRecordBody(long long bytes);
+void aimdRecordFailure();
+
+int aimdPipelineDepth(); //requests to keep in flight on this thread's connection
+void aimdRecordPipelined(int in_flight); //requests that were in flight on it, the depth grows only once they fill it
+
+//connection slots of a host, for the URL scheduler
+bool aimdTryAcquireConnection(const string &host);
+void aimdReleaseConnection(const string &host);
@@ -0,0 +1,146 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <cassert>
+#include "arena.h"
+
+using namespace std;
+
+#define ARENA_ALIGN 16
+
+//frees the thread's blocks when the thread ends
+struct thread_arena : request_arena
+{
+    ~thread_arena()
+    {
+        while (first != NULL)
+        {
+            arena_block* next = first->next;
+            free(first);
+            first = next;
+        }
+    }
+};
+
+static thread_local thread_arena local_arena;
+
+void (*arena_block_hook)(size_t bytes) = NULL;
+
+static size_t alignUp(size_t n)
+{
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static char* blockData(arena_block* block)
+{
+    return (char*)block + alignUp(sizeof(arena_block));
+}
+
+static arena_block* newBlock(size_t size)
+{
+    arena_block* block = (arena_block*)malloc(alignUp(sizeof(arena_block)) + size);
+    if (block == NULL)
+        throw bad_alloc();
+
+    if (arena_block_hook != NULL)
+        arena_block_hook(alignUp(sizeof(arena_block)) + size);
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+//free every block after the given one
+static void freeBlocksAfter(arena_block* block)
+{
+    arena_block* next = block->next;
+    block->next = NULL;
+
+    while (next != NULL)
+    {
+        arena_block* after = next->next;
+        free(next);
+        next = after;
+    }
+}
+
+request_arena* activeArena()
+{
+    return (local_arena.depth > 0) ? &local_arena : NULL;
+}
+
+void* arenaAllocate(request_arena* arena, size_t bytes)
+{
+    bytes = alignUp(max(bytes, (size_t)1));
+
+    arena_block* block = arena->current;
+    if (block == NULL || block->size - block->used < bytes)
+    {
+        //a body larger than a block gets a block of its own
+        arena_block* next = (block != NULL) ? block->next : arena->first;
+        if (next == NULL || next->size < bytes)
+        {
+            arena_block* fresh = newBlock(max(bytes, (size_t)ARENA_BLOCK_BYTES));
+            if (block == NULL)
+            {
+                fresh->next = arena->first;
+                arena->first = fresh;
+            }
+            else
+            {
+                fresh->next = block->next;
+                block->next = fresh;
+            }
+            next = fresh;
+        }
+
+        next->used = 0;
+        arena->current = block = next;
+    }
+
+    void* p = blockData(block) + block->used;
+    block->used += bytes;
+    return p;
+}
+
+//NUL-terminated copy of text in the active arena, released with its scope
+char* arenaCopy(const char* text, size_t len)
+{
+    request_arena* active = activeArena();
+    assert(active != NULL); //a heap copy would have no owner to free it
+    char* copy = (char*)arenaAllocate(active, len + 1);
+
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+arena_scope::arena_scope()
+{
+    mark_block = local_arena.current;
+    mark_used = (local_arena.current != NULL) ? local_arena.current->used : 0;
+    local_arena.depth++;
+}
+
+arena_scope::~arena_scope()
+{
+    local_arena.depth--;
+
+    if (mark_block == NULL) //nothing was allocated before this scope: keep only the first block, empty
+    {
+        if (local_arena.first != NULL)
+        {
+            freeBlocksAfter(local_arena.first);
+            local_arena.first->used = 0;
+        }
+        local_arena.current = NULL;
+        return;
+    }
+
+    freeBlocksAfter(mark_block);
+    mark_block->used = mark_used;
+    local_arena.current = mark_block;
+}
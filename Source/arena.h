@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//Per-request arena
+//Short-lived request data (host name, GET query, header and chunk-size lines, the fetched listing and its hrefs) is
+//carved out of per-thread blocks instead of the global heap. Freeing is a no-op: everything allocated after an
+//arena_scope was opened is released in one step when that scope ends. The first block of a thread is kept, so a
+//thread that handles request after request stops calling malloc once it is warm.
+//Objects allocated inside a scope must not be used after it ends. Outside every scope the allocator uses the heap.
+
+#define ARENA_BLOCK_BYTES 16384
+
+struct arena_block
+{
+    arena_block* next;
+    size_t size;
+    size_t used;
+};
+
+struct request_arena
+{
+    arena_block* first = NULL;
+    arena_block* current = NULL;
+    int depth = 0;              //number of open arena_scopes on this thread
+};
+
+//opens a scope on the calling thread's arena, nested scopes release only what was allocated after them
+struct arena_scope
+{
+    arena_scope();
+    ~arena_scope();
+
+    arena_block* mark_block;
+    size_t mark_used;
+};
+
+extern void (*arena_block_hook)(size_t bytes); //called for every block malloc()ed, NULL = nobody is counting (microbench.cpp)
+
+request_arena* activeArena();
+void* arenaAllocate(request_arena* arena, size_t bytes);
+char* arenaCopy(const char* text, size_t len); //only inside an arena_scope
+
+template <class T>
+struct arena_allocator
+{
+    typedef T value_type;
+
+    request_arena* arena; //NULL: no scope was open when the container was created, use the heap
+
+    arena_allocator() : arena(activeArena()) {}
+    template <class U> arena_allocator(const arena_allocator<U> &other) : arena(other.arena) {}
+
+    T* allocate(size_t n)
+    {
+        if (arena == NULL)
+            return (T*)::operator new(n * sizeof(T));
+
+        return (T*)arenaAllocate(arena, n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        if (arena == NULL)
+            ::operator delete(p);
+    }
+};
+
+template <class T, class U>
+bool operator==(const arena_allocator<T> &a, const arena_allocator<U> &b) { return a.arena == b.arena; }
+
+template <class T, class U>
+bool operator!=(const arena_allocator<T> &a, const arena_allocator<U> &b) { return a.arena != b.arena; }
+
+typedef basic_string<char, char_traits<char>, arena_allocator<char>> arena_string;
+typedef vector<arena_string, arena_allocator<arena_string>> arena_string_list;
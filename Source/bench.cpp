@@ -0,0 +1,418 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <direct.h>
+#include <psapi.h>
+#include "bench_server.h"
+#include "output.h"
+#include "writebehind.h"
+#include "sink.h"
+#include "h2.h"
+#include "pool.h"
+#include "schedule.h"
+#include "capture.h"
+#include "fetch.h"
+#include "netio.h"
+#include "bench_proxy.h"
+
+//Throughput benchmark: starts the loopback server stand-in (bench_server.cpp) and runs the client against fixed workloads
+//(the folder workload runs twice: HTTP/1.1 requests one after another, then HTTP/2 streams on one connection;
+//the mixed-size folder too: listing order, then largest first over several connections)
+//Every workload prints one JSON object per line on stdout, the client's own console output is discarded while measuring
+//With --replay=file the server plays back a capture (client --capture=file) instead, and the one workload fetches the
+//captured URLs again from it: real response shapes without network access. --serve keeps that server running
+//until Enter is pressed, for pointing the client (or anything else) at it.
+//With --impair the folder is fetched through an impairing proxy (bench_proxy.cpp) instead, once per scenario: added
+//latency, a bandwidth cap, dripped headers and a share of connections stalled, cut short or reset. Every scenario prints
+//completion time percentiles, failed fetches and the bytes retries cost on top of the clean run.
+
+//Note to compiler: the benchmark links the engine without cli.cpp, please compile with:
+//"g++ -std=c++11 -pthread -o bench.exe bench.cpp bench_server.cpp bench_proxy.cpp client.cpp stats.cpp trace.cpp netio.cpp output.cpp writebehind.cpp arena.cpp sink.cpp fetch.cpp hpack.cpp h2.cpp tls.cpp redirect.cpp pool.cpp aimd.cpp progress.cpp schedule.cpp journal.cpp capture.cpp budget.cpp shard.cpp preconnect.cpp layout.cpp -lws2_32 -lssl -lcrypto -lpsapi"
+
+//Usage: bench.exe [--iterations=N] [--size=BYTES] [--files=N] [--file-size=BYTES] [--threads=N]
+//                 [--chunk-size=BYTES] [--port=PORT] [--no-keep-alive] [--chunked-listing] [--mmap]
+//                 [--write-behind=N] [--fsync-every=BYTES] [--sink=null] [--replay=FILE [--replay-timing] [--serve]]
+//                 [--impair]
+
+using namespace std;
+
+struct bench_options
+{
+    int iterations = 20;
+    long long size = 1 << 20;       //body size of the single file workloads
+    int files = 50;                 //number of files in the folder workload
+    long long file_size = 16384;    //size of each file in the folder workload
+    int threads = 4;                //number of concurrent URLs in the parallel workload
+};
+
+//discards everything the client prints to cout
+class null_buffer : public streambuf
+{
+protected:
+    int overflow(int c) { return c; }
+    streamsize xsputn(const char*, streamsize n) { return n; }
+};
+
+//user + kernel time of the whole process (the in-process server is included)
+double cpuSeconds()
+{
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time);
+
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart = user_time.dwLowDateTime;
+    user.HighPart = user_time.dwHighDateTime;
+
+    return (kernel.QuadPart + user.QuadPart) / 1e7; //FILETIME counts 100-nanosecond intervals
+}
+
+size_t peakRSS()
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return pmc.PeakWorkingSetSize;
+}
+
+static null_sink discard_sink;
+static body_sink* bench_sink = NULL; //--sink=null: bodies are counted and dropped instead of written to bench_output
+
+static void fetchURL(char* url, bool multi_threaded)
+{
+    setBodySink(bench_sink);
+    process_address(url, multi_threaded);
+    setBodySink(NULL);
+}
+
+//process_address() takes a modifiable char*, so every URL gets its own buffer
+static vector<char> toURLBuffer(string url)
+{
+    return vector<char>(url.c_str(), url.c_str() + url.length() + 1);
+}
+
+void run_workload(string name, vector<string> urls, long long bytes_per_iteration, int requests_per_iteration, int iterations)
+{
+    null_buffer discard;
+    streambuf* console = cout.rdbuf(&discard);
+
+    double cpu_start = cpuSeconds();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (int it = 0; it < iterations; it++)
+    {
+        vector<vector<char>> url_buffers;
+        for (size_t i = 0; i < urls.size(); i++)
+            url_buffers.push_back(toURLBuffer(urls[i]));
+
+        if (urls.size() == 1)
+            fetchURL(url_buffers[0].data(), false);
+        else
+        {
+            vector<thread> connectionThread;
+            for (size_t i = 0; i < urls.size(); i++)
+                connectionThread.push_back(thread(fetchURL, url_buffers[i].data(), true));
+
+            for (size_t i = 0; i < connectionThread.size(); i++)
+                connectionThread[i].join();
+        }
+    }
+    waitWriteBehind(); //a workload is done when its files are on disk, not when the last byte is queued
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double cpu_seconds = cpuSeconds() - cpu_start;
+    cout.rdbuf(console);
+
+    double total_bytes = double(bytes_per_iteration) * iterations;
+    double total_requests = double(requests_per_iteration) * iterations;
+
+    printf("{\"workload\":\"%s\",\"iterations\":%d,\"bytes\":%.0f,\"requests\":%.0f,\"seconds\":%.6f,"
+           "\"mb_per_s\":%.3f,\"requests_per_s\":%.3f,\"cpu_seconds\":%.6f,\"peak_rss_bytes\":%zu}\n",
+           name.c_str(), iterations, total_bytes, total_requests, seconds,
+           total_bytes / (1024.0 * 1024.0) / seconds, total_requests / seconds, cpu_seconds, peakRSS());
+    fflush(stdout);
+}
+
+//the captured URLs, served by the replay server: only their path is kept
+static vector<string> replayURLs(const capture_file &capture, string base)
+{
+    vector<string> urls;
+    for (size_t i = 0; i < capture.urls.size(); i++)
+    {
+        size_t scheme_end = capture.urls[i].find("://");
+        size_t path_start = capture.urls[i].find('/', (scheme_end == string::npos) ? 0 : scheme_end + 3);
+        urls.push_back(base + ((path_start == string::npos) ? "/" : capture.urls[i].substr(path_start)));
+    }
+    return urls;
+}
+
+//response bytes and requests of one replay of every captured HTTP/1.1 connection
+static void replayVolume(const capture_file &capture, long long &bytes, int &requests)
+{
+    bytes = 0;
+    requests = 0;
+    for (size_t i = 0; i < capture.connections.size(); i++)
+        for (size_t j = 0; j < capture.connections[i].events.size(); j++)
+        {
+            const capture_event &event = capture.connections[i].events[j];
+            if (event.kind == CAPTURE_RECEIVED)
+                bytes += event.data.length();
+            else if (event.kind == CAPTURE_SENT)
+                for (size_t pos = event.data.find("\r\n\r\n"); pos != string::npos; pos = event.data.find("\r\n\r\n", pos + 4))
+                    requests++;
+        }
+}
+
+//completion time below which a share q of the sorted times lie
+static double percentile(const vector<double> &sorted, double q)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)ceil(q * sorted.size());
+    return sorted[(min)(sorted.size() - 1, index == 0 ? 0 : index - 1)];
+}
+
+//fetch url through the proxy iterations times under every scenario, one JSON object per scenario
+//every tenth connection of a fault scenario is faulted, the first one included, so a short run still faults one
+void run_impairment(string url, long long bytes_per_fetch, int iterations)
+{
+    long long fault_point = (max)(1LL, bytes_per_fetch / 2);
+
+    vector<impairment_profile> scenarios(7);
+    scenarios[0].name = "baseline";
+    scenarios[1].name = "latency_20ms";
+    scenarios[1].latency_ms = 20;
+    scenarios[2].name = "bandwidth_8mb";
+    scenarios[2].bandwidth_bps = 8 << 20;
+    scenarios[3].name = "stall";
+    scenarios[3].fault_every = 10;
+    scenarios[3].fault_after = (min)(16384LL, fault_point);
+    scenarios[3].stall_ms = 1500;
+    scenarios[4].name = "truncate";
+    scenarios[4].fault_every = 10;
+    scenarios[4].fault_after = fault_point;
+    scenarios[4].truncate = true;
+    scenarios[5].name = "reset";
+    scenarios[5].fault_every = 10;
+    scenarios[5].fault_after = fault_point;
+    scenarios[5].reset = true;
+    scenarios[6].name = "slow_headers";
+    scenarios[6].header_drip_ms = 1;
+
+    //a stalled connection is given up on after a second instead of the default 30
+    int saved_timeout = io_timeout_ms;
+    io_timeout_ms = 1000;
+
+    fetch_options fetch_opts;
+    fetch_opts.sink = bench_sink;
+    double baseline_bytes = 0;
+
+    for (size_t s = 0; s < scenarios.size(); s++)
+    {
+        set_impairment(scenarios[s]);
+        take_proxy_counters();
+
+        vector<double> times_ms;
+        int failures = 0;
+        for (int it = 0; it < iterations; it++)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            fetch_result result = fetch(url, fetch_opts).get();
+            times_ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            if (!result.success || result.body_bytes != bytes_per_fetch)
+                failures++;
+            closePooledConnections();
+        }
+        waitWriteBehind();
+
+        proxy_counters counters = take_proxy_counters();
+        sort(times_ms.begin(), times_ms.end());
+        double bytes_per_iteration = double(counters.bytes_to_client) / (max)(1, iterations);
+        if (s == 0)
+            baseline_bytes = bytes_per_iteration;
+
+        printf("{\"workload\":\"impair_%s\",\"iterations\":%d,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,"
+               "\"failures\":%d,\"faults\":%lld,\"connections_per_fetch\":%.3f,\"retry_overhead\":%.4f}\n",
+               scenarios[s].name.c_str(), iterations, percentile(times_ms, 0.5), percentile(times_ms, 0.99),
+               percentile(times_ms, 0.999), failures, counters.faults, double(counters.connections) / (max)(1, iterations),
+               baseline_bytes > 0 ? bytes_per_iteration / baseline_bytes - 1 : 0.0);
+        fflush(stdout);
+        if (scenarios[s].fault_every > 0 && counters.faults == 0) //every faulted connection ended before fault_after
+            fprintf(stderr, "Warning: the scenario '%s' injected no fault, its numbers are those of a clean run.\n", scenarios[s].name.c_str());
+    }
+
+    io_timeout_ms = saved_timeout;
+}
+
+static bool parseOption(const char* arg, const char* name, string &value)
+{
+    size_t n = strlen(name);
+    if (strncmp(arg, name, n) != 0 || arg[n] != '=')
+        return false;
+
+    value = arg + n + 1;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    bench_options options;
+    bench_server_config server_config;
+    capture_file capture;
+    bool serve = false;
+    bool impair = false;
+    string value;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (parseOption(argv[i], "--iterations", value))
+            options.iterations = atoi(value.c_str());
+        else if (parseOption(argv[i], "--size", value))
+            options.size = atoll(value.c_str());
+        else if (parseOption(argv[i], "--files", value))
+            options.files = atoi(value.c_str());
+        else if (parseOption(argv[i], "--file-size", value))
+            options.file_size = atoll(value.c_str());
+        else if (parseOption(argv[i], "--threads", value))
+            options.threads = atoi(value.c_str());
+        else if (parseOption(argv[i], "--chunk-size", value))
+            server_config.chunk_size = atoi(value.c_str());
+        else if (parseOption(argv[i], "--port", value))
+            server_config.port = value;
+        else if (strcmp(argv[i], "--no-keep-alive") == 0)
+            server_config.keep_alive = false;
+        else if (strcmp(argv[i], "--chunked-listing") == 0)
+            server_config.chunked_listing = true;
+        else if (strcmp(argv[i], "--mmap") == 0) //same as the client's --mmap
+            output_mmap = true;
+        else if (strcmp(argv[i], "--sink=null") == 0) //network and parsing only, no disk
+            bench_sink = &discard_sink;
+        else if (parseOption(argv[i], "--write-behind", value))
+            write_behind_threads = atoi(value.c_str());
+        else if (parseOption(argv[i], "--fsync-every", value))
+            fsync_every_bytes = atoll(value.c_str());
+        else if (parseOption(argv[i], "--replay", value)) //serve a capture instead of the generated routes
+        {
+            if (!loadCapture(value, capture))
+            {
+                printf("Failed to read the capture '%s'.\n", value.c_str());
+                return 1;
+            }
+            server_config.replay = &capture;
+        }
+        else if (strcmp(argv[i], "--replay-timing") == 0) //with the captured pauses before each response
+            server_config.replay_timing = true;
+        else if (strcmp(argv[i], "--serve") == 0) //only run the server, until Enter is pressed
+            serve = true;
+        else if (strcmp(argv[i], "--impair") == 0) //the folder through the impairing proxy, one line per scenario
+            impair = true;
+        else
+        {
+            printf("Unknown option '%s'.\n", argv[i]);
+            return 1;
+        }
+    }
+
+    WSADATA wsaData;
+    int WSAStartup_Result = WSAStartup(MAKEWORD(2,2), &wsaData);
+    if (WSAStartup_Result != 0)
+    {
+        printf("WSAStartup failed with error: %d\n", WSAStartup_Result);
+        return 1;
+    }
+
+    if (!start_bench_server(server_config))
+    {
+        printf("Failed to start the loopback server on port %s.\n", server_config.port.c_str());
+        WSACleanup();
+        return 1;
+    }
+
+    //downloaded files are written into their own directory so the benchmark never overwrites anything else
+    _mkdir("bench_output");
+    _chdir("bench_output");
+
+    string base = "http://127.0.0.1:" + server_config.port;
+    string size = to_string(options.size);
+
+    if (serve)
+    {
+        printf("Serving on %s, press Enter to stop.\n", base.c_str());
+        getchar();
+    }
+    else if (server_config.replay != NULL)
+    {
+        long long replay_bytes;
+        int replay_requests;
+        replayVolume(capture, replay_bytes, replay_requests);
+        run_workload(server_config.replay_timing ? "replay_timed" : "replay", replayURLs(capture, base), replay_bytes, replay_requests, options.iterations);
+    }
+    else if (impair)
+    {
+        //the proxy listens on the next port and forwards to the server
+        string proxy_port = to_string(atoi(server_config.port.c_str()) + 1);
+        if (!start_bench_proxy(proxy_port, server_config.port))
+            printf("Failed to start the impairing proxy on port %s.\n", proxy_port.c_str());
+        else
+        {
+            run_impairment("http://127.0.0.1:" + proxy_port + "/dir" + to_string(options.files) + "_" + to_string(options.file_size) + "/",
+                           options.files * options.file_size, options.iterations);
+            stop_bench_proxy();
+        }
+    }
+
+    if (serve || impair || server_config.replay != NULL)
+    {
+        stopWriteBehind();
+        closePooledConnections();
+        stop_bench_server();
+        WSACleanup();
+        return 0;
+    }
+
+    run_workload("content_length", {base + "/cl/" + size + ".bin"}, options.size, 1, options.iterations);
+    run_workload("chunked", {base + "/chunked/" + size + ".bin"}, options.size, 1, options.iterations);
+
+    //a 302 answered on the same keep-alive connection before every download, and a 301 that is only followed once
+    run_workload("redirect_302", {base + "/found/cl/" + size + ".bin"}, options.size, 2, options.iterations);
+    run_workload("redirect_301", {base + "/moved/cl/" + size + ".bin"}, options.size, 1, options.iterations);
+    run_workload("folder", {base + "/dir" + to_string(options.files) + "_" + to_string(options.file_size) + "/"},
+                 options.files * options.file_size, options.files + 1, options.iterations);
+
+    //the same folder as streams of one HTTP/2 connection
+    h2c_mode = H2C_PRIOR_KNOWLEDGE;
+    run_workload("folder_h2c", {base + "/dir" + to_string(options.files) + "_" + to_string(options.file_size) + "/"},
+                 options.files * options.file_size, options.files + 1, options.iterations);
+    h2c_mode = H2C_OFF;
+
+    //a few large files at the end of the listing: in listing order on one connection, then sized with HEAD and
+    //spread over several connections largest first (--schedule=largest)
+    string mixed = base + "/mixed" + to_string(options.files) + "_" + to_string(options.file_size) + "/";
+    int large_files = (max)(1, options.files / 10);
+    long long mixed_bytes = (options.files - large_files) * options.file_size + large_files * options.file_size * MIXED_LARGE_FACTOR;
+    run_workload("folder_mixed", {mixed}, mixed_bytes, options.files + 1, options.iterations);
+    folder_schedule = SCHEDULE_LARGEST_FIRST;
+    run_workload("folder_mixed_largest_first", {mixed}, mixed_bytes, 2 * options.files + 1, options.iterations);
+    folder_schedule = SCHEDULE_LISTING;
+
+    vector<string> parallel_urls;
+    for (int i = 0; i < options.threads; i++)
+        parallel_urls.push_back(base + "/cl/" + size + "_" + to_string(i) + ".bin");
+    run_workload("parallel_content_length", parallel_urls, options.size * options.threads, options.threads, options.iterations);
+
+    stopWriteBehind();
+    closePooledConnections();
+    stop_bench_server();
+    WSACleanup();
+
+    return 0;
+}
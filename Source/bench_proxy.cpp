@@ -0,0 +1,360 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "bench_proxy.h"
+
+using namespace std;
+
+typedef chrono::steady_clock proxy_clock;
+
+static string target_port;
+static SOCKET sock_Listen = INVALID_SOCKET;
+static thread acceptThread;
+static vector<thread> connectionThreads;
+static vector<SOCKET> open_sockets;         //shut down by stop_bench_proxy() to wake up every connection thread
+static mutex proxy_m;
+static atomic<bool> proxy_running(false);
+
+static impairment_profile current_profile;
+static long long profile_connections = 0;   //accepted under the current profile, to pick the faulty ones
+static atomic<long long> connections_accepted(0);
+static atomic<long long> bytes_to_client(0);
+static atomic<long long> faults_injected(0);
+
+//one direction of a proxied connection: chunks waiting for their latency to pass
+struct proxy_stream
+{
+    deque<pair<proxy_clock::time_point, string>> chunks;
+    bool eof = false;       //the sender closed its side
+    bool shut = false;      //and that was passed on
+};
+
+//the server's side of the connection, with the state of the impairments
+struct proxy_downstream : proxy_stream
+{
+    proxy_clock::time_point next_send;  //pacing (bandwidth, header drip, stall)
+    long long forwarded = 0;
+    bool faulty = false;
+    bool fault_done = false;
+
+    //response framing, for the header drip
+    bool in_headers = true;
+    string headers;
+    long long body_left = 0;
+    bool framing_lost = false;          //a response without Content-Length: the rest passes undripped
+};
+
+static SOCKET connect_to_target()
+{
+    struct addrinfo *result = NULL, hints;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if (getaddrinfo("127.0.0.1", target_port.c_str(), &hints, &result) != 0)
+        return INVALID_SOCKET;
+
+    SOCKET sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (sock != INVALID_SOCKET && connect(sock, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR)
+    {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    freeaddrinfo(result);
+    return sock;
+}
+
+static bool send_all(SOCKET sock, const char* buff, int len)
+{
+    int sent = 0;
+    while (sent < len)
+    {
+        int byte_sent = send(sock, buff + sent, len - sent, 0);
+        if (byte_sent <= 0)
+            return false;
+        sent += byte_sent;
+    }
+    return true;
+}
+
+//how many of the next bytes of the server's stream may go out in one piece, and whether they are header bytes
+static size_t next_piece(proxy_downstream &down, const impairment_profile &profile, size_t available)
+{
+    if (profile.header_drip_ms > 0 && !down.framing_lost)
+    {
+        if (down.in_headers)
+            return 1;
+        available = (size_t)(min)((long long)available, down.body_left);
+    }
+    if (down.faulty && !down.fault_done && down.forwarded < profile.fault_after)
+        available = (size_t)(min)((long long)available, profile.fault_after - down.forwarded);
+    if (profile.bandwidth_bps > 0)
+        available = (min)(available, (size_t)16384);
+    return available;
+}
+
+//follow the responses through the stream, so that only their headers are dripped
+static void track_framing(proxy_downstream &down, const char* data, size_t len)
+{
+    if (down.framing_lost)
+        return;
+
+    if (!down.in_headers)
+    {
+        down.body_left -= len;
+        if (down.body_left == 0)
+            down.in_headers = true;
+        return;
+    }
+
+    down.headers.append(data, len);
+    if (down.headers.length() < 4 || down.headers.compare(down.headers.length() - 4, 4, "\r\n\r\n") != 0)
+        return;
+
+    size_t field = down.headers.find("\r\nContent-Length:");
+    if (field == string::npos)
+        down.framing_lost = true;
+    else
+    {
+        down.body_left = atoll(down.headers.c_str() + field + 17);
+        down.in_headers = (down.body_left == 0);
+    }
+    down.headers = "";
+}
+
+//forward what is due of the server's stream, false when the connection is over (a fault, or the client is gone)
+static bool deliver_downstream(SOCKET client, proxy_downstream &down, const impairment_profile &profile, proxy_clock::time_point now)
+{
+    while (!down.chunks.empty() && down.chunks.front().first <= now && down.next_send <= now)
+    {
+        string &chunk = down.chunks.front().second;
+        size_t piece = next_piece(down, profile, chunk.length());
+
+        if (!send_all(client, chunk.c_str(), (int)piece))
+            return false;
+        track_framing(down, chunk.c_str(), piece);
+        down.forwarded += piece;
+        bytes_to_client += piece;
+        chunk.erase(0, piece);
+        if (chunk.empty())
+            down.chunks.pop_front();
+
+        if (profile.header_drip_ms > 0 && !down.framing_lost && down.in_headers)
+            down.next_send = now + chrono::milliseconds(profile.header_drip_ms);
+        else if (profile.bandwidth_bps > 0)
+            down.next_send = now + chrono::microseconds(piece * 1000000 / profile.bandwidth_bps);
+
+        if (down.faulty && !down.fault_done && down.forwarded >= profile.fault_after)
+        {
+            down.fault_done = true;
+            faults_injected++;
+            if (profile.reset) //RST instead of FIN: no lingering on close
+            {
+                struct linger hard_close;
+                hard_close.l_onoff = 1;
+                hard_close.l_linger = 0;
+                setsockopt(client, SOL_SOCKET, SO_LINGER, (const char*)&hard_close, sizeof(hard_close));
+                return false;
+            }
+            if (profile.truncate)
+                return false;
+            down.next_send = now + chrono::milliseconds(profile.stall_ms);
+        }
+    }
+
+    return true;
+}
+
+//receive what is there, false once the sender closed its side (or failed)
+static bool receive_into(SOCKET sock, proxy_stream &stream, int latency_ms)
+{
+    char recvbuff[16384];
+    int byte_recv = recv(sock, recvbuff, sizeof(recvbuff), 0);
+    if (byte_recv <= 0)
+    {
+        stream.eof = true;
+        return false;
+    }
+
+    stream.chunks.push_back(make_pair(proxy_clock::now() + chrono::milliseconds(latency_ms), string(recvbuff, byte_recv)));
+    return true;
+}
+
+static void proxy_connection(SOCKET client, impairment_profile profile, bool faulty)
+{
+    SOCKET server = connect_to_target();
+    if (server != INVALID_SOCKET)
+    {
+        lock_guard<mutex> lock(proxy_m);
+        open_sockets.push_back(server);
+    }
+
+    proxy_stream up;
+    proxy_downstream down;
+    down.faulty = faulty;
+    down.next_send = proxy_clock::now();
+
+    while (proxy_running && server != INVALID_SOCKET && !(up.shut && down.shut))
+    {
+        //wait for bytes, or until the next chunk or paced piece is due
+        proxy_clock::time_point now = proxy_clock::now();
+        proxy_clock::time_point wake = now + chrono::milliseconds(50);
+        if (!up.chunks.empty())
+            wake = (min)(wake, up.chunks.front().first);
+        if (!down.chunks.empty())
+            wake = (min)(wake, (max)(down.chunks.front().first, down.next_send));
+
+        WSAPOLLFD poll_fds[2];
+        poll_fds[0].fd = client;
+        poll_fds[0].events = up.eof ? 0 : POLLRDNORM;
+        poll_fds[0].revents = 0;
+        poll_fds[1].fd = server;
+        poll_fds[1].events = down.eof ? 0 : POLLRDNORM;
+        poll_fds[1].revents = 0;
+        int wait_ms = (int)(max)(0LL, (long long)chrono::duration_cast<chrono::milliseconds>(wake - now).count());
+        WSAPoll(poll_fds, 2, wait_ms);
+
+        if (!up.eof && (poll_fds[0].revents & (POLLRDNORM | POLLHUP | POLLERR)))
+            receive_into(client, up, profile.latency_ms);
+        if (!down.eof && (poll_fds[1].revents & (POLLRDNORM | POLLHUP | POLLERR)))
+            receive_into(server, down, profile.latency_ms);
+
+        now = proxy_clock::now();
+        bool failed = false;
+        while (!up.chunks.empty() && up.chunks.front().first <= now && !failed)
+        {
+            failed = !send_all(server, up.chunks.front().second.c_str(), (int)up.chunks.front().second.length());
+            up.chunks.pop_front();
+        }
+        if (failed || !deliver_downstream(client, down, profile, now))
+            break;
+
+        //a side that closed is closed on the other side once everything it sent was forwarded
+        if (up.eof && up.chunks.empty() && !up.shut)
+        {
+            shutdown(server, SD_SEND);
+            up.shut = true;
+        }
+        if (down.eof && down.chunks.empty() && !down.shut)
+        {
+            shutdown(client, SD_SEND);
+            down.shut = true;
+        }
+    }
+
+    lock_guard<mutex> lock(proxy_m);
+    for (size_t i = 0; i < open_sockets.size(); )
+        if (open_sockets[i] == client || open_sockets[i] == server)
+            open_sockets.erase(open_sockets.begin() + i);
+        else
+            i++;
+    if (server != INVALID_SOCKET)
+        closesocket(server);
+    closesocket(client);
+}
+
+static void accept_connections()
+{
+    while (proxy_running)
+    {
+        SOCKET sock_Client = accept(sock_Listen, NULL, NULL);
+        if (sock_Client == INVALID_SOCKET)
+            continue;
+
+        int no_delay = 1;
+        setsockopt(sock_Client, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+
+        lock_guard<mutex> lock(proxy_m);
+        bool faulty = current_profile.fault_every > 0 && profile_connections % current_profile.fault_every == 0;
+        profile_connections++;
+        connections_accepted++;
+        open_sockets.push_back(sock_Client);
+        connectionThreads.push_back(thread(proxy_connection, sock_Client, current_profile, faulty));
+    }
+}
+
+bool start_bench_proxy(string listen_port, string target)
+{
+    target_port = target;
+
+    struct addrinfo *result = NULL, hints;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo("127.0.0.1", listen_port.c_str(), &hints, &result) != 0)
+        return false;
+
+    sock_Listen = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (sock_Listen == INVALID_SOCKET)
+    {
+        freeaddrinfo(result);
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(sock_Listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    if (bind(sock_Listen, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR || listen(sock_Listen, SOMAXCONN) == SOCKET_ERROR)
+    {
+        freeaddrinfo(result);
+        closesocket(sock_Listen);
+        sock_Listen = INVALID_SOCKET;
+        return false;
+    }
+
+    freeaddrinfo(result);
+    proxy_running = true;
+    acceptThread = thread(accept_connections);
+
+    return true;
+}
+
+void stop_bench_proxy()
+{
+    if (!proxy_running)
+        return;
+
+    proxy_running = false;
+    shutdown(sock_Listen, SD_BOTH);
+    closesocket(sock_Listen);
+    sock_Listen = INVALID_SOCKET;
+    acceptThread.join();
+
+    {
+        lock_guard<mutex> lock(proxy_m);
+        for (size_t i = 0; i < open_sockets.size(); i++)
+            shutdown(open_sockets[i], SD_BOTH);
+    }
+
+    //the connection threads notice within one poll interval
+    for (size_t i = 0; i < connectionThreads.size(); i++)
+        connectionThreads[i].join();
+    connectionThreads.clear();
+}
+
+void set_impairment(const impairment_profile &profile)
+{
+    lock_guard<mutex> lock(proxy_m);
+    current_profile = profile;
+    profile_connections = 0;
+}
+
+proxy_counters take_proxy_counters()
+{
+    proxy_counters counters;
+    counters.connections = connections_accepted.exchange(0);
+    counters.bytes_to_client = bytes_to_client.exchange(0);
+    counters.faults = faults_injected.exchange(0);
+    return counters;
+}
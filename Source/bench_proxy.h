@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include "client.h"
+
+//Network impairment proxy used by the benchmark target (bench.cpp --impair)
+//Sits between the client and the loopback server stand-in and forwards both directions, one thread per connection.
+//Every connection accepted gets the profile set at that moment:
+//  latency       every chunk is held latency_ms before it is forwarded, each way
+//  bandwidth     the server's bytes reach the client at no more than bandwidth_bps
+//  header drip   the status line and headers of every response go out one byte at a time, header_drip_ms apart
+//                (responses are told apart by their Content-Length, a chunked one ends the dripping on its connection)
+//and every fault_every-th of them, from the first one accepted under the profile (so every run faults the same
+//connections and even a short run faults one), one fault once fault_after bytes of the server's stream were
+//forwarded: a stall of stall_ms, a close (the body is cut short), or a reset (RST, the client sees an error instead
+//of the end of the stream). A connection that ends before fault_after bytes gets no fault.
+
+struct impairment_profile
+{
+    string name;
+    int latency_ms = 0;
+    long long bandwidth_bps = 0;    //0 = unlimited
+    int header_drip_ms = 0;         //0 = headers in one piece
+    int fault_every = 0;            //every Nth connection gets the fault, 0 = none
+    long long fault_after = 0;      //bytes of the server's stream before it
+    int stall_ms = 0;
+    bool truncate = false;
+    bool reset = false;
+};
+
+struct proxy_counters
+{
+    long long connections = 0;      //accepted since the last reset
+    long long bytes_to_client = 0;  //forwarded from the server
+    long long faults = 0;           //stalls, closes and resets injected
+};
+
+bool start_bench_proxy(string listen_port, string target_port);
+void stop_bench_proxy();
+void set_impairment(const impairment_profile &profile); //for the connections accepted from now on, counted from 0
+proxy_counters take_proxy_counters();                   //and resets them
@@ -0,0 +1,744 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <deque>
+#include <chrono>
+#include "bench_server.h"
+#include "h2.h"
+#include "hpack.h"
+
+//ref to winsock2.h server example code: https://learn.microsoft.com/en-us/windows/win32/winsock/complete-server-code
+
+using namespace std;
+
+static bench_server_config server_config;
+static SOCKET sock_Listen = INVALID_SOCKET;
+static thread acceptThread;
+static vector<thread> connectionThreads;
+static mutex connections_m;
+static atomic<bool> server_running(false);
+
+static char pattern[65536]; //every body is built from this buffer
+
+static vector<string> replay_first_lines; //request line each captured connection started with, "" = not HTTP/1.1
+static vector<int> replay_plays;           //times each captured connection was played
+static mutex replay_m;
+
+static bool send_all(SOCKET sock, const char* buff, int len)
+{
+    while (len > 0)
+    {
+        int byte_sent = send(sock, buff, len, 0);
+        if (byte_sent == SOCKET_ERROR || byte_sent == 0)
+            return false;
+
+        buff += byte_sent;
+        len -= byte_sent;
+    }
+
+    return true;
+}
+
+static bool send_pattern(SOCKET sock, long long bytes)
+{
+    while (bytes > 0)
+    {
+        int n = (int)min<long long>(bytes, sizeof(pattern));
+        if (!send_all(sock, pattern, n))
+            return false;
+
+        bytes -= n;
+    }
+
+    return true;
+}
+
+static bool send_header(SOCKET sock, string extra_headers)
+{
+    string header = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n";
+    header += server_config.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    header += extra_headers + "\r\n";
+
+    return send_all(sock, header.c_str(), (int)header.length());
+}
+
+static bool send_content_length_body(SOCKET sock, long long bytes)
+{
+    if (!send_header(sock, "Content-Length: " + to_string(bytes) + "\r\n"))
+        return false;
+
+    return send_pattern(sock, bytes);
+}
+
+static bool send_chunked_body(SOCKET sock, const char* body, long long bytes)
+{
+    if (!send_header(sock, "Transfer-Encoding: chunked\r\n"))
+        return false;
+
+    char chunk_line[32];
+    while (bytes > 0)
+    {
+        int n = (int)min<long long>(bytes, server_config.chunk_size);
+        int line_len = sprintf(chunk_line, "%x\r\n", n);
+        if (!send_all(sock, chunk_line, line_len))
+            return false;
+
+        if (body != NULL)
+        {
+            if (!send_all(sock, body, n))
+                return false;
+            body += n;
+        }
+        else if (!send_pattern(sock, n))
+            return false;
+
+        if (!send_all(sock, "\r\n", 2))
+            return false;
+
+        bytes -= n;
+    }
+
+    return send_all(sock, "0\r\n\r\n", 5);
+}
+
+static string listing_body(int num_files)
+{
+    string listing = "<html><head><title>Index</title></head><body>\n";
+    for (int i = 0; i < num_files; i++)
+        listing += "<a href=\"file" + to_string(i) + ".bin\">file" + to_string(i) + ".bin</a><br>\n";
+    listing += "</body></html>\n";
+
+    return listing;
+}
+
+static bool send_listing(SOCKET sock, int num_files)
+{
+    string listing = listing_body(num_files);
+
+    if (server_config.chunked_listing)
+        return send_chunked_body(sock, listing.c_str(), listing.length());
+
+    if (!send_header(sock, "Content-Length: " + to_string(listing.length()) + "\r\nContent-Type: text/html\r\n"))
+        return false;
+
+    return send_all(sock, listing.c_str(), (int)listing.length());
+}
+
+static bool send_redirect(SOCKET sock, int status_code, string location, bool head)
+{
+    string body = "<html><body>Moved to <a href=\"" + location + "\">" + location + "</a></body></html>\n";
+    string response = "HTTP/1.1 " + to_string(status_code) + (status_code == 301 ? " Moved Permanently" : " Found") + "\r\n";
+    response += "Location: " + location + "\r\nContent-Type: text/html\r\nContent-Length: " + to_string(body.length()) + "\r\n";
+    response += server_config.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    response += "\r\n" + (head ? "" : body);
+
+    return send_all(sock, response.c_str(), (int)response.length());
+}
+
+static bool send_not_found(SOCKET sock)
+{
+    string response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    return send_all(sock, response.c_str(), (int)response.length());
+}
+
+enum route
+{
+    ROUTE_CONTENT_LENGTH,
+    ROUTE_CHUNKED,
+    ROUTE_LISTING,
+    ROUTE_MOVED,
+    ROUTE_FOUND,
+    ROUTE_NOT_FOUND
+};
+
+//the last tenth of a /mixed folder (at least one file) is MIXED_LARGE_FACTOR times larger than the rest
+static long long mixed_file_size(int num_files, long long bytes, int file_idx)
+{
+    int large_files = (max)(1, num_files / 10);
+    return (file_idx >= num_files - large_files) ? bytes * MIXED_LARGE_FACTOR : bytes;
+}
+
+//bytes: body size, num_files: number of hrefs of a listing, location: target of a redirect
+static route find_route(string path, long long &bytes, int &num_files, string &location)
+{
+    int file_idx;
+    char tail;
+
+    if (path.compare(0, 7, "/moved/") == 0)
+    {
+        location = path.substr(6);
+        return ROUTE_MOVED;
+    }
+    if (path.compare(0, 7, "/found/") == 0)
+    {
+        location = path.substr(6);
+        return ROUTE_FOUND;
+    }
+
+    if (sscanf(path.c_str(), "/cl/%lld", &bytes) == 1)
+        return ROUTE_CONTENT_LENGTH;
+    if (sscanf(path.c_str(), "/chunked/%lld", &bytes) == 1)
+        return ROUTE_CHUNKED;
+    if (sscanf(path.c_str(), "/dir%d_%lld/file%d.bi%c", &num_files, &bytes, &file_idx, &tail) == 4)
+        return ROUTE_CONTENT_LENGTH;
+    if (sscanf(path.c_str(), "/dir%d_%lld", &num_files, &bytes) == 2 && path.find('/', 1) == string::npos) //a folder without its trailing slash
+    {
+        location = path + "/";
+        return ROUTE_MOVED;
+    }
+    if (sscanf(path.c_str(), "/dir%d_%lld/%c", &num_files, &bytes, &tail) == 2)
+        return ROUTE_LISTING;
+
+    if (sscanf(path.c_str(), "/mixed%d_%lld/file%d.bi%c", &num_files, &bytes, &file_idx, &tail) == 4)
+    {
+        bytes = mixed_file_size(num_files, bytes, file_idx);
+        return ROUTE_CONTENT_LENGTH;
+    }
+    if (sscanf(path.c_str(), "/mixed%d_%lld/%c", &num_files, &bytes, &tail) == 2)
+        return ROUTE_LISTING;
+
+    return ROUTE_NOT_FOUND;
+}
+
+//answer a single request, returns false if the connection has to be closed
+//head: the same status line and headers, without the body
+static bool serve_request(SOCKET sock, string path, bool head)
+{
+    long long bytes;
+    int num_files;
+    string location;
+    bool sent;
+
+    route path_route = find_route(path, bytes, num_files, location);
+    if (head && path_route == ROUTE_CONTENT_LENGTH)
+        return send_header(sock, "Content-Length: " + to_string(bytes) + "\r\n") && server_config.keep_alive;
+    if (head && path_route == ROUTE_CHUNKED)
+        return send_header(sock, "Transfer-Encoding: chunked\r\n") && server_config.keep_alive;
+    if (head && path_route == ROUTE_LISTING)
+        return send_header(sock, "Content-Length: " + to_string(listing_body(num_files).length()) + "\r\nContent-Type: text/html\r\n") && server_config.keep_alive;
+
+    switch (path_route)
+    {
+        case ROUTE_CONTENT_LENGTH:
+            sent = send_content_length_body(sock, bytes);
+            break;
+        case ROUTE_CHUNKED:
+            sent = send_chunked_body(sock, NULL, bytes);
+            break;
+        case ROUTE_LISTING:
+            sent = send_listing(sock, num_files);
+            break;
+        case ROUTE_MOVED:
+            sent = send_redirect(sock, 301, location, head);
+            break;
+        case ROUTE_FOUND:
+            sent = send_redirect(sock, 302, location, head);
+            break;
+        default:
+            sent = send_not_found(sock);
+            break;
+    }
+
+    return sent && server_config.keep_alive;
+}
+
+//h2c: every request is a stream of one connection, the bodies are sent round-robin, one DATA frame per stream
+//at a time, within the flow control windows the client grants
+struct h2_server_stream
+{
+    long long left = 0;         //body bytes still to send
+    string body;                //listing body, "" = the byte pattern
+    long long window = H2_DEFAULT_WINDOW;
+};
+
+struct h2_server_connection
+{
+    SOCKET sock;
+    string pending;             //received bytes not parsed yet
+    hpack_decoder decoder;
+    map<unsigned int, h2_server_stream> streams;
+    unsigned int next_stream = 0;   //round-robin position
+    long long window = H2_DEFAULT_WINDOW;
+    long long initial_window = H2_DEFAULT_WINDOW;
+};
+
+static bool recv_pending(h2_server_connection &conn, size_t n)
+{
+    char recvbuff[16384];
+    while (conn.pending.length() < n)
+    {
+        int byte_recv = recv(conn.sock, recvbuff, sizeof(recvbuff), 0);
+        if (byte_recv <= 0)
+            return false;
+
+        conn.pending.append(recvbuff, byte_recv);
+    }
+
+    return true;
+}
+
+static bool h2_send(h2_server_connection &conn, int type, int flags, unsigned int stream_id, const string &payload)
+{
+    string frame = h2Frame(type, flags, stream_id, payload);
+    return send_all(conn.sock, frame.data(), (int)frame.length());
+}
+
+//answer the request on stream_id with its HEADERS frame, the body follows in DATA frames
+static bool h2_start_response(h2_server_connection &conn, unsigned int stream_id, string path)
+{
+    long long bytes = 0;
+    int num_files = 0;
+    h2_server_stream stream;
+    stream.window = conn.initial_window;
+
+    string location;
+    string block;
+    route path_route = find_route(path, bytes, num_files, location);
+    switch (path_route)
+    {
+        case ROUTE_CONTENT_LENGTH:
+        case ROUTE_CHUNKED: //HTTP/2 has no chunked encoding, the body simply ends with END_STREAM
+            stream.left = bytes;
+            hpackEncode(block, ":status", "200");
+            hpackEncode(block, "content-type", "application/octet-stream");
+            break;
+        case ROUTE_LISTING:
+            stream.body = listing_body(num_files);
+            stream.left = stream.body.length();
+            hpackEncode(block, ":status", "200");
+            hpackEncode(block, "content-type", "text/html");
+            break;
+        case ROUTE_MOVED:
+        case ROUTE_FOUND:
+            hpackEncode(block, ":status", (path_route == ROUTE_MOVED) ? "301" : "302");
+            hpackEncode(block, "location", location);
+            return h2_send(conn, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, stream_id, block);
+        default:
+            hpackEncode(block, ":status", "404");
+            return h2_send(conn, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, stream_id, block);
+    }
+
+    hpackEncode(block, "content-length", to_string(stream.left));
+    if (stream.left == 0)
+        return h2_send(conn, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, stream_id, block);
+
+    conn.streams[stream_id] = stream;
+    return h2_send(conn, H2_HEADERS, H2_FLAG_END_HEADERS, stream_id, block);
+}
+
+//handle one frame from conn.pending, returns false when the connection has to be closed
+static bool h2_handle_frame(h2_server_connection &conn)
+{
+    if (!recv_pending(conn, H2_FRAME_HEADER_BYTES))
+        return false;
+
+    const unsigned char* header = (const unsigned char*)conn.pending.data();
+    size_t len = (header[0] << 16) | (header[1] << 8) | header[2];
+    int type = header[3];
+    int flags = header[4];
+    unsigned int stream_id = h2ReadUint32(header + 5) & 0x7fffffff;
+
+    if (!recv_pending(conn, H2_FRAME_HEADER_BYTES + len))
+        return false;
+
+    string payload = conn.pending.substr(H2_FRAME_HEADER_BYTES, len);
+    conn.pending.erase(0, H2_FRAME_HEADER_BYTES + len);
+    const unsigned char* data = (const unsigned char*)payload.data();
+
+    if (type == H2_SETTINGS && !(flags & H2_FLAG_ACK))
+    {
+        for (size_t i = 0; i + 6 <= len; i += 6)
+        {
+            if (((data[i] << 8) | data[i + 1]) != H2_SETTINGS_INITIAL_WINDOW_SIZE)
+                continue;
+
+            //a new initial window changes the window of every open stream by the difference
+            long long new_window = h2ReadUint32(data + i + 2);
+            for (map<unsigned int, h2_server_stream>::iterator it = conn.streams.begin(); it != conn.streams.end(); it++)
+                it->second.window += new_window - conn.initial_window;
+            conn.initial_window = new_window;
+        }
+
+        return h2_send(conn, H2_SETTINGS, H2_FLAG_ACK, 0, "");
+    }
+
+    if (type == H2_WINDOW_UPDATE && len == 4)
+    {
+        long long increment = h2ReadUint32(data) & 0x7fffffff;
+        if (stream_id == 0)
+            conn.window += increment;
+        else if (conn.streams.count(stream_id))
+            conn.streams[stream_id].window += increment;
+    }
+    else if (type == H2_HEADERS) //requests are small, a header block never needs CONTINUATION frames
+    {
+        size_t offset = (flags & H2_FLAG_PADDED) ? 1 : 0;
+        size_t pad = (flags & H2_FLAG_PADDED) ? data[0] : 0;
+        if (flags & H2_FLAG_PRIORITY)
+            offset += 5;
+
+        vector<hpack_header> headers;
+        if (!(flags & H2_FLAG_END_HEADERS) || offset + pad > len || !hpackDecode(conn.decoder, data + offset, len - offset - pad, headers))
+            return false;
+
+        string path = "";
+        for (size_t i = 0; i < headers.size(); i++)
+            if (headers[i].name == ":path")
+                path = headers[i].value;
+
+        return h2_start_response(conn, stream_id, path);
+    }
+    else if (type == H2_RST_STREAM)
+        conn.streams.erase(stream_id);
+    else if (type == H2_PING && !(flags & H2_FLAG_ACK))
+        return h2_send(conn, H2_PING, H2_FLAG_ACK, 0, payload);
+    else if (type == H2_GOAWAY)
+        return false;
+
+    return true;
+}
+
+//send one DATA frame of the next stream (round-robin) that has data and window left, returns false if none can send
+static bool h2_send_data(h2_server_connection &conn, bool &failed)
+{
+    if (conn.window <= 0 || conn.streams.empty())
+        return false;
+
+    map<unsigned int, h2_server_stream>::iterator it = conn.streams.upper_bound(conn.next_stream);
+    for (size_t tried = 0; tried < conn.streams.size(); tried++, it++)
+    {
+        if (it == conn.streams.end())
+            it = conn.streams.begin();
+
+        h2_server_stream &stream = it->second;
+        if (stream.window <= 0)
+            continue;
+
+        int n = (int)min(min(stream.left, (long long)H2_MAX_FRAME_SIZE), min(stream.window, conn.window));
+        bool last = (n == stream.left);
+        string frame_data = stream.body.empty() ? string(pattern, n) : stream.body.substr(stream.body.length() - stream.left, n);
+
+        conn.next_stream = it->first;
+        stream.left -= n;
+        stream.window -= n;
+        conn.window -= n;
+
+        if (last)
+            conn.streams.erase(it);
+
+        failed = !h2_send(conn, H2_DATA, last ? H2_FLAG_END_STREAM : 0, conn.next_stream, frame_data);
+        return true;
+    }
+
+    return false;
+}
+
+static bool h2_readable(SOCKET sock, int wait_ms)
+{
+    WSAPOLLFD poll_fd;
+    poll_fd.fd = sock;
+    poll_fd.events = POLLRDNORM;
+    poll_fd.revents = 0;
+
+    return WSAPoll(&poll_fd, 1, wait_ms) > 0;
+}
+
+//pending: what was received after the HTTP/1.1 request, upgraded_path: the request that asked for "Upgrade: h2c"
+//("" when the client started with the preface), it is answered on stream 1
+static void serve_h2c(SOCKET sock, string pending, string upgraded_path)
+{
+    h2_server_connection conn;
+    conn.sock = sock;
+    conn.pending = pending;
+
+    if (upgraded_path != "")
+    {
+        string switching = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        if (!send_all(sock, switching.c_str(), (int)switching.length()))
+            return;
+    }
+
+    if (!recv_pending(conn, H2_PREFACE_BYTES) || conn.pending.compare(0, H2_PREFACE_BYTES, H2_PREFACE) != 0)
+        return;
+    conn.pending.erase(0, H2_PREFACE_BYTES);
+
+    if (!h2_send(conn, H2_SETTINGS, 0, 0, h2Setting(H2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_OPEN_STREAMS)))
+        return;
+    if (upgraded_path != "" && !h2_start_response(conn, 1, upgraded_path))
+        return;
+
+    bool failed = false;
+    while (server_running && !failed)
+    {
+        //frames the client has already sent come first (window updates unblock streams)
+        bool sent = false;
+        if (conn.pending.empty() && !h2_readable(sock, 0))
+            sent = h2_send_data(conn, failed);
+
+        if (!sent && (!conn.pending.empty() || h2_readable(sock, 100)))
+            failed = !h2_handle_frame(conn);
+    }
+}
+
+//a replayed connection: request heads that arrived and were not played against the capture yet
+struct replay_client
+{
+    SOCKET sock;
+    string pending;
+    deque<string> request_lines;
+    bool closed = false;
+};
+
+static string first_line(const string &text)
+{
+    return text.substr(0, text.find("\r\n"));
+}
+
+//wait up to wait_ms for more bytes, then split off every complete request head
+static void replay_receive(replay_client &client, int wait_ms)
+{
+    if (!client.closed && h2_readable(client.sock, wait_ms))
+    {
+        char recvbuff[4096];
+        int byte_recv = recv(client.sock, recvbuff, sizeof(recvbuff), 0);
+        if (byte_recv <= 0)
+            client.closed = true;
+        else
+            client.pending.append(recvbuff, byte_recv);
+    }
+
+    size_t end_of_headers;
+    while ((end_of_headers = client.pending.find("\r\n\r\n")) != string::npos)
+    {
+        client.request_lines.push_back(first_line(client.pending));
+        client.pending.erase(0, end_of_headers + 4);
+    }
+}
+
+//the least played captured connection that started with request_line, -1 if there is none
+static int pick_replay_connection(const string &request_line)
+{
+    lock_guard<mutex> lock(replay_m);
+    int picked = -1;
+    for (size_t i = 0; i < replay_first_lines.size(); i++)
+        if (request_line != "" && replay_first_lines[i] == request_line && (picked < 0 || replay_plays[i] < replay_plays[picked]))
+            picked = (int)i;
+
+    if (picked >= 0)
+        replay_plays[picked]++;
+    return picked;
+}
+
+//play one captured connection: its requests are awaited, its responses sent as they were received
+//false when the capture ends with the server closing the connection (or sending failed)
+static bool play_connection(replay_client &client, const captured_connection &captured)
+{
+    chrono::steady_clock::time_point base_real = chrono::steady_clock::now();
+    long long base_captured = 0;
+
+    for (size_t i = 0; i < captured.events.size() && server_running; i++)
+    {
+        const capture_event &event = captured.events[i];
+        if (event.kind == CAPTURE_SENT)
+        {
+            //one pipelined send may hold several requests
+            size_t heads = 0;
+            for (size_t pos = event.data.find("\r\n\r\n"); pos != string::npos; pos = event.data.find("\r\n\r\n", pos + 4))
+                heads++;
+
+            for (size_t h = 0; h < (max)(heads, (size_t)1); h++)
+            {
+                chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(REPLAY_REQUEST_WAIT_MS);
+                while (client.request_lines.empty() && !client.closed && chrono::steady_clock::now() < deadline)
+                    replay_receive(client, 10);
+                if (!client.request_lines.empty())
+                    client.request_lines.pop_front();
+            }
+
+            base_real = chrono::steady_clock::now();
+            base_captured = event.time_us;
+        }
+        else if (event.kind == CAPTURE_RECEIVED || event.kind == CAPTURE_SERVER_CLOSED)
+        {
+            if (server_config.replay_timing) //as long after the request as the server took in the capture
+                this_thread::sleep_until(base_real + chrono::microseconds(event.time_us - base_captured));
+
+            if (event.kind == CAPTURE_SERVER_CLOSED || !send_all(client.sock, event.data.c_str(), (int)event.data.length()))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static void serve_replay(SOCKET sock)
+{
+    replay_client client;
+    client.sock = sock;
+
+    while (server_running && !client.closed)
+    {
+        replay_receive(client, 100);
+        if (client.request_lines.empty())
+            continue;
+
+        int played = pick_replay_connection(client.request_lines.front());
+        if (played < 0 || !play_connection(client, server_config.replay->connections[played]))
+            break;
+    }
+
+    shutdown(sock, SD_SEND);
+    closesocket(sock);
+}
+
+static void serve_connection(SOCKET sock)
+{
+    if (server_config.replay != NULL)
+    {
+        serve_replay(sock);
+        return;
+    }
+
+    string pending = "";
+    char recvbuff[4096];
+
+    while (server_running)
+    {
+        size_t end_of_headers = pending.find("\r\n\r\n");
+        if (end_of_headers == string::npos)
+        {
+            int byte_recv = recv(sock, recvbuff, sizeof(recvbuff), 0);
+            if (byte_recv <= 0) //client closed the connection
+                break;
+
+            pending.append(recvbuff, byte_recv);
+            continue;
+        }
+
+        if (server_config.h2c && pending.compare(0, 14, "PRI * HTTP/2.0") == 0) //h2c with prior knowledge
+        {
+            serve_h2c(sock, pending, "");
+            break;
+        }
+
+        //request line: "GET <path> HTTP/1.1" (or HEAD)
+        string request = pending.substr(0, end_of_headers);
+        pending.erase(0, end_of_headers + 4);
+
+        size_t first_space = request.find(' ');
+        size_t second_space = request.find(' ', first_space + 1);
+        if (first_space == string::npos || second_space == string::npos)
+            break;
+
+        string path = request.substr(first_space + 1, second_space - first_space - 1);
+        if (server_config.h2c && request.find("\r\nUpgrade: h2c") != string::npos) //answered on stream 1 of the upgraded connection
+        {
+            serve_h2c(sock, pending, path);
+            break;
+        }
+
+        if (!serve_request(sock, path, request.compare(0, 5, "HEAD ") == 0))
+            break;
+    }
+
+    shutdown(sock, SD_SEND);
+    closesocket(sock);
+}
+
+static void accept_connections()
+{
+    while (server_running)
+    {
+        SOCKET sock_Client = accept(sock_Listen, NULL, NULL);
+        if (sock_Client == INVALID_SOCKET)
+            continue;
+
+        //header and body are sent separately, do not let Nagle's algorithm hold the body back
+        int no_delay = 1;
+        setsockopt(sock_Client, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+
+        lock_guard<mutex> lock(connections_m);
+        connectionThreads.push_back(thread(serve_connection, sock_Client));
+    }
+}
+
+bool start_bench_server(bench_server_config config)
+{
+    server_config = config;
+    memset(pattern, 'x', sizeof(pattern));
+
+    replay_first_lines.clear();
+    if (config.replay != NULL)
+        for (size_t i = 0; i < config.replay->connections.size(); i++)
+        {
+            const vector<capture_event> &events = config.replay->connections[i].events;
+            string line = "";
+            for (size_t j = 0; j < events.size() && line == ""; j++)
+                if (events[j].kind == CAPTURE_SENT)
+                    line = first_line(events[j].data);
+            replay_first_lines.push_back(line.compare(0, 3, "PRI") == 0 ? "" : line);
+        }
+    replay_plays.assign(replay_first_lines.size(), 0);
+
+    struct addrinfo *result = NULL,
+                    hints;
+
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo("127.0.0.1", server_config.port.c_str(), &hints, &result) != 0)
+        return false;
+
+    sock_Listen = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (sock_Listen == INVALID_SOCKET)
+    {
+        freeaddrinfo(result);
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(sock_Listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+    if (bind(sock_Listen, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR || listen(sock_Listen, SOMAXCONN) == SOCKET_ERROR)
+    {
+        freeaddrinfo(result);
+        closesocket(sock_Listen);
+        sock_Listen = INVALID_SOCKET;
+        return false;
+    }
+
+    freeaddrinfo(result);
+    server_running = true;
+    acceptThread = thread(accept_connections);
+
+    return true;
+}
+
+void stop_bench_server()
+{
+    if (!server_running)
+        return;
+
+    server_running = false;
+    shutdown(sock_Listen, SD_BOTH); //wakes up the blocked accept() on Linux, closesocket() does it on Windows
+    closesocket(sock_Listen);
+    sock_Listen = INVALID_SOCKET;
+    acceptThread.join();
+
+    //clients always close their side once done, so every connection thread is about to return
+    lock_guard<mutex> lock(connections_m);
+    for (size_t i = 0; i < connectionThreads.size(); i++)
+        connectionThreads[i].join();
+    connectionThreads.clear();
+}
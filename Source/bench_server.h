@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "client.h"
+#include "capture.h"
+
+//Loopback HTTP/1.1 and h2c server stand-in used by the benchmark target (bench.cpp)
+//Routes served (every body is a repeated byte pattern, so the server itself costs next to nothing):
+//  /cl/<bytes>[_<tag>].bin      -> "Content-Length" body of <bytes> bytes (<tag> only keeps file names apart)
+//  /chunked/<bytes>[_<tag>].bin -> "Transfer-Encoding: chunked" body of <bytes> bytes, split by chunk_size
+//  /dir<N>_<bytes>/             -> directory listing (index.html) with N hrefs "file<i>.bin"
+//  /dir<N>_<bytes>/file<i>.bin  -> "Content-Length" body of <bytes> bytes
+//  /mixed<N>_<bytes>/           -> listing like /dir, but the last tenth of its files (at least one) are
+//                                  MIXED_LARGE_FACTOR times larger: the files a listing order download finishes late
+//HEAD requests get the same status line and headers without the body.
+//The same routes are served over HTTP/2 to a client that starts with the preface or asks for "Upgrade: h2c".
+//With a replay capture (capture.h) the routes are off: a connection is answered with the captured connection that
+//started with the same request line (the least played one), byte for byte, each response once the requests it
+//followed have arrived (after REPLAY_REQUEST_WAIT_MS without them it goes ahead, the capture may have pipelined).
+//Once its script is over the next request picks another one. Only HTTP/1.1 connections can be replayed.
+#define MIXED_LARGE_FACTOR 32
+#define REPLAY_REQUEST_WAIT_MS 200
+
+struct bench_server_config
+{
+    string port = "8080";
+    int chunk_size = 16384;         //size of each chunk of a chunked body
+    bool keep_alive = true;         //false: close the connection after every response
+    bool chunked_listing = false;   //send directory listings chunked instead of with "Content-Length"
+    bool h2c = true;                //false: HTTP/1.1 only, the preface is rejected and "Upgrade: h2c" ignored
+    const capture_file* replay = NULL; //serve these recorded connections instead of the routes, owned by the caller
+    bool replay_timing = false;        //keep the captured pauses before each response, instead of full speed
+};
+
+bool start_bench_server(bench_server_config config);
+void stop_bench_server();
@@ -0,0 +1,69 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <mutex>
+#include "budget.h"
+
+using namespace std;
+
+long long memory_budget_bytes = 0;
+
+static long long in_use = 0;
+static long long peak_use = 0;
+static mutex budget_m;
+
+//budget_m is held
+static void take(memory_reservation &reservation, long long bytes)
+{
+    in_use += bytes;
+    peak_use = (max)(peak_use, in_use);
+    reservation.bytes += bytes;
+}
+
+bool budgetTryReserve(memory_reservation &reservation, long long bytes)
+{
+    lock_guard<mutex> lock(budget_m);
+    if (memory_budget_bytes > 0 && in_use + bytes > memory_budget_bytes)
+        return false;
+
+    take(reservation, bytes);
+    return true;
+}
+
+void budgetCharge(memory_reservation &reservation, long long bytes)
+{
+    lock_guard<mutex> lock(budget_m);
+    take(reservation, bytes);
+}
+
+void budgetRelease(memory_reservation &reservation)
+{
+    if (reservation.bytes == 0)
+        return;
+
+    lock_guard<mutex> lock(budget_m);
+    in_use -= reservation.bytes;
+    reservation.bytes = 0;
+}
+
+memory_reservation::~memory_reservation()
+{
+    budgetRelease(*this);
+}
+
+bool budgetHasRoom()
+{
+    lock_guard<mutex> lock(budget_m);
+    return memory_budget_bytes <= 0 || in_use < memory_budget_bytes;
+}
+
+long long budgetInUse()
+{
+    lock_guard<mutex> lock(budget_m);
+    return in_use;
+}
+
+long long budgetPeak()
+{
+    lock_guard<mutex> lock(budget_m);
+    return peak_use;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "client.h"
+
+//Global memory budget (--memory-budget) and hard limits on response framing
+//The buffers that grow with what a server sends draw from one process-wide byte budget: the write-behind buffer pool
+//(writebehind.h) and the bodies HTTP/2 streams keep in memory (h2.h). A folder listing over HTTP/1.1 is scanned as it
+//arrives (client.h) and never held whole.
+//Once the budget is used up, the write-behind pool stops growing (its receivers wait for one of its buffers to come
+//back) and fetchAll() (fetch.h) starts no further URL. Memory a transfer already needs to make progress (the first
+//write-behind buffer, an HTTP/2 body of a stream whose connection cannot stop) is counted without waiting, so it
+//still throttles everything else.
+//Independently of the budget, a status line, header line or chunk-size line longer than MAX_HEADER_LINE_BYTES, or a
+//header section with more than MAX_HEADER_LINES lines or MAX_HEADER_BYTES bytes, rejects the response.
+
+#define MAX_HEADER_LINE_BYTES 16384
+#define MAX_HEADER_LINES 128
+#define MAX_HEADER_BYTES (64 << 10)
+
+extern long long memory_budget_bytes;   //0 = no budget (--memory-budget)
+
+//bytes one buffer holds from the budget, given back when it is released or destroyed
+struct memory_reservation
+{
+    long long bytes = 0;
+
+    ~memory_reservation();
+};
+
+bool budgetTryReserve(memory_reservation &reservation, long long bytes);   //false when there is no room
+void budgetCharge(memory_reservation &reservation, long long bytes);       //counted even above the budget
+void budgetRelease(memory_reservation &reservation);
+
+bool budgetHasRoom();       //below the budget, a new URL may start
+long long budgetInUse();
+long long budgetPeak();     //highest use since the start
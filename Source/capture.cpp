@@ -0,0 +1,189 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include "capture.h"
+
+using namespace std;
+
+#define CAPTURE_MAGIC "DLCAPTURE1\n"
+
+struct capture_connection_state
+{
+    long long id;
+    chrono::steady_clock::time_point opened;
+};
+
+static ofstream capture_out;
+static atomic<bool> capturing(false); //read on every send and receive, without the lock
+static map<SOCKET, capture_connection_state> open_connections;
+static long long next_connection = 1;
+static mutex capture_m;
+
+static void appendVarint(string &out, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        out += (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+static bool readVarint(const string &in, size_t &pos, unsigned long long &value)
+{
+    value = 0;
+    for (int shift = 0; pos < in.length() && shift < 64; shift += 7)
+    {
+        unsigned char byte = (unsigned char)in[pos++];
+        value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+//capture_m is held
+static void writeEvent(long long connection, int kind, long long time_us, const char* data, int len)
+{
+    string header;
+    appendVarint(header, connection);
+    header += (char)kind;
+    appendVarint(header, time_us);
+    appendVarint(header, len);
+
+    capture_out.write(header.c_str(), header.length());
+    capture_out.write(data, len);
+}
+
+bool startCapture(const string &path)
+{
+    lock_guard<mutex> lock(capture_m);
+    capture_out.open(path, ios::binary | ios::trunc);
+    if (!capture_out.is_open())
+        return false;
+
+    capture_out.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC) - 1);
+    open_connections.clear();
+    next_connection = 1;
+    capturing = true;
+    return true;
+}
+
+bool stopCapture()
+{
+    lock_guard<mutex> lock(capture_m);
+    if (!capturing)
+        return true;
+
+    capturing = false;
+    open_connections.clear();
+    bool written = capture_out.good();
+    capture_out.close();
+    return written;
+}
+
+void captureURL(const string &url)
+{
+    if (!capturing)
+        return;
+
+    lock_guard<mutex> lock(capture_m);
+    writeEvent(0, CAPTURE_URL, 0, url.c_str(), (int)url.length());
+}
+
+void captureOpen(SOCKET sock)
+{
+    if (!capturing)
+        return;
+
+    lock_guard<mutex> lock(capture_m);
+    capture_connection_state &state = open_connections[sock]; //a handle the OS reuses starts a new connection
+    state.id = next_connection++;
+    state.opened = chrono::steady_clock::now();
+    writeEvent(state.id, CAPTURE_OPEN, 0, "", 0);
+}
+
+void captureData(SOCKET sock, int kind, const char* data, int len)
+{
+    if (!capturing)
+        return;
+
+    lock_guard<mutex> lock(capture_m);
+    map<SOCKET, capture_connection_state>::iterator it = open_connections.find(sock);
+    if (it == open_connections.end()) //opened before the capture started
+        return;
+
+    long long time_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - it->second.opened).count();
+    writeEvent(it->second.id, kind, time_us, data, len);
+}
+
+void captureClose(SOCKET sock, int kind)
+{
+    if (!capturing)
+        return;
+
+    lock_guard<mutex> lock(capture_m);
+    map<SOCKET, capture_connection_state>::iterator it = open_connections.find(sock);
+    if (it == open_connections.end())
+        return;
+
+    long long time_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - it->second.opened).count();
+    writeEvent(it->second.id, kind, time_us, "", 0);
+    if (kind == CAPTURE_CLIENT_CLOSED)
+        open_connections.erase(it);
+}
+
+bool loadCapture(const string &path, capture_file &capture)
+{
+    ifstream in(path, ios::binary);
+    if (!in.is_open())
+        return false;
+
+    string contents((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    if (contents.compare(0, sizeof(CAPTURE_MAGIC) - 1, CAPTURE_MAGIC) != 0)
+        return false;
+
+    map<unsigned long long, size_t> connection_index; //connection number -> index in capture.connections
+    size_t pos = sizeof(CAPTURE_MAGIC) - 1;
+    while (pos < contents.length())
+    {
+        unsigned long long connection, time_us, length;
+        //a capture cut short (the client was killed) ends with a partial record, the events before it still count
+        if (!readVarint(contents, pos, connection) || pos >= contents.length())
+            break;
+        int kind = (unsigned char)contents[pos++];
+        if (!readVarint(contents, pos, time_us) || !readVarint(contents, pos, length) || length > contents.length() - pos)
+            break;
+
+        capture_event event;
+        event.kind = kind;
+        event.time_us = (long long)time_us;
+        event.data = contents.substr(pos, (size_t)length);
+        pos += (size_t)length;
+
+        if (kind == CAPTURE_URL)
+        {
+            capture.urls.push_back(event.data);
+            continue;
+        }
+
+        if (kind == CAPTURE_OPEN)
+        {
+            connection_index[connection] = capture.connections.size();
+            capture.connections.push_back(captured_connection());
+        }
+
+        map<unsigned long long, size_t>::iterator it = connection_index.find(connection);
+        if (it != connection_index.end())
+            capture.connections[it->second].events.push_back(event);
+    }
+
+    return true;
+}
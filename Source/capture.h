@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include "client.h"
+
+//Capture of the raw byte streams of every connection (--capture), for replay by the benchmark (bench.cpp --replay)
+//Everything the client sends and receives on a connection is recorded as it passes through netio.cpp: status lines,
+//headers, chunk framing and bodies exactly as the server sent them (after TLS decryption, so https:// captures
+//replay over plain TCP). Each event carries the time since its connection was opened, so a replay can keep the
+//original pauses. The URLs the run was given are recorded too, they are what the replay fetches again.
+//File: "DLCAPTURE1\n", then one record per event: varint connection, one byte kind, varint microseconds since the
+//connection was opened, varint length and that many bytes.
+
+enum capture_event_kind
+{
+    CAPTURE_URL = 1,            //a URL the run fetched (connection 0, not tied to a connection)
+    CAPTURE_OPEN,               //a connection was established
+    CAPTURE_SENT,               //bytes the client sent
+    CAPTURE_RECEIVED,           //bytes the server sent
+    CAPTURE_SERVER_CLOSED,      //the server closed the connection
+    CAPTURE_CLIENT_CLOSED       //the client closed it
+};
+
+struct capture_event
+{
+    int kind;
+    long long time_us;
+    string data;
+};
+
+struct captured_connection
+{
+    vector<capture_event> events;
+};
+
+struct capture_file
+{
+    vector<string> urls;
+    vector<captured_connection> connections; //in the order they were opened
+};
+
+bool startCapture(const string &path); //false if the file cannot be created
+bool stopCapture();                    //false if writing it failed
+bool loadCapture(const string &path, capture_file &capture);
+
+//called by netio.cpp (and fetch.cpp for the URLs), no-ops unless a capture is running
+void captureURL(const string &url);
+void captureOpen(SOCKET sock);
+void captureData(SOCKET sock, int kind, const char* data, int len);
+void captureClose(SOCKET sock, int kind);
@@ -0,0 +1,252 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <io.h>
+#include <fcntl.h>
+#include "client.h"
+#include "stats.h"
+#include "trace.h"
+#include "netio.h"
+#include "output.h"
+#include "writebehind.h"
+#include "sink.h"
+#include "fetch.h"
+#include "h2.h"
+#include "tls.h"
+#include "redirect.h"
+#include "pool.h"
+#include "aimd.h"
+#include "progress.h"
+#include "schedule.h"
+#include "journal.h"
+#include "capture.h"
+#include "budget.h"
+#include "shard.h"
+#include "preconnect.h"
+#include "layout.h"
+
+//Command line front end: parses the options and runs every URL through fetchAll() (fetch.h)
+
+//Note to compiler: if you're using g++ to compile this code please add "-lws2_32 -lssl -lcrypto" after "g++ -std=c++11 -pthread cli.cpp client.cpp stats.cpp trace.cpp netio.cpp output.cpp writebehind.cpp arena.cpp sink.cpp fetch.cpp hpack.cpp h2.cpp tls.cpp redirect.cpp pool.cpp aimd.cpp progress.cpp schedule.cpp journal.cpp capture.cpp budget.cpp shard.cpp preconnect.cpp layout.cpp [other files]"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+    //Split the parameters into options (starting with "--") and URLs
+    vector<char*> URLs;
+    string stats_file = "";
+    string trace_file = "";
+    string sink_name = "file";
+    vector<fetch_job> manifest_jobs;
+    string journal_file = "";
+    string capture_file = "";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+            URLs.push_back(argv[i]);
+        else if (strcmp(argv[i], "--stats") == 0) //per-phase timing, dumped to stderr at exit
+            stats_enabled = true;
+        else if (strncmp(argv[i], "--stats=", 8) == 0) //per-phase timing, dumped into the given file at exit
+        {
+            stats_enabled = true;
+            stats_file = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--timeout=", 10) == 0) //longest wait for a single connect/send/recv, in milliseconds
+            io_timeout_ms = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--request-timeout=", 18) == 0) //longest time a whole request may take, in milliseconds
+            request_timeout_ms = atoi(argv[i] + 18);
+        else if (strncmp(argv[i], "--retries=", 10) == 0) //reconnect attempts after a failed request, 0 = until ESC
+            max_retries = atoi(argv[i] + 10);
+        else if (strcmp(argv[i], "--mmap") == 0) //preallocate and memory-map files whose Content-Length is known
+            output_mmap = true;
+        else if (strncmp(argv[i], "--write-behind=", 15) == 0) //hand received buffers to N disk-writer threads
+            write_behind_threads = atoi(argv[i] + 15);
+        else if (strncmp(argv[i], "--fsync-every=", 14) == 0) //flush a file to disk after every N bytes written
+            fsync_every_bytes = atoll(argv[i] + 14);
+        else if (strncmp(argv[i], "--sink=", 7) == 0) //where the bodies go: file (default), stdout, null or tar:file
+            sink_name = argv[i] + 7;
+        else if (strcmp(argv[i], "--h2c") == 0) //HTTP/2 over cleartext, the server is known to speak it
+            h2c_mode = H2C_PRIOR_KNOWLEDGE;
+        else if (strcmp(argv[i], "--h2c=upgrade") == 0) //HTTP/2 over cleartext if the server accepts "Upgrade: h2c"
+            h2c_mode = H2C_UPGRADE;
+        else if (strcmp(argv[i], "--insecure") == 0) //https:// without checking the server certificate
+            tls_verify = false;
+        else if (strncmp(argv[i], "--cacert=", 9) == 0) //trust the CA certificates in this PEM file for https://
+            tls_ca_file = argv[i] + 9;
+        else if (strncmp(argv[i], "--max-redirects=", 16) == 0) //redirects followed per URL, 0 = none
+            max_redirects = atoi(argv[i] + 16);
+        else if (strncmp(argv[i], "--connections=", 14) == 0) //fixed connections per host without pipelining, instead of adapting
+            fixed_connections = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--progress=off") == 0) //no progress dashboard, the receive loops skip the counters too
+            progress_enabled = false;
+        else if (strcmp(argv[i], "--progress") == 0 || strcmp(argv[i], "--progress=on") == 0)
+            progress_enabled = true;
+        else if (strcmp(argv[i], "--schedule=largest") == 0) //HEAD the files of a folder, then largest first over several connections
+            folder_schedule = SCHEDULE_LARGEST_FIRST;
+        else if (strcmp(argv[i], "--schedule=smallest") == 0) //the same, smallest first
+            folder_schedule = SCHEDULE_SMALLEST_FIRST;
+        else if (strcmp(argv[i], "--schedule=listing") == 0)
+            folder_schedule = SCHEDULE_LISTING;
+        else if (strncmp(argv[i], "--manifest=", 11) == 0) //more URLs, one per line with an optional priority
+        {
+            if (!loadManifest(argv[i] + 11, manifest_jobs))
+            {
+                fprintf(stderr, "Failed to read the manifest '%s'.\n", argv[i] + 11);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[i], "--journal=", 10) == 0) //record every URL's state, skip what an earlier run finished
+            journal_file = argv[i] + 10;
+        else if (strncmp(argv[i], "--capture=", 10) == 0) //record the raw bytes of every connection, for bench.exe --replay
+            capture_file = argv[i] + 10;
+        else if (strncmp(argv[i], "--memory-budget=", 16) == 0) //bytes the buffers of every transfer may hold together
+            memory_budget_bytes = atoll(argv[i] + 16);
+        else if (strcmp(argv[i], "--shards=auto") == 0) //one shard per core
+            engine_shards = (int)thread::hardware_concurrency();
+        else if (strncmp(argv[i], "--shards=", 9) == 0) //split the hosts between N groups of workers, each pinned to a core
+            engine_shards = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--fanout=", 9) == 0) //place the files N levels of hashed directories deep
+            layout_fanout = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--preconnect=", 13) == 0) //open the connections of up to N waiting URLs ahead of them
+            preconnect_budget = atoi(argv[i] + 13);
+        else if (strcmp(argv[i], "--fast-open") == 0) //TCP Fast Open to addresses connected to before (Linux)
+            tcp_fast_open = true;
+        else if (strncmp(argv[i], "--trace=", 8) == 0) //timeline of every connection, written into the given file
+            trace_file = argv[i] + 8;
+        else
+        {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[i]);
+            return 1;
+        }
+    }
+
+    //Validate parameters (the aplication is used in command promt)
+    if (URLs.size() < 1 && manifest_jobs.empty() && journal_file == "")
+    {
+        fprintf(stderr, "Incorrect syntax. Please use: %s [--stats[=file]] [--trace=file] [--timeout=ms] [--request-timeout=ms] [--retries=N] [--mmap] [--write-behind=N] [--fsync-every=bytes] [--sink=file|stdout|null|tar:file] [--h2c[=upgrade]] [--cacert=file] [--insecure] [--max-redirects=N] [--connections=N] [--progress[=off]] [--schedule=listing|largest|smallest] [--manifest=file] [--journal=file] [--capture=file] [--memory-budget=bytes] [--shards=N|auto] [--preconnect=N] [--fast-open] [--fanout=N] [HTTP or HTTPS URL(s)].\n", argv[0]);
+        return 1;
+    }
+
+    //Bodies go to files unless another sink was chosen
+    fetch_options options;
+    stdout_sink pipe;
+    null_sink discard;
+    tar_sink archive;
+    if (sink_name == "stdout") //the log moves to stderr so that stdout carries nothing but the bodies
+    {
+        _setmode(_fileno(stdout), _O_BINARY); //no CRLF translation of binary bodies
+        setConsoleTarget(cerr);
+        options.sink = &pipe;
+    }
+    else if (sink_name == "null")
+        options.sink = &discard;
+    else if (sink_name.compare(0, 4, "tar:") == 0) //every body packed into one archive
+    {
+        if (!archive.open(sink_name.substr(4)))
+        {
+            fprintf(stderr, "Failed to create the archive '%s'.\n", sink_name.substr(4).c_str());
+            return 1;
+        }
+        options.sink = &archive;
+    }
+    else if (sink_name != "file")
+    {
+        fprintf(stderr, "Unknown sink '%s'. Please use file, stdout, null or tar:file.\n", sink_name.c_str());
+        return 1;
+    }
+
+    //Initialize Winsock
+    WSADATA wsaData;
+    int WSAStartup_Result = WSAStartup(MAKEWORD(2,2), &wsaData);
+    if (WSAStartup_Result != 0) 
+    {
+        fprintf(stderr, "WSAStartup failed with error: %d\n", WSAStartup_Result);
+        return 1;
+    }
+
+    //Every URL is one fetch of the library
+    //with only one URL the log uses the single transfer layout (no thread blocks)
+    options.console = true;
+    vector<fetch_job> jobs(URLs.size());
+    for (size_t i = 0; i < URLs.size(); i++)
+        jobs[i].url = URLs[i];
+    jobs.insert(jobs.end(), manifest_jobs.begin(), manifest_jobs.end());
+
+    //a journal from an earlier run: without URLs, whatever it did not finish runs again
+    if (journal_file != "")
+    {
+        if (!openJournal(journal_file))
+        {
+            fprintf(stderr, "Failed to open the journal '%s'.\n", journal_file.c_str());
+            WSACleanup();
+            return 1;
+        }
+        if (jobs.empty())
+            journalUnfinished(jobs);
+    }
+    options.exclusive_console = (jobs.size() == 1);
+
+    if (capture_file != "" && !startCapture(capture_file))
+    {
+        fprintf(stderr, "Failed to create the capture '%s'.\n", capture_file.c_str());
+        WSACleanup();
+        return 1;
+    }
+
+    if (trace_file != "" && !trace_start(trace_file))
+    {
+        fprintf(stderr, "Failed to create the trace '%s'.\n", trace_file.c_str());
+        WSACleanup();
+        return 1;
+    }
+
+    //as many URLs at the same time as their hosts keep up with (aimd.h), every one gets its turn
+    startProgressReporter();
+    vector<fetch_result> results = fetchAll(jobs, options);
+    stopProgressReporter();
+
+    if (journal_file != "")
+    {
+        int skipped = 0;
+        for (size_t i = 0; i < results.size(); i++)
+            if (results[i].from_journal)
+                skipped++;
+        if (skipped > 0)
+            fprintf(stderr, "%d URL(s) already done according to the journal '%s'.\n", skipped, journal_file.c_str());
+    }
+
+    stopWriteBehind(); //every file is on disk before the program exits
+    if (journal_file != "" && !closeJournal()) //after the writers, nothing is journaled as done before its files are
+        fprintf(stderr, "Failed to write the journal '%s'.\n", journal_file.c_str());
+    closePooledConnections();
+
+    if (!stopCapture())
+        fprintf(stderr, "Failed to write the capture to '%s'.\n", capture_file.c_str());
+
+    if (sink_name == "null")
+        fprintf(stderr, "Received %lld bytes (discarded).\n", discard.bytes.load());
+
+    if (options.sink == &archive && !archive.finish())
+        fprintf(stderr, "Failed to write the archive '%s'.\n", sink_name.substr(4).c_str());
+
+    if (memory_budget_bytes > 0)
+        fprintf(stderr, "Buffers held at most %lld of the %lld byte memory budget.\n", budgetPeak(), memory_budget_bytes);
+
+    if (!stats_dump(stats_file))
+        fprintf(stderr, "Failed to write timing statistics to '%s'.\n", stats_file.c_str());
+
+    if (!trace_finish())
+        fprintf(stderr, "Failed to write the trace to '%s'.\n", trace_file.c_str());
+
+    //Clean up
+    WSACleanup();
+
+    return 0;
+}
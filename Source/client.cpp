@@ -6,22 +6,58 @@
 #include <string>
 #include <vector>
 #include <cstring>
+#include <climits>
 #include <thread>
+#include <chrono>
+#include <memory>
 #include <direct.h>
 #include <mutex> //stop the print result to be overlap from each thread, learn more: https://stackoverflow.com/questions/25848615/c-printing-cout-overlaps-in-multithreading
 #include "client.h"
-
-//Note to compiler: if you're using g++ to compile this code please add "-lws2_32" after "g++ -std=c++11 -pthread client.cpp [other files]"
-//For example: "g++ -std=c++11 -pthread client.cpp -lws2_32"
+#include "stats.h"
+#include "trace.h"
+#include "netio.h"
+#include "output.h"
+#include "writebehind.h"
+#include "arena.h"
+#include "sink.h"
+#include "fetch.h"
+#include "h2.h"
+#include "tls.h"
+#include "redirect.h"
+#include "pool.h"
+#include "aimd.h"
+#include "progress.h"
+#include "schedule.h"
+#include "journal.h"
+#include "budget.h"
+#include "layout.h"
+
+//Note to compiler: if you're using g++ to compile this code please add "-lws2_32 -lssl -lcrypto" after "g++ -std=c++11 -pthread cli.cpp client.cpp stats.cpp trace.cpp netio.cpp output.cpp writebehind.cpp arena.cpp sink.cpp fetch.cpp hpack.cpp h2.cpp tls.cpp redirect.cpp pool.cpp aimd.cpp progress.cpp schedule.cpp journal.cpp capture.cpp budget.cpp shard.cpp preconnect.cpp layout.cpp [other files]"
+//For example: "g++ -std=c++11 -pthread cli.cpp client.cpp stats.cpp -lws2_32"
 
 //ref to winsock2.h example code: https://learn.microsoft.com/en-us/windows/win32/winsock/complete-client-code
 //ref to multithreading in C++: https://www.geeksforgeeks.org/multithreading-in-cpp/
 
 #define PORT "80"
+#define HTTPS_PORT "443"
 
 using namespace  std;
 
 mutex m;
+
+//discards everything written to it
+class console_discard_buffer : public streambuf
+{
+protected:
+    int overflow(int c) { return c; }
+    streamsize xsputn(const char*, streamsize n) { return n; }
+};
+
+static thread_local console_discard_buffer discard_buffer;
+static thread_local ostream discard_stream(&discard_buffer);
+static thread_local bool console_enabled = true;
+static ostream* console_target = &cout;
+
 //common MIME file types that can be send through HTTP: https://developer.mozilla.org/en-US/docs/Web/HTTP/Basics_of_HTTP/MIME_types/Common_types
 vector<string> MIME_file_types{".aac", ".abw", ".arc", ".avif", ".avi", ".azw", ".bin", ".bmp",
                                 ".bz", ".bz2", ".cda", ".csh", ".css", ".csv", ".doc", ".docx",
@@ -33,297 +69,396 @@ vector<string> MIME_file_types{".aac", ".abw", ".arc", ".avif", ".avi", ".azw",
                                 ".vsd", ".wav", ".weba", ".webm", ".webp", ".woff", ".woff2", ".xhtml", ".xls",
                                 ".xlsx", ".xml", ".xul", ".zip", ".3gp", ".3g2", ".7z", ".tex"};
 
-int main(int argc, char* argv[])
+//console output of the calling thread: cout (or the stream set by setConsoleTarget), or nothing for a library fetch
+//that did not ask for a log
+ostream& console()
 {
-    //Validate parameters (the aplication is used in command promt)
-    if (argc < 2)
-    {
-        printf("Incorrect syntax. Please use: %s [HTTP or HTTPS URL(s)].\n", argv[0]);
-        return 1;
-    }
-
-    //Initialize Winsock
-    WSADATA wsaData;
-    int WSAStartup_Result = WSAStartup(MAKEWORD(2,2), &wsaData);
-    if (WSAStartup_Result != 0) 
-    {
-        printf("WSAStartup failed with error: %d\n", WSAStartup_Result);
-        return 1;
-    }
-
-    //Check if there is only one URL to be processed or there are multiple of them
-    if (argc == 2) //only one URL
-        process_address(argv[1], false);
-    else if (argc > 2) //more than 1 URL, using multithreading to process all at the same time
-    {
-        thread connectionThread[4]; //support up to 4 connections at the same time
-        int connections = min(4, argc - 1); //if user enter more than 4 URLs, only the first 4 are processed
-        //this methods is to ensure hardware safety because different machines support different numbers of maximum threads
-
-        for (int i = 0; i < connections; i++)
-            connectionThread[i] = thread(process_address, argv[i + 1], true);
+    return console_enabled ? *console_target : discard_stream;
+}
 
-        for (int i = 0; i < connections; i++)
-            connectionThread[i].join();
-    }
+void setConsoleOutput(bool enabled)
+{
+    console_enabled = enabled;
+}
 
-    //Clean up
-    WSACleanup();
+bool consoleOutputEnabled()
+{
+    return console_enabled;
+}
 
-    return 0;
+//for every thread, call before any transfer starts (e.g. cerr when the bodies themselves go to stdout)
+void setConsoleTarget(ostream &stream)
+{
+    console_target = &stream;
 }
 
 void process_address(char* addr, bool multi_threaded)
 {
-    //Getting the host name from the URL
-    char* host_name = getHostnameFromURL(addr);
-    if (host_name == NULL)
+    arena_scope connection_scope; //host names, GET queries and the file lists are released together when the URL is done
+    long long connection_start = trace_now();
+
+    //a URL that answered with 301 or 308 earlier in this run goes straight to its target
+    string url = permanentRedirectTarget(addr);
+    if (url != addr)
     {
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Failed to retrieve host name.\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Moved permanently to '" << url << "' (remembered from an earlier redirect).\n";
             m.unlock();
         }
         else
-            cout << "\nFailed to retrieve host name.\n";
-        
-        return;
+            console() << "\nMoved permanently to '" << url << "' (remembered from an earlier redirect).\n";
     }
 
-    //sock_Connect is used for connecting to web servers
-    SOCKET sock_Connect = INVALID_SOCKET; 
-
-    //Create Internet address structure
-    //learn more: https://learn.microsoft.com/en-us/windows/win32/api/ws2def/ns-ws2def-addrinfoa
-    //ref code: https://learn.microsoft.com/en-us/windows/win32/winsock/complete-client-code
-    struct addrinfo *result = NULL,
-                    *ptr = NULL,
-                    hints;
-
-    ZeroMemory( &hints, sizeof(hints) );
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM; //TCP
-    hints.ai_protocol = IPPROTO_TCP;
-    
-    //Resolve the server address and port
-    //Please make sure your IP Routing is enabled on your Windows IP Configuration (to check: type ipconfig /all in cmd)
-    //To enable IP Routing, see: https://www.wikihow.com/Enable-IP-Routing-on-Windows-10
-    int getAddrInfo_Result = getaddrinfo(host_name, PORT, &hints, &result);
-    if (getAddrInfo_Result != 0) 
+    url_connection connection;
+    for (int hops = 0; ; hops++)
     {
-        if (getAddrInfo_Result == 11001)
+        vector<char> url_buffer(url.c_str(), url.c_str() + url.length() + 1); //the request functions take a modifiable char*
+        response_info response;
+        request_address(url_buffer.data(), multi_threaded, connection, response);
+
+        if (response.location == "" || fetchAborted())
+            break;
+
+        string target = resolveLocation(url, response.location);
+        if (hops >= max_redirects)
         {
             if (multi_threaded)
             {
                 m.lock();
-                cout << "----------------------------------------------------------------------------------------------------------------------\n";
-                cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                cout << "Host not found.\nPlease make sure:\n";
-                cout << "- You have connected to Internet.\n";
-                cout << "- You have 'IP Routing' enabled on your Windows IP Configuration (type 'ipconfig /all' in cmd to check).\n";
-                cout << "- You have entered the URL with HTTP or HTTPS protocol.\n";
-                
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Not following the redirect to '" << target << "', " << max_redirects << " redirect(s) already followed. Terminating.\n";
                 m.unlock();
             }
             else
-            {
-                cout << "\nHost not found.\nPlease make sure:\n";
-                cout << "- You have connected to Internet.\n";
-                cout << "- You have 'IP Routing' enabled on your Windows IP Configuration (type 'ipconfig /all' in cmd to check).\n";
-                cout << "- You have entered the URL with HTTP or HTTPS protocol.\n";
-            }
-            
-            return;
+                console() << "Not following the redirect to '" << target << "', " << max_redirects << " redirect(s) already followed. Terminating.\n";
+
+            break;
         }
-        
-        
+
+        if (isPermanentRedirect(response.status_code))
+            rememberPermanentRedirect(url, target);
+
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Failed to resolve address.\n";
-            
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Redirected to '" << target << "'.\n";
             m.unlock();
         }
         else
-            cout << "\nFailed to resolve address.\n";
-        
-        return;
+            console() << "Redirected to '" << target << "'.\n";
+
+        url = target;
     }
 
-    //Initialize sock_Connect
-    sock_Connect = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (sock_Connect == INVALID_SOCKET)
+    //Clean up
+    releaseConnection(connection);
+    trace_span("connection", "connection", connection_start, trace_now(), addr);
+}
+
+//send the request(s) for addr and process the response, on connection when it is still open to the same origin
+//(the previous hop of a redirect) or on a pooled or new connection otherwise
+//response.location is set when the server redirected addr, the caller decides whether to follow it
+void request_address(char* addr, bool multi_threaded, url_connection &connection, response_info &response)
+{
+    //Getting the host name from the URL
+    char* host_name = getHostnameFromURL(addr);
+    if (host_name == NULL)
     {
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Failed to create socket.\n";
-            
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Failed to retrieve host name.\n";
             m.unlock();
         }
-        else 
-            cout << "\nFailed to create socket.\n";
+        else
+            console() << "\nFailed to retrieve host name.\n";
         
         return;
     }
 
-    //Establish connection
-    int connect_Result = connect(sock_Connect, result->ai_addr, (int)result->ai_addrlen);
-    if (connect_Result == SOCKET_ERROR)
+    aimdUseHost(host_name); //status lines, bodies and failures from here on count for this host
+    string node, port;
+    bool https = is_HTTPS_URL(addr);
+    splitHostAndPort(host_name, node, port, https ? HTTPS_PORT : PORT);
+    string origin = string(https ? "https://" : "http://") + node + ":" + port;
+    stats_begin_request();
+
+    //same origin as the previous hop: the keep-alive connection carries this request too
+    bool reused = (connection.reusable && connection.origin == origin && connectionIdle(connection.sock));
+    bool pooled = false;
+    if (!reused)
     {
-        if (multi_threaded)
+        releaseConnection(connection);
+
+        //Create Internet address structure
+        //learn more: https://learn.microsoft.com/en-us/windows/win32/api/ws2def/ns-ws2def-addrinfoa
+        //ref code: https://learn.microsoft.com/en-us/windows/win32/winsock/complete-client-code
+        struct addrinfo *result = NULL,
+                        hints;
+
+        ZeroMemory( &hints, sizeof(hints) );
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM; //TCP
+        hints.ai_protocol = IPPROTO_TCP;
+        
+        //Resolve the server address and port
+        //Please make sure your IP Routing is enabled on your Windows IP Configuration (to check: type ipconfig /all in cmd)
+        //To enable IP Routing, see: https://www.wikihow.com/Enable-IP-Routing-on-Windows-10
+        useTLS(https ? node : "", node + ":" + port); //every connection of this URL (retries included) runs TLS for https://
+        int getAddrInfo_Result = getaddrinfo(node.c_str(), port.c_str(), &hints, &result);
+        if (getAddrInfo_Result != 0) 
         {
-            m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Connection failed.\n";
+            if (getAddrInfo_Result == 11001)
+            {
+                if (multi_threaded)
+                {
+                    m.lock();
+                    console() << "----------------------------------------------------------------------------------------------------------------------\n";
+                    console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                    console() << "Host not found.\nPlease make sure:\n";
+                    console() << "- You have connected to Internet.\n";
+                    console() << "- You have 'IP Routing' enabled on your Windows IP Configuration (type 'ipconfig /all' in cmd to check).\n";
+                    console() << "- You have entered the URL with HTTP or HTTPS protocol.\n";
+                    
+                    m.unlock();
+                }
+                else
+                {
+                    console() << "\nHost not found.\nPlease make sure:\n";
+                    console() << "- You have connected to Internet.\n";
+                    console() << "- You have 'IP Routing' enabled on your Windows IP Configuration (type 'ipconfig /all' in cmd to check).\n";
+                    console() << "- You have entered the URL with HTTP or HTTPS protocol.\n";
+                }
+                
+                return;
+            }
             
-            m.unlock();
+            
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "----------------------------------------------------------------------------------------------------------------------\n";
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Failed to resolve address.\n";
+                
+                m.unlock();
+            }
+            else
+                console() << "\nFailed to resolve address.\n";
+            
+            return;
+        }
+        stats_mark_phase(PHASE_DNS);
+
+        connection.origin = origin;
+        connection.result = result;
+
+        //Establish connection: an idle one left in the pool by an earlier URL, otherwise a fresh non-blocking socket
+        //bounded by the --timeout deadline (always fresh for h2c, the pooled ones already carried HTTP/1.1)
+        if (h2c_mode == H2C_OFF)
+            connection.sock = takePooledConnection(origin);
+        pooled = (connection.sock != INVALID_SOCKET);
+        if (!pooled)
+            connection.sock = connectWithDeadline(result);
+        if (connection.sock == INVALID_SOCKET)
+        {
+            aimdRecordFailure();
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "----------------------------------------------------------------------------------------------------------------------\n";
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Connection failed. " << lastConnectError() << "\n";
+                
+                m.unlock();
+            }
+            else
+                console() << "\nConnection failed. " << lastConnectError() << "\n";
+            
+            return;
         }
+        if (pooled)
+            stats_skip_phase();
         else
-            cout << "\nConnection failed.\n";
-        
-        closesocket(sock_Connect);
-        sock_Connect = INVALID_SOCKET;
-        return;
+            stats_mark_phase(PHASE_CONNECT);
     }
+    connection.reusable = false; //until a response has been read completely
 
+    //sock_Connect is used for connecting to web servers
+    SOCKET &sock_Connect = connection.sock;
+    struct addrinfo* result = connection.result;
+
+    string established = reused ? "Reusing the connection of the previous request." :
+                         pooled ? "Reusing an idle connection from the pool." : "Connection successfully established.";
     if (multi_threaded)
     {
         m.lock();
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
-        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-        cout << "Connection successfully established.\n";
-        cout << "Host name: " << host_name << "\n";
-        cout << "Host IP: " << getIPv4(result->ai_addr) << "\n";
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+        console() << established << "\n";
+        console() << "Host name: " << host_name << "\n";
+        console() << "Host IP: " << getIPv4(result->ai_addr) << "\n";
+        if (https)
+            console() << "TLS: " << tlsDescription(sock_Connect) << "\n";
         
         m.unlock();
     }
     else
     {
-        cout << "\nConnection successfully established.\n";
-        cout << "Host name: " << host_name << "\n";
-        cout << "Host IP: " << getIPv4(result->ai_addr) << "\n";
+        console() << "\n" << established << "\n";
+        console() << "Host name: " << host_name << "\n";
+        console() << "Host IP: " << getIPv4(result->ai_addr) << "\n";
+        if (https)
+            console() << "TLS: " << tlsDescription(sock_Connect) << "\n";
     }
     
-    //Check if need to download multiple files through 1 connection (download folder)
     string abs_path = get_abs_path(addr, host_name);
+
+    //HTTP/2 cleartext: the whole URL (every file of a folder) is fetched as streams of this one connection
+    //(a connection that already carried HTTP/1.1 requests stays on HTTP/1.1)
+    if (h2c_mode != H2C_OFF && !https && !reused) //h2 over TLS would need ALPN, https:// stays on HTTP/1.1
+    {
+        if (fetchH2C(sock_Connect, addr, host_name, abs_path, multi_threaded, response))
+        {
+            closeConnection(sock_Connect);
+            sock_Connect = INVALID_SOCKET;
+            return;
+        }
+
+        //the server does not speak h2c: start over with HTTP/1.1 on a new connection
+        closeConnection(sock_Connect);
+        sock_Connect = connectWithDeadline(result);
+        if (sock_Connect == INVALID_SOCKET)
+        {
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Connection failed.\n";
+                m.unlock();
+            }
+            else
+                console() << "\nConnection failed.\n";
+
+            return;
+        }
+    }
+
+    //Check if need to download multiple files through 1 connection (download folder)
     if (hasFolderName(abs_path)) //send multiple HTTP request
     {
         string Folder_name = getFolderName(abs_path);
-        vector<string> file_names;
+        arena_string_list file_names;
+        //in listing order, the files start downloading on a second connection while the listing still arrives
+        unique_ptr<listing_feed, void(*)(listing_feed*)> feed((folder_schedule == SCHEDULE_LISTING && currentBodySink() == NULL) ?
+            beginListingFeed(result, connection.origin, addr, host_name, abs_path, Folder_name, multi_threaded) : NULL, finishListingFeed);
         //send initial HTTP request to fetch the "index.html" file, then decode the file to get a list of files that needs to be downloaded
         bool query_result = REQUEST_QUERY(sock_Connect, addr, host_name, multi_threaded);
+        if (!query_result)
+            query_result = retryRequest(sock_Connect, result, addr, host_name, abs_path, "", multi_threaded);
 
         bool get_filenames_result;
         if (query_result)
         {
-            get_filenames_result = RESPONSE_QUERY_GET_FILENAMES(sock_Connect, addr, host_name, multi_threaded, file_names);
+            get_filenames_result = RESPONSE_QUERY_GET_FILENAMES(sock_Connect, addr, host_name, multi_threaded, file_names, response, feed.get());
+            size_t taken = endListingFeed(feed.get()); //files the second connection has already started
+            if (response.location != "") //the folder moved, the caller follows the redirect
+            {
+                connection.reusable = response.keep_alive;
+                return;
+            }
 
-            //create folder
-            string folder_dir = "";
-            if (_mkdir(Folder_name.c_str()) == -1)
+            if (!get_filenames_result) //a listing cut short names only some of the files, the folder is not complete
             {
-                if (multi_threaded)
-                {
-                    m.lock();
-                    cout << "----------------------------------------------------------------------------------------------------------------------\n";
-                    cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                    cout << "Failed to create folder. Downloading directly into program directory.\n";
-                    m.unlock();
-                }
+                if (response.status_code == 200)
+                    fetchFail("incomplete folder listing");
                 else
-                    cout << "Failed to create folder. Downloading directly into program directory.\n";
+                    fetchFail("status " + to_string(response.status_code) + " for the folder listing");
+                return;
+            }
+            fetchNoteFilesListed((int)file_names.size());
+
+            //create folder (unless the first names of the listing already did)
+            string folder_dir;
+            if (!listingFeedFolder(feed.get(), folder_dir))
+                folder_dir = createFolder(addr, Folder_name, multi_threaded);
+
+            if (folder_schedule != SCHEDULE_LISTING) //sized with HEAD first, then spread over several connections
+            {
+                bool keep_alive = false;
+                if (!downloadFolderScheduled(sock_Connect, result, connection.origin, addr, host_name, abs_path, folder_dir, file_names, keep_alive))
+                    fetchFail("files of the folder not downloaded (connection lost)");
+                connection.reusable = keep_alive && !fetchAborted();
+                return;
             }
-            else
-                folder_dir = Folder_name + "/";
 
             //with each filename in file_names: create a new HTTP request to download that file
+            //up to aimdPipelineDepth() requests are sent ahead on the connection (HTTP/1.1 pipelining), the responses
+            //arrive in the same order, so the server never waits for the next request while a body is being received
             int num_Files = file_names.size();
+            int requested = (int)taken; //files whose request is on the current connection
             bool REQUEST_result;
-            for (int file_idx = 0; file_idx < num_Files; file_idx++)
+            bool keep_alive = response.keep_alive;
+            for (int file_idx = (int)taken; file_idx < num_Files && !fetchAborted(); file_idx++)
             {
-                REQUEST_result = REQUEST_QUERY_FILENAME(sock_Connect, host_name, abs_path, file_names[file_idx], multi_threaded);
+                const char* file_name = file_names[file_idx].c_str();
+                response_info file_response; //redirects of the files themselves are not followed
+                REQUEST_result = true;
+                if (requested <= file_idx)
+                {
+                    REQUEST_result = REQUEST_QUERY_FILENAME(sock_Connect, host_name, abs_path, file_name, multi_threaded);
+                    requested = file_idx + 1;
+                }
 
-                if (REQUEST_result)
-                    RESPONSE_QUERY_FILENAME(sock_Connect, addr, host_name, file_names[file_idx], multi_threaded, folder_dir);
-                else
+                //a server announcing "Connection: close" answers no further request on this connection
+                int depth = aimdPipelineDepth();
+                while (REQUEST_result && keep_alive && requested < num_Files && requested - file_idx < depth)
                 {
+                    if (!REQUEST_QUERY_FILENAME(sock_Connect, host_name, abs_path, file_names[requested].c_str(), multi_threaded, true))
+                        break; //the connection is gone, that shows up when the responses are read
+                    requested++;
+                }
+                aimdRecordPipelined(requested - file_idx);
+
+                //a dead keep-alive connection shows up either when sending or when the response never arrives
+                while (!REQUEST_result || !RESPONSE_QUERY_FILENAME(sock_Connect, addr, host_name, file_name, multi_threaded, folder_dir, file_response))
+                {
+                    if (fetchAborted()) //a rejected response (or a consumer that stopped) is not asked for again
+                        return;
+
+                    aimdRecordFailure();
                     if (multi_threaded)
                     {
                         m.lock();
-                        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                        cout << "Failed to send HTTP request to download '" << file_names[file_idx] << "'. (Connection closed)\n";
+                        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                        console() << "Failed to download '" << file_name << "'. (Connection closed)\n";
                         m.unlock();
                     }
                     else
-                        cout << "Failed to send HTTP request to download '" << file_names[file_idx] << "'. (Connection closed)\n";
+                        console() << "Failed to download '" << file_name << "'. (Connection closed)\n";
 
-                    //Retry connection until successfully send data or until user closes connection
-                    while (!query_result)
+                    //Retry on a fresh connection until the request is sent again or until the user or the retry limit stops it
+                    //(the requests pipelined behind it were lost with the connection, they are sent again too)
+                    REQUEST_result = retryRequest(sock_Connect, result, addr, host_name, abs_path, file_name, multi_threaded);
+                    requested = file_idx + 1;
+                    if (!REQUEST_result)
                     {
-                        if (multi_threaded)
-                        {
-                            m.lock();
-                            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                            cout << "Retrying connection for '" << file_names[file_idx] << "'. Enter 'ESC' to cancel retrying and close connection.\n";
-                            m.unlock();
-                        }
-                        else
-                            cout << "Retrying connection for '" << file_names[file_idx] << "'. Enter 'ESC' to cancel retrying and close connection.\n";
-
-                        if (GetAsyncKeyState(VK_ESCAPE))
-                        {
-                            if (multi_threaded) //if this was used in a multi-thread enviroment, ALL THREADS THAT WAS CURRENT HAVING CONNECTION PROBLEMS WILL BE TERMINATED
-                            {
-                                m.lock();
-                                cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                                cout << "Connection terminated by user.\n";
-                                m.unlock();
-                            }
-                            else
-                                cout << "Connection terminated by user.\n";
-                            
-                            int shutdown_result = shutdown(sock_Connect, SD_SEND);
-                            freeaddrinfo(result);
-                            delete[] host_name;
-                            closesocket(sock_Connect);
-                            return;
-                        }
-
-                        connect_Result = connect(sock_Connect, result->ai_addr, (int)result->ai_addrlen);
-                        if (connect_Result == SOCKET_ERROR)
-                        {
-                            if (multi_threaded)
-                            {
-                                m.lock();
-                                cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                                cout << "Connection failed.\n";
-                                m.unlock();
-                            }
-                            else
-                                cout << "\nConnection failed.\n";
-                            
-                            closesocket(sock_Connect);
-                            sock_Connect = INVALID_SOCKET;
-                            continue;
-                        }
-
-                        query_result = REQUEST_QUERY(sock_Connect, addr, host_name, multi_threaded);
-                    } 
-
-                    //connection re-established successfully, process the response from server
-                    RESPONSE_QUERY(sock_Connect, addr, host_name, multi_threaded, folder_dir);
+                        fetchFail("'" + string(file_name) + "' not downloaded (connection lost)");
+                        return;
+                    }
                 }
-                    
+
+                keep_alive = file_response.keep_alive;
             }
+
+            connection.reusable = keep_alive && !fetchAborted();
         }
     }
     else //send single HTTP request
@@ -334,195 +469,291 @@ void process_address(char* addr, bool multi_threaded)
         //Recieve data
         string folder_dir = "";
         if (query_result) //send request successfully, waiting to recv data
-            RESPONSE_QUERY(sock_Connect, addr, host_name, multi_threaded, folder_dir);
+            RESPONSE_QUERY(sock_Connect, addr, host_name, multi_threaded, folder_dir, response);
         else
         {
             if (multi_threaded)
             {
                 m.lock();
-                cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                cout << "Failed to send HTTP request. (Connection closed)\n";
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Failed to send HTTP request. (Connection closed)\n";
                 m.unlock();
             }
             else
-                cout << "Failed to send HTTP request. (Connection closed)\n";
+                console() << "Failed to send HTTP request. (Connection closed)\n";
+
+            //Retry on a fresh connection until the request is sent again or until the user or the retry limit stops it
+            query_result = retryRequest(sock_Connect, result, addr, host_name, abs_path, "", multi_threaded);
+
+            //connection re-established successfully, process the response from server
+            if (query_result)
+                RESPONSE_QUERY(sock_Connect, addr, host_name, multi_threaded, folder_dir, response);
+        }
+
+        connection.reusable = response.keep_alive && !fetchAborted();
+    }
+}
 
-            //Retry connection until successfully send data or until user closes connection
-            while (!query_result)
+//park the connection in the pool when another request may follow on it, close it otherwise
+void releaseConnection(url_connection &connection)
+{
+    if (connection.reusable)
+        poolConnection(connection.origin, connection.sock);
+    else
+        closeConnection(connection.sock);
+
+    if (connection.result != NULL)
+        freeaddrinfo(connection.result);
+
+    connection = url_connection();
+}
+
+//create the folder the files of a folder download are written into, returns the prefix for their paths
+//("" when the folder cannot be created: the files go into the program directory)
+string createFolder(char* addr, string Folder_name, bool multi_threaded)
+{
+    if (currentBodySink() != NULL) //the files go to the body sink, nothing is created on disk
+        return Folder_name + "/";
+
+    if (_mkdir(Folder_name.c_str()) == -1)
+    {
+        if (multi_threaded)
+        {
+            m.lock();
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Failed to create folder. Downloading directly into program directory.\n";
+            m.unlock();
+        }
+        else
+            console() << "Failed to create folder. Downloading directly into program directory.\n";
+
+        return "";
+    }
+
+    return Folder_name + "/";
+}
+
+//Reconnect with exponential backoff (always on a fresh socket) and send the request again
+//file_name == "": the request for addr itself, otherwise the request for file_name inside the folder abs_path
+//Returns false when the user pressed ESC or max_retries attempts failed, sock_Connect is closed in that case
+bool retryRequest(SOCKET &sock_Connect, struct addrinfo* result, char* addr, char* host_name, string abs_path, string file_name, bool multi_threaded)
+{
+    closeConnection(sock_Connect);
+    sock_Connect = INVALID_SOCKET;
+
+    string target = (file_name == "") ? "" : " for '" + file_name + "'";
+    int backoff_ms = 100;
+
+    for (int attempt = 1; max_retries == 0 || attempt <= max_retries; attempt++)
+    {
+        if (multi_threaded)
+        {
+            m.lock();
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Retrying connection" << target << " in " << backoff_ms << " ms. Enter 'ESC' to cancel retrying and close connection.\n";
+            m.unlock();
+        }
+        else
+            console() << "Retrying connection" << target << " in " << backoff_ms << " ms. Enter 'ESC' to cancel retrying and close connection.\n";
+
+        //wait out the backoff in short steps so ESC is still noticed quickly
+        for (int waited = 0; waited < backoff_ms; waited += 50)
+        {
+            if (GetAsyncKeyState(VK_ESCAPE))
             {
-                if (multi_threaded)
+                if (multi_threaded) //if this was used in a multi-thread enviroment, ALL THREADS THAT WAS CURRENT HAVING CONNECTION PROBLEMS WILL BE TERMINATED
                 {
                     m.lock();
-                    cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                    cout << "Retrying connection. Enter 'ESC' to cancel retrying and close connection.\n";
+                    console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                    console() << "Connection terminated by user.\n";
                     m.unlock();
                 }
                 else
-                    cout << "Retrying connection. Enter 'ESC' to cancel retrying and close connection.\n";
+                    console() << "Connection terminated by user.\n";
 
-                if (GetAsyncKeyState(VK_ESCAPE))
-                {
-                    if (multi_threaded) //if this was used in a multi-thread enviroment, ALL THREADS THAT WAS CURRENT HAVING CONNECTION PROBLEMS WILL BE TERMINATED
-                    {
-                        m.lock();
-                        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                        cout << "Connection terminated by user.\n";
-                        m.unlock();
-                    }
-                    else
-                        cout << "Connection terminated by user.\n";
-                    
-                    int shutdown_result = shutdown(sock_Connect, SD_SEND);
-                    freeaddrinfo(result);
-                    delete[] host_name;
-                    closesocket(sock_Connect);
-                    return;
-                }
+                return false;
+            }
 
-                connect_Result = connect(sock_Connect, result->ai_addr, (int)result->ai_addrlen);
-                if (connect_Result == SOCKET_ERROR)
-                {
-                    if (multi_threaded)
-                    {
-                        m.lock();
-                        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-                        cout << "Connection failed.\n";
-                        m.unlock();
-                    }
-                    else
-                        cout << "\nConnection failed.\n";
-                    
-                    closesocket(sock_Connect);
-                    sock_Connect = INVALID_SOCKET;
-                    continue;
-                }
+            Sleep(min(50, backoff_ms - waited));
+        }
+        backoff_ms = min(backoff_ms * 2, 10000);
 
-                query_result = REQUEST_QUERY(sock_Connect, addr, host_name, multi_threaded);
-            } 
+        sock_Connect = connectWithDeadline(result);
+        if (sock_Connect == INVALID_SOCKET)
+        {
+            aimdRecordFailure();
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Connection failed. " << lastConnectError() << "\n";
+                m.unlock();
+            }
+            else
+                console() << "\nConnection failed. " << lastConnectError() << "\n";
 
-            //connection re-established successfully, process the response from server
-            RESPONSE_QUERY(sock_Connect, addr, host_name, multi_threaded, folder_dir);
+            continue;
+        }
+
+        if (tlsActive(sock_Connect)) //shows whether the cached TLS session was resumed
+        {
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "TLS: " << tlsDescription(sock_Connect) << "\n";
+                m.unlock();
+            }
+            else
+                console() << "TLS: " << tlsDescription(sock_Connect) << "\n";
         }
+
+        bool query_result;
+        if (file_name == "")
+            query_result = REQUEST_QUERY(sock_Connect, addr, host_name, multi_threaded);
+        else
+            query_result = REQUEST_QUERY_FILENAME(sock_Connect, host_name, abs_path, file_name, multi_threaded);
+
+        if (query_result)
+            return true;
+
+        closeConnection(sock_Connect);
+        sock_Connect = INVALID_SOCKET;
     }
-    
-    //Clean up
-    int shutdown_result = shutdown(sock_Connect, SD_SEND);
-    freeaddrinfo(result);
-    delete[] host_name;
-    closesocket(sock_Connect);
+
+    if (multi_threaded)
+    {
+        m.lock();
+        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+        console() << "Giving up after " << max_retries << " retries.\n";
+        m.unlock();
+    }
+    else
+        console() << "Giving up after " << max_retries << " retries.\n";
+
+    return false;
 }
 
 bool REQUEST_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded)
 {
     //Create HTTP message (initial buffer) and send it
-    string GET_QUERY = create_GET_query(addr, host_name);
+    arena_string GET_QUERY = create_GET_query(addr, host_name);
     const char* sendbuff = GET_QUERY.c_str(); 
-    int byte_sent = send(sock_Connect, sendbuff, (int)strlen(sendbuff), 0);
-    if (byte_sent == SOCKET_ERROR)
+    beginRequestDeadline();
+    int byte_sent = sendAll(sock_Connect, sendbuff, (int)strlen(sendbuff));
+    if (byte_sent <= 0)
     {  
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Failed to send HTTP message to server.\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Failed to send HTTP message to server.\n";
             
             m.unlock();
         }
         else
-            cout << "\nFailed to send HTTP message to server.\n";
+            console() << "\nFailed to send HTTP message to server.\n";
         
-        closesocket(sock_Connect);
         return false;
     }
+    stats_mark_phase(PHASE_REQUEST_SENT);
 
     if (multi_threaded)
     {
         m.lock();
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
-        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-        cout << "Sent HTTP request to '" << host_name << "' successfully.\n";
-        cout << "Byte sent to server: " << byte_sent << "\n";
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+        console() << "Sent HTTP request to '" << host_name << "' successfully.\n";
+        console() << "Byte sent to server: " << byte_sent << "\n";
         
         m.unlock();
     }
     else 
     {
-        cout << "\nSent HTTP request to '" << host_name << "' successfully.\n";
-        cout << "Byte sent to server: " << byte_sent << "\n";
+        console() << "\nSent HTTP request to '" << host_name << "' successfully.\n";
+        console() << "Byte sent to server: " << byte_sent << "\n";
     }
     
     if (multi_threaded)
     {
         m.lock();
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
-        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-        cout << "DATA SENT to '" << host_name <<"':\n";
-        cout << ".........................................................\n";
-        cout << sendbuff;
-        cout << ".........................................................\n";
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+        console() << "DATA SENT to '" << host_name <<"':\n";
+        console() << ".........................................................\n";
+        console() << sendbuff;
+        console() << ".........................................................\n";
        
         m.unlock();
     }
     else
     {
-        cout << "\nDATA SENT to '" << host_name <<"':\n";
-        cout << ".........................................................\n";
-        cout << sendbuff;
-        cout << ".........................................................\n";
+        console() << "\nDATA SENT to '" << host_name <<"':\n";
+        console() << ".........................................................\n";
+        console() << sendbuff;
+        console() << ".........................................................\n";
     }
 
     return true;
 }
 
-bool REQUEST_QUERY_FILENAME(SOCKET sock_Connect, char* host_name, string abs_path, string file_name, bool multi_threaded)
+bool REQUEST_QUERY_FILENAME(SOCKET sock_Connect, char* host_name, string abs_path, string file_name, bool multi_threaded, bool pipelined)
 {
-    cout << "\nQUERY: GET " << file_name << " at " << host_name << ".\n";
-    string host_name_str = host_name;
-    string GET_QUERY = "GET " + abs_path + file_name + " HTTP/1.1\r\nHost: " + host_name_str + "\r\nConnection: keep-alive\r\n\r\n";
+    console() << "\nQUERY: GET " << file_name << " at " << host_name << ".\n";
+    arena_string GET_QUERY;
+    GET_QUERY.reserve(abs_path.length() + file_name.length() + strlen(host_name) + 64);
+    GET_QUERY.append("GET ").append(abs_path.c_str(), abs_path.length()).append(file_name.c_str(), file_name.length());
+    GET_QUERY.append(" HTTP/1.1\r\nHost: ").append(host_name).append("\r\nConnection: keep-alive\r\n\r\n");
     const char* sendbuff = GET_QUERY.c_str(); 
-    int byte_sent = send(sock_Connect, sendbuff, (int)strlen(sendbuff), 0);
-    if (byte_sent == SOCKET_ERROR)
+    beginRequestDeadline();
+    int byte_sent = sendAll(sock_Connect, sendbuff, (int)strlen(sendbuff));
+    if (byte_sent <= 0)
     {  
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - GET " << file_name << " at " << host_name << ".\n";
-            cout << "Failed to send HTTP message to server.\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - GET " << file_name << " at " << host_name << ".\n";
+            console() << "Failed to send HTTP message to server.\n";
             
             m.unlock();
         }
         else
-            cout << "\nFailed to send HTTP message to server.\n";
+            console() << "\nFailed to send HTTP message to server.\n";
         
-        closesocket(sock_Connect);
         return false;
     }
+    if (pipelined)
+        stats_pipelined_request();
+    else
+        stats_mark_phase(PHASE_REQUEST_SENT);
 
     m.lock();
-    cout << sendbuff;
+    console() << sendbuff;
     m.unlock();
 
     return true;
 }
 
-void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, string folder_dir)
+void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, string folder_dir, response_info &response)
 {
     //ref code: https://learn.microsoft.com/en-us/windows/win32/api/winsock/nf-winsock-recv
     int byte_recv;
-    vector<string> headers;
-    string line;
+    arena_string_list headers;
+    arena_string line;
     string excess_data = "";
 
-    //get status code
+    //get status code (how long it takes to arrive tells the concurrency controller whether the server is queueing)
+    chrono::steady_clock::time_point wait_start = chrono::steady_clock::now();
     int status_code;
     if (multi_threaded)
     {
-        m.lock();
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
-        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
         line = recvALineFromServerRepsonse(sock_Connect, headers); //first line of HTTP response contains a status code (e.g. 200, 501, 502, 404,...)
+        m.lock(); //the line is received before locking, so a slow server does not hold up the other threads' output
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
         getStatusCodeInfo(line, status_code);
         
         m.unlock();
@@ -532,6 +763,9 @@ void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi
         line = recvALineFromServerRepsonse(sock_Connect, headers);
         getStatusCodeInfo(line, status_code);
     }
+    stats_mark_phase(PHASE_STATUS_LINE);
+    response.status_code = status_code;
+    aimdRecordResponse(status_code, wait_start);
     
     if (status_code == 200)
     {
@@ -539,20 +773,37 @@ void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi
                                  //if the HTTP response contains "Transfer-Encoding: chunked",  content_length = -1
 
         //recieve all the headers, extracts and put them into a vector
-        while ((line.length() != 2) && (int(line[0]) != 13) && (int(line[1]) != 10)) //13: CR, 10: LF - '\r\n' in ASCII
+        while ((line != "\r\n") && (line != "")) //"": the connection failed before the empty line ending the headers
             line = recvALineFromServerRepsonse(sock_Connect, headers);
+
+        if (line == "")
+        {
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "----------------------------------------------------------------------------------------------------------------------\n";
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Connection closed or timed out while receiving headers.\n";
+                m.unlock();
+            }
+            else
+                console() << "Connection closed or timed out while receiving headers.\n";
+
+            return;
+        }
+        stats_mark_phase(PHASE_HEADERS);
         
         //Extract "Content-Length" or "Transfer-Encoding: chunked" from the vector headers
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "DATA RECIEVED from '" << host_name << "':\n";
-            cout << ".........................................................\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "DATA RECIEVED from '" << host_name << "':\n";
+            console() << ".........................................................\n";
             for (int i = 0; i < headers.size(); i++)
             {
-                cout << headers[i];
+                console() << headers[i];
 
                 if (headers[i].find("Content-Length") != string::npos)
                 {
@@ -566,18 +817,18 @@ void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi
                     break;
                 }
             }
-            cout << "(message body)\n";
-            cout << ".........................................................\n";
+            console() << "(message body)\n";
+            console() << ".........................................................\n";
             
             m.unlock();
         }
         else
         {
-            cout << "\nDATA RECIEVED from '" << host_name << "':\n";
-            cout << ".........................................................\n";
+            console() << "\nDATA RECIEVED from '" << host_name << "':\n";
+            console() << ".........................................................\n";
             for (int i = 0; i < headers.size(); i++)
             {
-                cout << headers[i];
+                console() << headers[i];
 
                 if (headers[i].find("Content-Length") != string::npos)
                 {
@@ -589,62 +840,85 @@ void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi
                     content_length = -1;
                 }
             }
-            cout << "(message body)\n";
-            cout << ".........................................................\n";
+            console() << "(message body)\n";
+            console() << ".........................................................\n";
         }
         
+        string source = string(host_name) + get_abs_path(addr, host_name);
         if (content_length > 0) //content-length type
         {
             string filename = get_filename(addr);
-            downloadFile(sock_Connect, filename, content_length, multi_threaded, folder_dir);
+            response.keep_alive = downloadFile(sock_Connect, filename, content_length, multi_threaded, folder_dir, source) && keepsConnectionOpen(headers);
         }
         else if (content_length == -1) //Transfer-encoding: chunked
         {
             string filename = get_filename(addr);
-            downloadFile(sock_Connect, filename, content_length, multi_threaded, folder_dir);
+            response.keep_alive = downloadFile(sock_Connect, filename, content_length, multi_threaded, folder_dir, source) && keepsConnectionOpen(headers);
         }
     }
+    else if (isRedirect(status_code))
+    {
+        //the body of the redirect is skipped, so the same connection can carry the request to its target
+        response.keep_alive = skipResponse(sock_Connect, status_code, headers) && keepsConnectionOpen(headers);
+        response.location = getHeaderValue(headers, "Location");
+        if (response.location == "")
+        {
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "----------------------------------------------------------------------------------------------------------------------\n";
+                console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+                console() << "Server responded with a redirect but no Location. Terminating.\n";
+                m.unlock();
+            }
+            else
+                console() << "Server responded with a redirect but no Location. Terminating.\n";
+        }
+        else
+            return; //the caller follows the redirect
+    }
     else
     {
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Server responded with non-OK status code. Terminating.\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Server responded with non-OK status code. Terminating.\n";
             
             m.unlock();
         }
         else
-            cout << "Server responded with non-OK status code. Terminating.\n";
+            console() << "Server responded with non-OK status code. Terminating.\n";
     }
 
     //Notify if the thread exitted successfully
     if (multi_threaded)
     {
         m.lock();
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
-        cout << "Thread " << this_thread::get_id() << " exitted with no error.\n";
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "Thread " << this_thread::get_id() << " exitted with no error.\n";
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
         m.unlock();
     }  
 
 }
 
-bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, vector<string> &file_names)
+bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, arena_string_list &file_names, response_info &response, listing_feed* feed)
 {
     int byte_recv;
-    vector<string> headers;
-    string line;
+    arena_string_list headers;
+    arena_string line;
 
-    //get status code
+    //get status code (how long it takes to arrive tells the concurrency controller whether the server is queueing)
+    chrono::steady_clock::time_point wait_start = chrono::steady_clock::now();
     int status_code;
     if (multi_threaded)
     {
-        m.lock();
-        cout << "----------------------------------------------------------------------------------------------------------------------\n";
-        cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
         line = recvALineFromServerRepsonse(sock_Connect, headers);
+        m.lock();
+        console() << "----------------------------------------------------------------------------------------------------------------------\n";
+        console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
         getStatusCodeInfo(line, status_code);
         
         m.unlock();
@@ -654,26 +928,40 @@ bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_na
         line = recvALineFromServerRepsonse(sock_Connect, headers);
         getStatusCodeInfo(line, status_code);
     }
+    stats_mark_phase(PHASE_STATUS_LINE);
+    response.status_code = status_code;
+    aimdRecordResponse(status_code, wait_start);
     
+    if (isRedirect(status_code)) //e.g. "/folder" -> "/folder/", the caller follows it
+    {
+        response.keep_alive = skipResponse(sock_Connect, status_code, headers) && keepsConnectionOpen(headers);
+        response.location = getHeaderValue(headers, "Location");
+        return false;
+    }
+
     if (status_code == 200)
     {
         int content_length = 0;
 
         //recieve all the headers, extracts and put them into a vector
-        while ((line.length() != 2) && (int(line[0]) != 13) && (int(line[1]) != 10)) //13: CR, 10: LF - '\r\n' in ASCII
+        while ((line != "\r\n") && (line != "")) //"": the connection failed before the empty line ending the headers
             line = recvALineFromServerRepsonse(sock_Connect, headers);
+
+        if (line == "") //connection closed or timed out
+            return false;
+        stats_mark_phase(PHASE_HEADERS);
         
         //Extract "Content-Length" or "Transfer-Encoding: chunked" from the vector headers
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "DATA RECIEVED from '" << host_name << "':\n";
-            cout << ".........................................................\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "DATA RECIEVED from '" << host_name << "':\n";
+            console() << ".........................................................\n";
             for (int i = 0; i < headers.size(); i++)
             {
-                cout << headers[i];
+                console() << headers[i];
 
                 if (headers[i].find("Content-Length") != string::npos)
                 {
@@ -687,18 +975,18 @@ bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_na
                     break;
                 }
             }
-            cout << "(message body)\n";
-            cout << ".........................................................\n";
+            console() << "(message body)\n";
+            console() << ".........................................................\n";
             
             m.unlock();
         }
         else
         {
-            cout << "\nDATA RECIEVED from '" << host_name << "':\n";
-            cout << ".........................................................\n";
+            console() << "\nDATA RECIEVED from '" << host_name << "':\n";
+            console() << ".........................................................\n";
             for (int i = 0; i < headers.size(); i++)
             {
-                cout << headers[i];
+                console() << headers[i];
 
                 if (headers[i].find("Content-Length") != string::npos)
                 {
@@ -710,151 +998,111 @@ bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_na
                     content_length = -1;
                 }
             }
-            cout << "(message body)\n";
-            cout << ".........................................................\n";
+            console() << "(message body)\n";
+            console() << ".........................................................\n";
         }
         
         if (content_length > 0) //content-length type
         {
             string filename = "index.html";
-            string contents = "";
+            href_scanner scanner; //the listing is scanned as it arrives, it is never held in memory as a whole
             int i = 0;
             int byte_recv;
-            char recvbuff[1];
-            float progress;
-            float downloadbar = 0;
-            
-            if (multi_threaded)
-            {
-                m.lock();
-                cout << "Fetching '" << filename << "': 0%\n";
-                m.unlock();
-            }     
-            else
-                cout << "Fetching '" << filename << "': " << progressBar(0) << "\n";
+            char recvbuff[16384];
+            progress_transfer* progress = progressBegin(filename, content_length);
 
             while (i < content_length)
             {
-                byte_recv = recv(sock_Connect, recvbuff, 1, 0);
-
-                if (byte_recv > 0)
-                {
-                    contents += recvbuff[0];
-                    i++;
-                }
-                
-                progress = (float(i) / content_length) * 100;
-                if (progress - downloadbar > 10)
+                byte_recv = recvSome(sock_Connect, recvbuff, min(content_length - i, (int)sizeof(recvbuff)));
+                if (byte_recv <= 0)
                 {
                     if (multi_threaded)
                     {
                         m.lock();
-                        cout << "Fetching '" << filename << "': " << fixed << setprecision(0) << progress << "%\n";
+                        console() << "Download interupted. Cannot fetch '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
                         m.unlock();
-                    }     
+                    }
                     else
-                        cout << "Fetching '" << filename << "': " << progressBar(progress) << "\n";
+                        console() << "Download interupted. Cannot fetch '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
 
-                    downloadbar = progress;
+                    progressEnd(progress);
+                    return false;
                 }
-                 
+
+                scanFileNames(scanner, recvbuff, byte_recv, file_names);
+                feedFileNames(feed, file_names);
+                i += byte_recv;
+                progressAdvance(progress, byte_recv);
             }
+            progressEnd(progress);
 
             if (!multi_threaded)
-            {
-                cout << "Fetching '" << filename << "': " << progressBar(100) << "\n";
-                cout << "\nSuccessfully fetched file '" << filename << "'.\n";
-            }
+                console() << "\nSuccessfully fetched file '" << filename << "'.\n";
             else
             {
                 m.lock();
-                cout << "Fetching '" << filename << "': 100%\n";
-                cout << "Successfully fetched file '" << filename << "'.\n";
+                console() << "Successfully fetched file '" << filename << "'.\n";
                 m.unlock();
             }
 
-            //Extract filenames by searching for "href="
-            size_t found_href = contents.find("href=");
-            string href_content = "";
-            size_t j;
-
-            while (found_href != string::npos)
-            {
-                href_content = "";
-
-                j = found_href;
-                while (contents[j] != '"')
-                    j++;
+            stats_mark_phase(PHASE_BODY, content_length, "index.html");
 
-                j++;
-                while (contents[j] != '"')
-                {
-                    href_content += contents[j];
-                    j++;
-                }
-
-                if (isFileName(href_content))
-                    file_names.push_back(href_content);
-            
-                found_href = contents.find("href=", found_href + 1);
-            }
-
-            cout << "List of files to be downloaded:\n";
+            console() << "List of files to be downloaded:\n";
             for (int k = 0; k < file_names.size(); k++)
-                cout << file_names[k] << "\n";
+                console() << file_names[k] << "\n";
 
+            response.keep_alive = keepsConnectionOpen(headers);
             return true;
         }
         else if (content_length == -1) //Transfer-encoding: chunked
         {
             string filename = "index.html";
-            string contents = "";
-            vector<string> chunk_sizes;
+            href_scanner scanner;
+            long long listing_bytes = 0;
+            char recvbuff[16384];
             int chunk_size_10;
             int byte_recv;
-            int i = 1, chunk_i;
-            char recvbuff[1];
-            string line = recvALineFromServerRepsonse(sock_Connect, chunk_sizes);
-            chunk_size_10 = getChunkSize(line);
+            int i = 1;
+            chunk_size_10 = recvChunkSize(sock_Connect);
 
             while (chunk_size_10 > 0)
             {
                 if (multi_threaded)
                 {
                     m.lock();
-                    cout << "Fetching '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
+                    console() << "Fetching '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
                     m.unlock();
                 }
                 else
-                    cout << "Fetching '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
+                    console() << "Fetching '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
                 
-                chunk_i = 0;
-
-                while (chunk_i < chunk_size_10)
+                //a chunk is read and scanned in pieces too, however large the server made it
+                int chunk_left = chunk_size_10;
+                byte_recv = 1;
+                while (chunk_left > 0 && byte_recv > 0)
                 {
-                    byte_recv = recv(sock_Connect, recvbuff, 1, 0);
+                    byte_recv = recvExact(sock_Connect, recvbuff, (min)(chunk_left, (int)sizeof(recvbuff)));
                     if (byte_recv > 0)
                     {
-                        contents += recvbuff;
-                        chunk_i++;
+                        scanFileNames(scanner, recvbuff, byte_recv, file_names);
+                        feedFileNames(feed, file_names);
+                        chunk_left -= byte_recv;
+                        listing_bytes += byte_recv;
                     }
                 }
                 
-                if (readCRLF(sock_Connect))
-                {
-                    line = recvALineFromServerRepsonse(sock_Connect, chunk_sizes); //get next chunk_size
-                    chunk_size_10 = getChunkSize(line);
-                }
+                if (byte_recv > 0 && readCRLF(sock_Connect))
+                    chunk_size_10 = recvChunkSize(sock_Connect); //get next chunk_size
                 else 
                 {
                     if (multi_threaded)
                     {
                         m.lock();
-                        cout << "Download interupted. Cannot fetch '" << filename << "'.\n";
+                        console() << "Download interupted. Cannot fetch '" << filename << "'.\n";
                         m.unlock();
                     }
                     else
-                        cout << "Download interupted. Cannot fetch '" << filename << "'.\n";
+                        console() << "Download interupted. Cannot fetch '" << filename << "'.\n";
                     
                     return false;
                 }
@@ -862,45 +1110,37 @@ bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_na
                 i++;
             }
 
+            //a zero-size chunk ends the body, it is followed by optional trailers and an empty line
+            if (chunk_size_10 < 0 || !recvTrailers(sock_Connect)) //connection closed, timed out or the response was rejected
+            {
+                if (multi_threaded)
+                {
+                    m.lock();
+                    console() << "Download interupted. Cannot fetch '" << filename << "'.\n";
+                    m.unlock();
+                }
+                else
+                    console() << "Download interupted. Cannot fetch '" << filename << "'.\n";
+
+                return false;
+            }
+
             if (multi_threaded)
             {
                 m.lock();
-                cout << "Successfully fetched file '" << filename << "'.\n";
+                console() << "Successfully fetched file '" << filename << "'.\n";
                 m.unlock();
             }
             else
-                cout << "\nSuccessfully fetched file '" << filename << "'.\n";
-
-            //Extract filenames by searching for "href="
-            size_t found_href = contents.find("href=");
-            string href_content = "";
-            size_t j;
+                console() << "\nSuccessfully fetched file '" << filename << "'.\n";
 
-            while (found_href != string::npos)
-            {
-                href_content = "";
+            stats_mark_phase(PHASE_BODY, listing_bytes, "index.html");
 
-                j = found_href;
-                while (contents[j] != '"')
-                    j++;
-
-                j++;
-                while (contents[j] != '"')
-                {
-                    href_content += contents[j];
-                    j++;
-                }
-
-                if (isFileName(href_content))
-                    file_names.push_back(href_content);
-            
-                found_href = contents.find("href=", found_href + 1);
-            }
-
-            cout << "List of files to be downloaded:\n";
+            console() << "List of files to be downloaded:\n";
             for (int k = 0; k < file_names.size(); k++)
-                cout << file_names[k] << "\n";
+                console() << file_names[k] << "\n";
 
+            response.keep_alive = keepsConnectionOpen(headers);
             return true;
         }
     }
@@ -908,19 +1148,25 @@ bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_na
     return false;
 }
 
-void RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, string file_name, bool multi_threaded, string folder_dir)
+bool RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, string file_name, bool multi_threaded, string folder_dir, response_info &response)
 {
+    arena_scope request_scope; //the header lines of this file are released before the next file is requested
     int byte_recv;
-    vector<string> headers;
-    string line;
+    arena_string_list headers;
+    arena_string line;
+
+    //the requests pipelined behind this one were sent since it went out, each of them restarted the thread's request
+    //timeout: the response gets its own from when it starts being read
+    beginRequestDeadline();
 
-    //get status code
+    //get status code (how long it takes to arrive tells the concurrency controller whether the server is queueing)
+    chrono::steady_clock::time_point wait_start = chrono::steady_clock::now();
     int status_code;
     
     if (multi_threaded)
     {
-        m.lock();
         line = recvALineFromServerRepsonse(sock_Connect, headers);
+        m.lock();
         getStatusCodeInfo(line, status_code);
         m.unlock();
     }
@@ -929,6 +1175,12 @@ void RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, s
         line = recvALineFromServerRepsonse(sock_Connect, headers);
         getStatusCodeInfo(line, status_code);
     }
+
+    if (line == "") //connection closed or timed out, the caller retries on a fresh connection
+        return false;
+    stats_mark_phase(PHASE_STATUS_LINE);
+    response.status_code = status_code;
+    aimdRecordResponse(status_code, wait_start);
     
     if (status_code == 200)
     {
@@ -936,8 +1188,12 @@ void RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, s
                                  //if the HTTP response contains "Transfer-Encoding: chunked",  content_length = -1
 
         //recieve all the headers, extracts and put them into a vector
-        while ((line.length() != 2) && (int(line[0]) != 13) && (int(line[1]) != 10)) //13: CR, 10: LF - '\r\n' in ASCII
+        while ((line != "\r\n") && (line != "")) //"": the connection failed before the empty line ending the headers
             line = recvALineFromServerRepsonse(sock_Connect, headers);
+
+        if (line == "")
+            return false;
+        stats_mark_phase(PHASE_HEADERS);
         
         //Extract "Content-Length" or "Transfer-Encoding: chunked" from the vector headers
         if (multi_threaded)
@@ -973,81 +1229,56 @@ void RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, s
             }
         }
         
-        if (content_length > 0) //content-length type
-            downloadFile(sock_Connect, file_name, content_length, multi_threaded, folder_dir);
-        else if (content_length == -1) //Transfer-encoding: chunked
-            downloadFile(sock_Connect, file_name, content_length, multi_threaded, folder_dir);            
+        if (content_length > 0 || content_length == -1) //content-length type or Transfer-encoding: chunked
+        {
+            bool downloaded = downloadFile(sock_Connect, file_name, content_length, multi_threaded, folder_dir, string(host_name) + get_abs_path(addr, host_name) + file_name);
+            response.keep_alive = downloaded && keepsConnectionOpen(headers);
+            return downloaded;
+        }
     }
     else
     {
+        //the rest of the response is skipped, so the next file can still be requested on this connection
+        response.keep_alive = skipResponse(sock_Connect, status_code, headers) && keepsConnectionOpen(headers);
+        fetchFail("status " + to_string(status_code) + " for '" + file_name + "'");
+
         if (multi_threaded)
         {
             m.lock();
-            cout << "----------------------------------------------------------------------------------------------------------------------\n";
-            cout << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
-            cout << "Server responded with non-OK status code. Terminating.\n";
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n";
+            console() << "Server responded with non-OK status code. Terminating.\n";
             
             m.unlock();
         }
         else
-            cout << "Server responded with non-OK status code. Terminating.\n";
+            console() << "Server responded with non-OK status code. Terminating.\n";
     }
+
+    return true;
 }
 
 //We specifically want to get a host name from the entered URL, because the program will take an URL as argument and the URL contains the content type (e.g "/" for index.html and "*.html", "*.pdf", etc for other file types)
 //(e.g: get "web.stanford.edu" from "http://web.stanford.edu/dept/its/support/techtraining/techbriefing-media/Intro_Net_91407.ppt")
+//the host name is copied into the request arena (see arena.h), the caller never frees it and calls this inside an arena_scope
 char* getHostnameFromURL(char* URL)
 {
-    if (is_HTTP_URL(URL))
-    {
-        char* secondSlash = strchr(URL, '/') + 1;
-        char* thirdSlash = strchr(secondSlash + 1, '/');
-        string host_name = "";
-
-        if (secondSlash != NULL && thirdSlash != NULL)
-        {
-            //everything between second slash and third slash is the host name
-            for (int i = 1; secondSlash + i != thirdSlash; i++)  
-                host_name += *(secondSlash + i);
-        
-                int str_len = host_name.length();
-                char* host_name_chr = new char[str_len + 1];
-        
-            for (int i = 0; i < str_len; i++)
-                host_name_chr[i] = host_name[i];
+    char* host_start = URL; //assume there is no "http://" or "https://" opening in the URL
 
-            host_name_chr[str_len] = '\0';
-            
-            return host_name_chr;
-        }
-        else if (secondSlash != NULL && thirdSlash == NULL) //in case no thirdslash was found, i.e: https://www.google.com
-        {
-            return (secondSlash + 1);
-        }
-    }
-    else //assume there is no "http://" or "https://" opening in the URL
+    if (is_HTTP_URL(URL))
     {
         char* firstSlash = strchr(URL, '/');
+        if (firstSlash == NULL || firstSlash[1] != '/')
+            return NULL;
 
-        if (firstSlash == NULL) //no path after host name
-            return URL;
-
-        string host_name = "";
-        for (int i = 0; URL + i != firstSlash; i++)
-            host_name += *(URL + i);
-
-        int str_len = host_name.length();
-        char* host_name_chr = new char[str_len + 1];
-        
-        for (int i = 0; i < str_len; i++)
-            host_name_chr[i] = host_name[i];
-
-        host_name_chr[str_len] = '\0';
-        
-        return host_name_chr;
+        host_start = firstSlash + 2; //everything between second slash and third slash is the host name
     }
 
-    return NULL;
+    char* host_end = strchr(host_start, '/');
+    if (host_end == NULL) //no path after host name, i.e: https://www.google.com
+        host_end = host_start + strlen(host_start);
+
+    return arenaCopy(host_start, host_end - host_start);
 }
 
 //check if the entered URL starting with "http:" or "https:" or not
@@ -1059,6 +1290,45 @@ bool is_HTTP_URL(char* host_name)
     return false;
 }
 
+//check if the entered URL starts with "https:", its connection runs TLS (see tls.h)
+bool is_HTTPS_URL(char* URL)
+{
+    return strncmp(URL, "https:", 6) == 0;
+}
+
+//"scheme://node:port" of a URL, the origin its connections are pooled under ("" when it has no host name)
+string urlOrigin(const string &url)
+{
+    arena_scope url_scope;
+    vector<char> url_buffer(url.c_str(), url.c_str() + url.length() + 1);
+    char* host_name = getHostnameFromURL(url_buffer.data());
+    if (host_name == NULL)
+        return "";
+
+    string node, port;
+    bool https = is_HTTPS_URL(url_buffer.data());
+    splitHostAndPort(host_name, node, port, https ? HTTPS_PORT : PORT);
+    return string(https ? "https://" : "http://") + node + ":" + port;
+}
+
+//split "host:port" into its two parts, port defaults to default_port (PORT or HTTPS_PORT) when the URL does not specify one
+//(e.g: "127.0.0.1:8080" -> "127.0.0.1" and "8080", "example.com" -> "example.com" and "80")
+void splitHostAndPort(char* host_name, string &node, string &port, string default_port)
+{
+    string host_name_str = host_name;
+    size_t colon = host_name_str.rfind(':');
+
+    if (colon == string::npos || host_name_str.find(']', colon) != string::npos)
+    {
+        node = host_name_str;
+        port = default_port;
+        return;
+    }
+
+    node = host_name_str.substr(0, colon);
+    port = host_name_str.substr(colon + 1);
+}
+
 //convert sockaddr to string, getting the IPv4 representation of a sockaddr
 //ref code: https://stackoverflow.com/questions/1276294/getting-ipv4-address-from-a-sockaddr-structure, more specifically, ans: https://stackoverflow.com/a/32899053
 string getIPv4(sockaddr* addr)
@@ -1071,7 +1341,7 @@ string getIPv4(sockaddr* addr)
     return string(ipv4);
 }
 
-string create_GET_query(char* addr, char* host_name)
+arena_string create_GET_query(char* addr, char* host_name)
 {
     /*General template for simple GET HTTP request used:
     
@@ -1081,26 +1351,24 @@ string create_GET_query(char* addr, char* host_name)
         \r\n
     */
     
-    string host_name_str = host_name;
-    string GET_query = "GET " + get_abs_path(addr, host_name) + " HTTP/1.1\r\nHost: " + host_name_str + "\r\nConnection: keep-alive\r\n\r\n";
+    string abs_path = get_abs_path(addr, host_name);
+    arena_string GET_query;
+    GET_query.reserve(abs_path.length() + strlen(host_name) + 64); //one allocation for the whole request
+    GET_query.append("GET ").append(abs_path.c_str(), abs_path.length()).append(" HTTP/1.1\r\nHost: ").append(host_name);
+    GET_query.append("\r\nConnection: keep-alive\r\n\r\n");
 
     return GET_query;
 }
 
 string get_abs_path(char* addr, char* host_name)
 {
-    string addr_str = addr;
-    string host_name_str = host_name;
     string abs_path = "";
 
-    size_t found = addr_str.find(host_name_str);
-    if (found != string::npos)
-    {
-        for (size_t i = found + host_name_str.length(); i < addr_str.length(); i++)
-            abs_path += addr_str[i];
-    }
+    const char* found = strstr(addr, host_name); //no copy of the URL or host name just to search it
+    if (found != NULL)
+        abs_path = found + strlen(host_name);
 
-    if ((host_name_str == "www.bing.com") && (abs_path == "")) //bing.com isn't indexed by google, therefore it does not named 'index.html' like others website
+    if ((strcmp(host_name, "www.bing.com") == 0) && (abs_path == "")) //bing.com isn't indexed by google, therefore it does not named 'index.html' like others website
         return "/";
 
     if (abs_path == "/")
@@ -1140,72 +1408,175 @@ string getFolderName(string abs_path)
 {
     int n = abs_path.length();
 
-    string Folder_name = "";
-    for (int i = n - 2; i >= 0; i--)
-    {
-        if (abs_path[i] == '/')
-            return Folder_name;
-        
-        Folder_name = abs_path[i] + Folder_name;
-    }
+    string Folder_name = "";
+    for (int i = n - 2; i >= 0; i--)
+    {
+        if (abs_path[i] == '/')
+            return Folder_name;
+        
+        Folder_name = abs_path[i] + Folder_name;
+    }
+
+    if (Folder_name != "")
+        return Folder_name;
+
+    return "NewFolder";
+}
+
+bool isFileName(const arena_string &filename)
+{
+    //List of file extentions: https://developer.mozilla.org/en-US/docs/Web/HTTP/Basics_of_HTTP/MIME_types/Common_types
+    int n = MIME_file_types.size();
+
+    for (int i = 0; i < n; i++)
+        if (filename.find(MIME_file_types[i].c_str(), 0, MIME_file_types[i].length()) != string::npos)
+            return true;
+    
+    return false;
+}
+
+//Extract filenames from a directory listing by searching for "href=", every name once
+void extractFileNames(const arena_string &contents, arena_string_list &file_names)
+{
+    href_scanner scanner;
+    scanFileNames(scanner, contents.c_str(), contents.length(), file_names);
+}
+
+//the listing is scanned as it arrives: a piece may end anywhere, inside "href=" or inside the quoted name, so the
+//scanner keeps how far it got and the name collected so far
+//after "href=" everything up to the next '"' is skipped, the name is what follows up to the closing '"'
+void scanFileNames(href_scanner &scanner, const char* data, size_t len, arena_string_list &file_names)
+{
+    static const char HREF[] = "href=";
+    size_t i = 0;
+
+    while (i < len)
+    {
+        if (scanner.state == HREF_SEEK)
+        {
+            if (scanner.matched == 0) //jump to the next candidate instead of looking at every byte
+            {
+                const char* next = (const char*)memchr(data + i, 'h', len - i);
+                if (next == NULL)
+                    return;
+                i = next - data;
+            }
+
+            if (data[i] == HREF[scanner.matched])
+                scanner.matched++;
+            else
+                scanner.matched = (data[i] == 'h') ? 1 : 0;
+            i++;
+
+            if (scanner.matched == 5)
+            {
+                scanner.matched = 0;
+                scanner.state = HREF_OPEN;
+            }
+            continue;
+        }
+
+        const char* quote = (const char*)memchr(data + i, '"', len - i);
+        size_t end = (quote == NULL) ? len : quote - data;
+
+        if (scanner.state == HREF_VALUE)
+        {
+            //a name longer than any header line is not a file of this listing, it is skipped
+            if (scanner.value.length() + (end - i) <= MAX_HEADER_LINE_BYTES)
+                scanner.value.append(data + i, end - i);
+            else
+                scanner.value_too_long = true;
+        }
+        if (quote == NULL)
+            return;
+        i = end + 1;
+
+        if (scanner.state == HREF_OPEN)
+        {
+            scanner.state = HREF_VALUE;
+            continue;
+        }
 
-    if (Folder_name != "")
-        return Folder_name;
+        arena_string name(scanner.value.c_str(), scanner.value.length());
+        if (!scanner.value_too_long && isFileName(name) && scanner.seen.insert(scanner.value).second)
+            file_names.push_back(name);
 
-    return "NewFolder";
+        scanner.value.clear();
+        scanner.value_too_long = false;
+        scanner.state = HREF_SEEK;
+    }
 }
 
-bool isFileName(string filename)
+//a response that breaks the hard limits of budget.h is not read any further, and the fetch is not retried
+static arena_string rejectResponse(string reason)
 {
-    //List of file extentions: https://developer.mozilla.org/en-US/docs/Web/HTTP/Basics_of_HTTP/MIME_types/Common_types
-    int n = MIME_file_types.size();
+    m.lock();
+    console() << "Response rejected: " << reason << "\n";
+    m.unlock();
 
-    for (int i = 0; i < n; i++)
-        if (filename.find(MIME_file_types[i]) != string::npos)
-            return true;
-    
-    return false;
+    fetchAbort();
+    return "";
 }
 
-string recvALineFromServerRepsonse(SOCKET sock_Connect, vector<string> &headers)
+//returns the line including its CRLF, or "" when the connection was closed, failed or timed out
+//or the line breaks the limits on header lines (headers: the lines of the same header section received so far,
+//cleared before every chunk-size line so that a long chunked body is not one ever growing section)
+arena_string recvALineFromServerRepsonse(SOCKET sock_Connect, arena_string_list &headers)
 {
     int byte_recv = 0;
-    string line = "";
+    arena_string line;
     int line_length = 0;
-    char recvbuff[1] = "";
+    char recvbuff[1];
 
-    while (int(recvbuff[0]) == 13 || int(recvbuff[0]) == 10)
-        byte_recv = recv(sock_Connect, recvbuff, 1, 0);
+    size_t section_bytes = 0;
+    for (size_t i = 0; i < headers.size(); i++)
+        section_bytes += headers[i].length();
+    if (headers.size() >= MAX_HEADER_LINES)
+        return rejectResponse("more than " + to_string(MAX_HEADER_LINES) + " header lines.");
     
     while (true)
     {
-        byte_recv = recv(sock_Connect, recvbuff, 1, 0);
+        byte_recv = recvSome(sock_Connect, recvbuff, 1); //served from the read-ahead buffer, not one recv() per character
 
-        if (byte_recv > 0)
-        {
-            line += recvbuff;
-            line_length++;
-        }
+        if (byte_recv <= 0)
+            return "";
+
+        line += recvbuff[0];
+        line_length++;
             
         if ((line_length > 1) && (int(line[line_length - 2]) == 13) && (int(line[line_length - 1]) == 10)) //13: CR, 10: LF - '\r\n' in ASCII
         {
             headers.push_back(line);
             return line;
         }
+
+        if (line_length > MAX_HEADER_LINE_BYTES)
+            return rejectResponse("a line longer than " + to_string(MAX_HEADER_LINE_BYTES) + " bytes.");
+        if (section_bytes + line_length > MAX_HEADER_BYTES)
+            return rejectResponse("headers larger than " + to_string(MAX_HEADER_BYTES) + " bytes.");
     }
     
     return line;
 }
 
-void getStatusCodeInfo(string line, int &status_code)
+void getStatusCodeInfo(const arena_string &line, int &status_code)
 {
     int i = 0, j;
     int n = line.length();
+    if (n < 12) //"HTTP/1.1 200" is the shortest valid status line, "" means the connection failed
+    {
+        status_code = 0;
+        console() << "No status line received from server.\n";
+        fetchNoteStatus(status_code);
+        return;
+    }
+
     while ((line[i] != ' ') && (i + 1 < n))
         i++;
 
     status_code = (int(line[i + 1]) - 48) * 100 + (int(line[i + 2]) - 48) * 10 + (int(line[i + 3]) - 48);
-    cout << "Status: " << status_code << " " << getStatus(status_code) << "\n"; 
+    console() << "Status: " << status_code << " " << getStatus(status_code) << "\n"; 
+    fetchNoteStatus(status_code);
 }
 
 string getStatus(int status_code)
@@ -1261,6 +1632,9 @@ string getStatus(int status_code)
         case 307:
             return "Temporary Redirect";
             break;
+        case 308:
+            return "Permanent Redirect";
+            break;
         case 400:
             return "Bad Request";
             break;
@@ -1339,7 +1713,7 @@ string getStatus(int status_code)
     }
 }
 
-int getContentLength(string CL_header)
+int getContentLength(const arena_string &CL_header)
 {
     int content_length = 0;
     int n = CL_header.length();
@@ -1351,6 +1725,109 @@ int getContentLength(string CL_header)
     return content_length;
 }
 
+//value of the first header called name (the case of the name does not matter), without the surrounding spaces and
+//the CRLF, "" when the response has no such header
+string getHeaderValue(const arena_string_list &headers, const char* name)
+{
+    size_t name_len = strlen(name);
+    for (size_t i = 1; i < headers.size(); i++) //headers[0] is the status line
+    {
+        const arena_string &header = headers[i];
+        if (header.length() <= name_len || header[name_len] != ':' || _strnicmp(header.c_str(), name, name_len) != 0)
+            continue;
+
+        size_t value_start = header.find_first_not_of(" \t", name_len + 1);
+        size_t value_end = header.find_last_not_of(" \t\r\n");
+        if (value_start == string::npos || value_end < value_start)
+            return "";
+
+        return string(header.c_str() + value_start, value_end - value_start + 1);
+    }
+
+    return "";
+}
+
+//HTTP/1.1 keeps the connection open unless the server sends "Connection: close", HTTP/1.0 only with "Connection: keep-alive"
+bool keepsConnectionOpen(const arena_string_list &headers)
+{
+    string connection = getHeaderValue(headers, "Connection");
+    for (size_t i = 0; i < connection.length(); i++)
+        connection[i] = tolower(connection[i]);
+
+    if (connection.find("close") != string::npos)
+        return false;
+
+    if (!headers.empty() && headers[0].compare(0, 8, "HTTP/1.0") == 0)
+        return connection.find("keep-alive") != string::npos;
+
+    return true;
+}
+
+//read the rest of a response whose status line is headers[0] and throw its body away (a redirect, or an error page
+//inside a folder), so the next request can go out on the same connection
+//returns false when the connection failed or the body has no length (it would only end when the server closes)
+bool skipResponse(SOCKET sock_Connect, int status_code, arena_string_list &headers)
+{
+    arena_string line = headers.empty() ? "" : headers.back();
+    while ((line != "\r\n") && (line != ""))
+        line = recvALineFromServerRepsonse(sock_Connect, headers);
+
+    if (line == "")
+        return false;
+
+    if (status_code == 204 || status_code == 304 || status_code / 100 == 1) //never have a body
+        return true;
+
+    string transfer_encoding = getHeaderValue(headers, "Transfer-Encoding");
+    if (transfer_encoding.find("chunked") != string::npos)
+        return discardBody(sock_Connect, -1);
+
+    string content_length = getHeaderValue(headers, "Content-Length");
+    if (content_length == "")
+        return false;
+
+    return discardBody(sock_Connect, atoll(content_length.c_str()));
+}
+
+//read a body and throw it away, content_length -1 = chunked (followed by optional trailers and an empty line)
+//returns false when the connection failed before the end of the body
+bool discardBody(SOCKET sock_Connect, long long content_length)
+{
+    char recvbuff[4096];
+    if (content_length == -1)
+    {
+        int chunk_size = recvChunkSize(sock_Connect);
+        while (chunk_size > 0)
+        {
+            for (int left = chunk_size; left > 0; )
+            {
+                int byte_recv = recvSome(sock_Connect, recvbuff, min(left, (int)sizeof(recvbuff)));
+                if (byte_recv <= 0)
+                    return false;
+                left -= byte_recv;
+            }
+
+            if (!readCRLF(sock_Connect))
+                return false;
+
+            chunk_size = recvChunkSize(sock_Connect);
+        }
+
+        //optional trailers and the empty line after the zero-size chunk
+        return chunk_size == 0 && recvTrailers(sock_Connect);
+    }
+
+    for (long long left = content_length; left > 0; )
+    {
+        int byte_recv = recvSome(sock_Connect, recvbuff, (int)min(left, (long long)sizeof(recvbuff)));
+        if (byte_recv <= 0)
+            return false;
+        left -= byte_recv;
+    }
+
+    return true;
+}
+
 string get_filename(char* addr)
 {
     string addr_str = addr;
@@ -1374,285 +1851,557 @@ string get_filename(char* addr)
     return "index.html";
 }
 
-void downloadFile(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir)
+bool downloadFile(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir, string source)
+{
+    fetchNoteBodyStarted(); //counts as complete only once fetchNoteBody() is reached
+
+    //the file's place in the output layout (layout.h), a body sink needs none
+    string path = (currentBodySink() == NULL) ? outputPath(source, folder_dir, filename) : "";
+
+    if (!journalActive())
+        return receiveBody(sock_Connect, filename, content_length, multi_threaded, folder_dir, path);
+
+    //the journal records the hash of the body, the receive loops compute it as the bytes arrive
+    body_digest digest;
+    receiving_body = &digest;
+    bool received = receiveBody(sock_Connect, filename, content_length, multi_threaded, folder_dir, path);
+    receiving_body = NULL;
+    return received;
+}
+
+bool receiveBody(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir, string path)
 {
+    if (currentBodySink() != NULL) //stream the body to the sink (library callback) instead of a file
+        return downloadToSink(sock_Connect, filename, content_length, multi_threaded);
+
+    if (content_length > 0 && output_mmap) //receive straight into the preallocated, memory-mapped file
+        return downloadFileMapped(sock_Connect, filename, content_length, multi_threaded, folder_dir, path);
+
     if (content_length > 0) //Download "content-length" type
     {
         ofstream fout;
-        if (folder_dir != "")
-            fout.open(folder_dir + filename, ios::binary);
+        write_behind_file* wb = NULL;
+        if (write_behind_threads > 0) //the disk-writer threads write the file, this thread only receives
+            wb = openWriteBehind(path, fetchWriteGroup());
         else
-            fout.open(filename, ios::binary);
+            fout.open(path, ios::binary);
 
-        if (fout.is_open())
+        if (wb != NULL || fout.is_open())
         {
             int i = 0;
             int byte_recv;
-            char recvbuff[1];
-            float progress;
-            float downloadbar = 0;
-            
-            if (multi_threaded)
-            {
-                m.lock();
-                cout << "Downloading '" << filename << "': 0%\n";
-                m.unlock();
-            }     
-            else
-                cout << "Downloading '" << filename << "': " << progressBar(0) << "\n";
+            char recvbuff[16384];
+            progress_transfer* progress = progressBegin(filename, content_length);
 
             while (i < content_length)
             {
-                byte_recv = recv(sock_Connect, recvbuff, 1, 0);
+                if (wb != NULL)
+                    byte_recv = recvIntoWriteBehind(wb, sock_Connect, content_length - i);
+                else
+                    byte_recv = recvSome(sock_Connect, recvbuff, min(content_length - i, (int)sizeof(recvbuff)));
 
                 if (byte_recv > 0)
                 {
-                    fout << recvbuff[0];
-                    i++;
-                }
-                else if (byte_recv == SOCKET_ERROR && WSAGetLastError() == WSAECONNRESET)
-                {
-                    cout << "Server prematurely closes connection.\n";
+                    if (wb == NULL)
+                    {
+                        fout.write(recvbuff, byte_recv);
+                        digestBody(recvbuff, byte_recv);
+                    }
+                    i += byte_recv;
                 }
-                
-                progress = (float(i) / content_length) * 100;
-                if (progress - downloadbar > 10)
+                else //closed, failed or timed out: stop instead of calling recv again
                 {
                     if (multi_threaded)
                     {
                         m.lock();
-                        cout << "Downloading '" << filename << "': " << fixed << setprecision(0) << progress << "%\n";
+                        console() << "Download interupted. Cannot download '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
                         m.unlock();
-                    }     
+                    }
                     else
-                        cout << "Downloading '" << filename << "': " << progressBar(progress) << "\n";
+                        console() << "Download interupted. Cannot download '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
 
-                    downloadbar = progress;
+                    if (wb != NULL)
+                        closeWriteBehind(wb);
+                    else
+                        fout.close();
+                    progressEnd(progress);
+                    return false;
                 }
-                 
+
+                progressAdvance(progress, byte_recv);
+                fetchNoteBodyProgress(i);
             }
+            progressEnd(progress);
 
             if (!multi_threaded)
             {
-                cout << "Downloading '" << filename << "': " << progressBar(100) << "\n";
                 if (folder_dir == "")
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
                 else
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
             }
             else
             {
                 m.lock();
-                cout << "Downloading '" << filename << "': 100%\n";
                 if (folder_dir == "")
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
                 else
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
                 m.unlock();
             }
             
-            fout.close();
+            long long write_start = trace_now();
+            if (wb != NULL) //the writer reports a failed write to the fetch's group (writebehind.h)
+                closeWriteBehind(wb);
+            else
+            {
+                fout.close();
+                if (fout.fail())
+                    fetchNoteWriteFailed();
+            }
+            trace_span("disk_write", "disk", write_start, trace_now(), filename.c_str());
+            stats_mark_phase(PHASE_BODY, content_length, filename.c_str());
+            fetchNoteBody(content_length);
+            aimdRecordBody(content_length);
         }
         else
         {
             if (multi_threaded)
             {
                 m.lock();
-                cout << "----------------------------------------------------------------------------------------------------------------------\n";
-                cout << "Cannot download '" << filename <<"'.\n";
+                console() << "----------------------------------------------------------------------------------------------------------------------\n";
+                console() << "Cannot download '" << filename <<"'.\n";
                 m.unlock();
             }
             else
-                cout << "\nCannot download '" << filename <<"'.\n";
+                console() << "\nCannot download '" << filename <<"'.\n";
+
+            //the body is still on the connection: read past it, or the next response would start in the middle of it
+            fetchNoteWriteFailed();
+            return discardBody(sock_Connect, content_length);
         }
             
     }
     else if (content_length == -1) //Download "Transfer-Encoding: chunked" type
     {
         ofstream fout;
-        if (folder_dir != "")
-            fout.open(folder_dir + filename, ios::binary);
+        write_behind_file* wb = NULL;
+        if (write_behind_threads > 0)
+            wb = openWriteBehind(path, fetchWriteGroup());
         else
-            fout.open(filename, ios::binary);
+            fout.open(path, ios::binary);
 
-        if (fout.is_open())
+        if (wb != NULL || fout.is_open())
         {
-            vector<string> chunk_sizes;
             int chunk_size_10;
             int byte_recv;
             int i = 1;
-            char recvbuff[1];
-            string line = recvALineFromServerRepsonse(sock_Connect, chunk_sizes);
-            chunk_size_10 = getChunkSize(line);
+            long long body_bytes = 0;
+            progress_transfer* progress = progressBegin(filename, -1);
+            chunk_size_10 = recvChunkSize(sock_Connect);
 
             while (chunk_size_10 > 0)
             {
                 if (multi_threaded)
                 {
                     m.lock();
-                    cout << "Downloading '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
+                    console() << "Downloading '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
                     m.unlock();
                 }
                 else
-                    cout << "Downloading '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
+                    console() << "Downloading '" << filename << "': chunk size: " << chunk_size_10 << " (" << i << ")\n";
                 
-                readChunk(fout, sock_Connect, chunk_size_10);
-                if (readCRLF(sock_Connect))
+                if (readChunk(fout, wb, sock_Connect, chunk_size_10) && readCRLF(sock_Connect))
                 {
-                    line = recvALineFromServerRepsonse(sock_Connect, chunk_sizes); //get next chunk_size
-                    chunk_size_10 = getChunkSize(line);
+                    body_bytes += chunk_size_10;
+                    progressAdvance(progress, chunk_size_10);
+                    fetchNoteBodyProgress(body_bytes);
+                    chunk_size_10 = recvChunkSize(sock_Connect); //get next chunk_size
                 }
                 else 
                 {
                     if (multi_threaded)
                     {
                         m.lock();
-                        cout << "Download interupted. Cannot download '" << filename << "'.\n";
+                        console() << "Download interupted. Cannot download '" << filename << "'.\n";
                         m.unlock();
                     }
                     else
-                        cout << "Download interupted. Cannot download '" << filename << "'.\n";
+                        console() << "Download interupted. Cannot download '" << filename << "'.\n";
                     
-                    fout.close();
-                    return;
+                    if (wb != NULL)
+                        closeWriteBehind(wb);
+                    else
+                        fout.close();
+                    progressEnd(progress);
+                    return false;
                 }
 
                 i++;
             }
+            progressEnd(progress);
+
+            //a zero-size chunk ends the body, it is followed by optional trailers and an empty line
+            if (chunk_size_10 < 0 || !recvTrailers(sock_Connect)) //connection closed, timed out or the response was rejected
+            {
+                if (multi_threaded)
+                {
+                    m.lock();
+                    console() << "Download interupted. Cannot download '" << filename << "'.\n";
+                    m.unlock();
+                }
+                else
+                    console() << "Download interupted. Cannot download '" << filename << "'.\n";
+
+                if (wb != NULL)
+                    closeWriteBehind(wb);
+                else
+                    fout.close();
+                return false;
+            }
 
             if (multi_threaded)
             {
                 m.lock();
                 if (folder_dir == "")
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
                 else
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
                 m.unlock();
             }
             else
                 if (folder_dir == "")
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
                 else
-                    cout << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
+                    console() << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
             
-            fout.close();
+            long long write_start = trace_now();
+            if (wb != NULL) //the writer reports a failed write to the fetch's group (writebehind.h)
+                closeWriteBehind(wb);
+            else
+            {
+                fout.close();
+                if (fout.fail())
+                    fetchNoteWriteFailed();
+            }
+            trace_span("disk_write", "disk", write_start, trace_now(), filename.c_str());
+            stats_mark_phase(PHASE_BODY, body_bytes, filename.c_str());
+            fetchNoteBody(body_bytes);
+            aimdRecordBody(body_bytes);
         }
         else
         {
             if (multi_threaded)
             {
                 m.lock();
-                cout << "Cannot download '" << filename <<"'.\n";
+                console() << "Cannot download '" << filename <<"'.\n";
                 m.unlock();
             }
             else
-                cout << "\nCannot download '" << filename <<"'.\n";
+                console() << "\nCannot download '" << filename <<"'.\n";
+
+            fetchNoteWriteFailed();
+            return discardBody(sock_Connect, -1);
         }
     }
-}
 
-string progressBar(float progress)
-{
-    if (progress >= 100)
-        return "[==============================] 100%";
-    else if (progress >= 90)
-        return "[===========================---] 90%";
-    else if (progress >= 80)
-        return "[========================------] 80%";
-    else if (progress >= 70)
-        return "[=====================---------] 70%";
-    else if (progress >= 60)
-        return "[==================------------] 60%";
-    else if (progress >= 50)
-        return "[===============---------------] 50%";
-    else if (progress >= 40)
-        return "[============------------------] 40%";
-    else if (progress >= 30)
-        return "[=========---------------------] 30%";
-    else if (progress >= 20)
-        return "[======------------------------] 20%";
-    else if (progress >= 10)
-        return "[===---------------------------] 10%";
-    else if (progress >= 0)
-        return "[------------------------------] 0%";
-    
-    return "";
+    return true;
 }
 
-int getChunkSize(string chunk_size_16) //convert hexadecimal data read from a line (in string)
+bool downloadFileMapped(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir, string path)
 {
-    int chunk_size_10 = 0;
-    int pow16 = 1;
-    int n = chunk_size_16.length() - 2; //excluding CRLF "\r\n"
-    int digit;
+    mapped_output out;
+    if (!openMappedOutput(out, path, content_length))
+    {
+        if (multi_threaded)
+        {
+            m.lock();
+            console() << "----------------------------------------------------------------------------------------------------------------------\n";
+            console() << "Cannot download '" << filename <<"'.\n";
+            m.unlock();
+        }
+        else
+            console() << "\nCannot download '" << filename <<"'.\n";
 
-    for (int i = n - 1; i >= 0; i--)
+        fetchNoteWriteFailed();
+        return discardBody(sock_Connect, content_length); //the connection stays usable for the next request
+    }
+
+    long long i = 0;
+    int byte_recv, available;
+    progress_transfer* progress = progressBegin(filename, content_length);
+
+    while (i < content_length)
     {
-        if ((int(chunk_size_16[i]) >= 48) && (int(chunk_size_16[i]) <= 57))
-            digit = int(chunk_size_16[i]) - 48;
-        else if ((int(chunk_size_16[i]) >= 97) && (int(chunk_size_16[i]) <= 102)) //lowercase a, b, c, d, e, f
-            digit = int(chunk_size_16[i]) - 87;
-        else if ((int(chunk_size_16[i]) >= 65) && (int(chunk_size_16[i]) <= 70)) //uppercase A, B, C, D, E, F
-            digit = int(chunk_size_16[i]) - 55;
-        
-        if ((digit >= 0) && (digit <= 15))
+        char* window = mappedOutputAt(out, i, available);
+        if (window == NULL)
+            byte_recv = IO_ERROR;
+        else
         {
-            chunk_size_10 += digit * pow16;
-            pow16 *= 16;
+            byte_recv = recvSome(sock_Connect, window, min(available, 1 << 20));
+            if (byte_recv > 0)
+                digestBody(window, byte_recv);
+        }
+
+        if (byte_recv <= 0) //closed, failed or timed out
+        {
+            if (multi_threaded)
+            {
+                m.lock();
+                console() << "Download interupted. Cannot download '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
+                m.unlock();
+            }
+            else
+                console() << "Download interupted. Cannot download '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
+
+            closeMappedOutput(out, i);
+            progressEnd(progress);
+            return false;
         }
+
+        i += byte_recv;
+        progressAdvance(progress, byte_recv);
+        fetchNoteBodyProgress(i);
     }
+    progressEnd(progress);
 
-    return chunk_size_10;
+    if (!multi_threaded)
+    {
+        if (folder_dir == "")
+            console() << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
+        else
+            console() << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
+    }
+    else
+    {
+        m.lock();
+        if (folder_dir == "")
+            console() << "\nSuccessfully downloaded file '" << filename << "' into program directory.\n";
+        else
+            console() << "\nSuccessfully downloaded file '" << filename << "' into program directory/" << folder_dir << ".\n";
+        m.unlock();
+    }
+
+    long long write_start = trace_now();
+    if (!closeMappedOutput(out, i))
+        fetchNoteWriteFailed();
+    trace_span("disk_write", "disk", write_start, trace_now(), filename.c_str());
+    stats_mark_phase(PHASE_BODY, content_length, filename.c_str());
+    fetchNoteBody(content_length);
+    aimdRecordBody(content_length);
+
+    return true;
 }
 
-void readChunk(ofstream &fout, SOCKET sock_Connect, int chunk_size)
+//the body goes to the thread's body sink (see sink.h), received in large reads and never written to disk
+bool downloadToSink(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded)
 {
-    int i = 0;
-    int byte_recv;
-    char recvbuff[1];
-    string chunk = "";
-    while (i < chunk_size)
+    body_sink* sink = currentBodySink();
+    char recvbuff[16384];
+    long long body_bytes = 0;
+    int byte_recv = IO_ERROR;
+    bool consumer_stopped = !sink->begin(filename, content_length);
+    bool complete = false;
+    progress_transfer* progress = progressBegin(filename, content_length);
+
+    if (content_length > 0) //Content-Length: read exactly that many bytes
     {
-        byte_recv = recv(sock_Connect, recvbuff, 1, 0);
-        if (byte_recv > 0)
+        while (!consumer_stopped && body_bytes < content_length)
         {
-            chunk += recvbuff[0];
-            i++;
+            byte_recv = recvSome(sock_Connect, recvbuff, (int)min((long long)sizeof(recvbuff), content_length - body_bytes));
+            if (byte_recv <= 0)
+                break;
+
+            body_bytes += byte_recv;
+            progressAdvance(progress, byte_recv);
+            fetchNoteBodyProgress(body_bytes);
+            digestBody(recvbuff, byte_recv);
+            consumer_stopped = !sink->write(recvbuff, byte_recv);
         }
-        else if (byte_recv == SOCKET_ERROR && WSAGetLastError() == WSAECONNRESET)
+
+        complete = (body_bytes == content_length);
+    }
+    else if (content_length == -1) //Transfer-Encoding: chunked, then optional trailers and an empty line
+    {
+        int chunk_size_10 = recvChunkSize(sock_Connect);
+
+        while (!consumer_stopped && chunk_size_10 > 0)
         {
-            cout << "Server prematurely closes connection.\n";
+            int chunk_left = chunk_size_10;
+            while (!consumer_stopped && chunk_left > 0)
+            {
+                byte_recv = recvSome(sock_Connect, recvbuff, min((int)sizeof(recvbuff), chunk_left));
+                if (byte_recv <= 0)
+                    break;
+
+                chunk_left -= byte_recv;
+                body_bytes += byte_recv;
+                progressAdvance(progress, byte_recv);
+                fetchNoteBodyProgress(body_bytes);
+                digestBody(recvbuff, byte_recv);
+                consumer_stopped = !sink->write(recvbuff, byte_recv);
+            }
+
+            if (chunk_left > 0 || consumer_stopped || !readCRLF(sock_Connect))
+            {
+                chunk_size_10 = -1;
+                break;
+            }
+
+            chunk_size_10 = recvChunkSize(sock_Connect);
         }
+
+        complete = (chunk_size_10 == 0 && recvTrailers(sock_Connect));
     }
 
-    int n = chunk.length();
-    for (int i = 0; i < n; i++)
-        fout << chunk[i];
+    complete = complete && !consumer_stopped;
+    sink->end(complete);
+    progressEnd(progress);
+
+    if (multi_threaded)
+        m.lock();
+
+    if (consumer_stopped)
+        console() << "Transfer of '" << filename << "' stopped by the consumer.\n";
+    else if (!complete)
+        console() << "Download interupted. Cannot download '" << filename << "'. " << ioErrorText(byte_recv) << "\n";
+    else
+        console() << "\nSuccessfully received '" << filename << "' (" << body_bytes << " bytes).\n";
+
+    if (multi_threaded)
+        m.unlock();
+
+    if (consumer_stopped) //not a connection failure: nothing is retried and the rest of a folder is skipped
+    {
+        fetchAbort();
+        return true;
+    }
+
+    if (!complete)
+        return false;
+
+    stats_mark_phase(PHASE_BODY, body_bytes, filename.c_str());
+    fetchNoteBody(body_bytes);
+    aimdRecordBody(body_bytes);
+
+    return true;
 }
 
-bool readCRLF(SOCKET sock_Connect)
+//the hex size at the start of a chunk-size line, up to a chunk extension (";name=value"), whitespace or the CRLF
+//-1 when the line does not start with one or it does not fit in an int, the response is rejected then
+int getChunkSize(const arena_string &chunk_size_16)
 {
-    int byte_recv;
-    char recvbuff[1];
-    string line = "";
+    int chunk_size_10 = 0;
+    size_t n = chunk_size_16.length();
+    size_t i = 0;
 
-    while (true)
+    for (; i < n; i++)
     {
-        byte_recv = recv(sock_Connect, recvbuff, 1, 0);
-        if (byte_recv > 0)
+        char c = chunk_size_16[i];
+        int digit;
+        if ((c >= '0') && (c <= '9'))
+            digit = c - '0';
+        else if ((c >= 'a') && (c <= 'f'))
+            digit = c - 'a' + 10;
+        else if ((c >= 'A') && (c <= 'F'))
+            digit = c - 'A' + 10;
+        else
+            break;
+
+        if (chunk_size_10 > (INT_MAX - digit) / 16)
         {
-            line += recvbuff[0];
+            rejectResponse("a chunk size larger than " + to_string(INT_MAX) + " bytes.");
+            return -1;
         }
+        chunk_size_10 = chunk_size_10 * 16 + digit;
+    }
+
+    if (i == 0 || (i < n && chunk_size_16[i] != ';' && chunk_size_16[i] != ' ' && chunk_size_16[i] != '\t' && chunk_size_16[i] != '\r'))
+    {
+        rejectResponse("a malformed chunk-size line.");
+        return -1;
+    }
+
+    return chunk_size_10;
+}
 
-        if (line.length() == 2)
+//the next chunk-size line, in an arena scope of its own so that a body of many chunks does not grow the request
+//arena line by line; -1 when the connection failed or the line was rejected
+int recvChunkSize(SOCKET sock_Connect)
+{
+    arena_scope line_scope;
+    arena_string_list chunk_line;
+    arena_string line = recvALineFromServerRepsonse(sock_Connect, chunk_line);
+    if (line == "")
+        return -1;
+
+    return getChunkSize(line);
+}
+
+//the trailers after the zero-size chunk up to the empty line, a header section of their own: they are held to
+//MAX_HEADER_LINES lines and MAX_HEADER_BYTES bytes like the headers; false when the connection failed or they broke
+//those limits
+bool recvTrailers(SOCKET sock_Connect)
+{
+    arena_scope trailer_scope;
+    arena_string_list trailers;
+    arena_string line;
+    do
+        line = recvALineFromServerRepsonse(sock_Connect, trailers);
+    while ((line != "\r\n") && (line != ""));
+
+    return line != "";
+}
+
+bool readChunk(ofstream &fout, write_behind_file* wb, SOCKET sock_Connect, int chunk_size)
+{
+    int i = 0;
+    int byte_recv;
+    char recvbuff[16384];
+
+    if (wb != NULL) //the chunk goes straight into write-behind buffers
+    {
+        while (i < chunk_size)
         {
-            if ((int(line[0]) == 13) && (int(line[1]) == 10))
-                return true;
+            byte_recv = recvIntoWriteBehind(wb, sock_Connect, chunk_size - i);
+            if (byte_recv <= 0)
+            {
+                console() << ioErrorText(byte_recv) << "\n";
+                return false;
+            }
+
+            i += byte_recv;
         }
 
-        if (line.length() > 2)
+        return true;
+    }
+
+    //written piece by piece as it arrives, a chunk is never held in memory as a whole (its size is the server's choice)
+    while (i < chunk_size)
+    {
+        byte_recv = recvSome(sock_Connect, recvbuff, min(chunk_size - i, (int)sizeof(recvbuff)));
+        if (byte_recv <= 0) //closed, failed or timed out
+        {
+            console() << ioErrorText(byte_recv) << "\n";
             return false;
+        }
+
+        digestBody(recvbuff, byte_recv);
+        fout.write(recvbuff, byte_recv);
+        i += byte_recv;
     }
+
+    return true;
+}
+
+bool readCRLF(SOCKET sock_Connect)
+{
+    char recvbuff[2];
+
+    if (recvExact(sock_Connect, recvbuff, 2) != 2)
+        return false;
+
+    return (int(recvbuff[0]) == 13) && (int(recvbuff[1]) == 10); //13: CR, 10: LF - '\r\n' in ASCII
 }
 
 void printline(string line)
@@ -1660,9 +2409,9 @@ void printline(string line)
     int n = line.length();
     for (int i = 0; i < n; i++)
         if (int(line[i]) == 13)
-            cout << "CR";
+            console() << "CR";
         else if (int(line[i]) == 10)
-            cout << "LF\n";
+            console() << "LF\n";
         else
-            cout << line[i];
+            console() << line[i];
 }
\ No newline at end of file
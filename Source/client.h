@@ -1,9 +1,13 @@
 #pragma once
 #include <windows.h>
+#include <iostream>
 #include <string>
+#include <vector>
+#include <unordered_set>
 #include <cstring>
 #include <WinSock2.h>
 #include <ws2tcpip.h>
+#include "arena.h"
 
 using namespace std;
 
@@ -12,31 +16,90 @@ using namespace std;
 #pragma comment (lib, "Mswsock.lib")
 #pragma comment (lib, "AdvApi32.lib")
 
+//console output of the calling thread (see fetch.h)
+ostream& console();
+void setConsoleOutput(bool enabled);
+bool consoleOutputEnabled();
+void setConsoleTarget(ostream &stream);
+
+//the connection the requests of one URL (and of its redirect targets) are sent on
+struct url_connection
+{
+    string origin = "";                 //"http://host:port" of sock, the connection pool key (pool.h)
+    SOCKET sock = INVALID_SOCKET;
+    struct addrinfo* result = NULL;     //resolved addresses of origin, for reconnects
+    bool reusable = false;              //the last response was read completely, another request may follow on sock
+};
+
+//what the caller needs to know about a response besides its body
+struct response_info
+{
+    int status_code = 0;
+    string location = "";               //"Location" of a redirect to follow, "" = none (see redirect.h)
+    bool keep_alive = false;            //the response was read completely and the server keeps the connection open
+};
+
 //main processing function
 void process_address(char* addr, bool multi_threaded);
+void request_address(char* addr, bool multi_threaded, url_connection &connection, response_info &response);
+void releaseConnection(url_connection &connection);
 bool REQUEST_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded);
-bool REQUEST_QUERY_FILENAME(SOCKET sock_Connect, char* host_name, string abs_path, string file_name, bool multi_threaded);
-void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, string folder_dir);
-bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, vector<string> &file_names);
-void RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, string file_name, bool multi_threaded, string folder_dir);
+bool REQUEST_QUERY_FILENAME(SOCKET sock_Connect, char* host_name, string abs_path, string file_name, bool multi_threaded, bool pipelined = false); //pipelined: earlier responses are still due
+string createFolder(char* addr, string Folder_name, bool multi_threaded);
+bool retryRequest(SOCKET &sock_Connect, struct addrinfo* result, char* addr, char* host_name, string abs_path, string file_name, bool multi_threaded);
+void RESPONSE_QUERY(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, string folder_dir, response_info &response);
+bool RESPONSE_QUERY_GET_FILENAMES(SOCKET sock_Connect, char* addr, char* host_name, bool multi_threaded, arena_string_list &file_names, response_info &response, struct listing_feed* feed = NULL);
+bool RESPONSE_QUERY_FILENAME(SOCKET sock_Connect, char* addr, char* host_name, string file_name, bool multi_threaded, string folder_dir, response_info &response);
 
 //support functions
 char* getHostnameFromURL(char* URL);
 bool is_HTTP_URL(char* host_name);
+bool is_HTTPS_URL(char* URL);
+void splitHostAndPort(char* host_name, string &node, string &port, string default_port);
+string urlOrigin(const string &url);
 string getIPv4(sockaddr* addr);
-string create_GET_query(char* addr, char* host_name);
+arena_string create_GET_query(char* addr, char* host_name);
 string get_abs_path(char* addr, char* host_name);
 bool hasFolderName(string abs_path);
 string getFolderName(string abs_path);
-bool isFileName(string filename);
-string recvALineFromServerRepsonse(SOCKET sock_Connect, vector<string> &lines);
-void getStatusCodeInfo(string line, int &status_code);
+bool isFileName(const arena_string &filename);
+void extractFileNames(const arena_string &contents, arena_string_list &file_names);
+
+//incremental form of extractFileNames(), fed the listing piece by piece as it arrives; file_names only gets the
+//names it has not had before
+enum href_scanner_state
+{
+    HREF_SEEK,                          //looking for "href="
+    HREF_OPEN,                          //looking for the '"' that opens the name
+    HREF_VALUE                          //collecting the name up to its closing '"'
+};
+
+struct href_scanner
+{
+    int state = HREF_SEEK;
+    int matched = 0;                    //characters of "href=" matched so far (at the end of the last piece)
+    string value;
+    bool value_too_long = false;
+    unordered_set<string> seen;
+};
+
+void scanFileNames(href_scanner &scanner, const char* data, size_t len, arena_string_list &file_names);
+arena_string recvALineFromServerRepsonse(SOCKET sock_Connect, arena_string_list &lines);
+void getStatusCodeInfo(const arena_string &line, int &status_code);
 string getStatus(int status_code);
-int getContentLength(string CL_header);
+int getContentLength(const arena_string &CL_header);
+string getHeaderValue(const arena_string_list &headers, const char* name);
+bool keepsConnectionOpen(const arena_string_list &headers);
+bool skipResponse(SOCKET sock_Connect, int status_code, arena_string_list &headers);
+bool discardBody(SOCKET sock_Connect, long long content_length);
 string get_filename(char* addr);
-int getChunkSize(string chunk_size_16);
-void readChunk(ofstream &fout, SOCKET sock_Connect, int chunk_size);
+int getChunkSize(const arena_string &chunk_size_16);    //-1 (and the response rejected) when it is not a chunk size
+int recvChunkSize(SOCKET sock_Connect);
+bool recvTrailers(SOCKET sock_Connect);
+bool readChunk(ofstream &fout, struct write_behind_file* wb, SOCKET sock_Connect, int chunk_size);
 bool readCRLF(SOCKET sock_Connect);
-void downloadFile(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir);
-string progressBar(float progress);
+bool downloadFile(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir, string source);
+bool receiveBody(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir, string path);
+bool downloadFileMapped(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded, string folder_dir, string path);
+bool downloadToSink(SOCKET sock_Connect, string filename, int content_length, bool multi_threaded);
 void printline(string line);
\ No newline at end of file
@@ -0,0 +1,499 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <map>
+#include "fetch.h"
+#include "sink.h"
+#include "aimd.h"
+#include "journal.h"
+#include "capture.h"
+#include "budget.h"
+#include "shard.h"
+#include "preconnect.h"
+#include "writebehind.h"
+
+using namespace std;
+
+struct fetch_state
+{
+    fetch_result* result;
+    bool last_body_complete;
+    bool aborted;               //the body callback asked to stop
+    int journal_job;            //-1 = not journaled
+    uint64_t body_hash;         //sum of the hashes of the bodies, for the journal
+    string failure;             //fetchFail(), "" = nothing failed so far
+    write_behind_group writes;  //its files still queued to the disk writers
+    mutex state_m;              //helper threads of the fetch report at the same time
+};
+
+static thread_local fetch_state* active_fetch = NULL;
+static once_flag winsock_once;
+
+//WSAStartup is reference counted, so this does not disturb an application (or cli.cpp) that starts Winsock itself
+static void startWinsock()
+{
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2,2), &wsaData);
+}
+
+//why a fetch did not succeed, for the journal
+static string failureReason(const fetch_result &result, const fetch_state &state)
+{
+    if (state.aborted)
+        return "stopped by the consumer";
+    if (result.write_failed)
+        return "write to disk failed";
+    if (state.failure != "")
+        return state.failure;
+    if (result.files < result.files_listed)
+        return to_string(result.files) + " of " + to_string(result.files_listed) + " files downloaded";
+    if (result.status_code == 0)
+        return "no response";
+    if (result.status_code != 200)
+        return "status " + to_string(result.status_code);
+    return "incomplete body";
+}
+
+static fetch_result runFetch(string url, fetch_options options)
+{
+    fetch_result result;
+    result.url = url;
+    captureURL(url);
+
+    fetch_state state;
+    state.result = &result;
+    state.last_body_complete = false;
+    state.aborted = false;
+    state.journal_job = journalQueue(url, 0); //already queued by fetchAll(), or a single fetch()
+    state.body_hash = 0;
+    journalRunning(state.journal_job, 0);
+    active_fetch = &state;
+
+    callback_sink sink;
+    sink.callback = options.on_body_chunk;
+    if (options.sink != NULL)
+        setBodySink(options.sink);
+    else
+        setBodySink(options.on_body_chunk ? &sink : NULL);
+    setConsoleOutput(options.console);
+
+    //process_address() takes a modifiable char*
+    vector<char> url_buffer(url.c_str(), url.c_str() + url.length() + 1);
+    process_address(url_buffer.data(), !options.exclusive_console);
+
+    setBodySink(NULL);
+    setConsoleOutput(true);
+    active_fetch = NULL;
+
+    //done only once its bodies are on disk, the writers may still be busy with them
+    if (!waitWriteBehindGroup(&state.writes))
+        result.write_failed = true;
+
+    //a folder only once every file it lists has arrived, a file that failed in the middle counts as much as the last one
+    result.success = (result.status_code == 200 && result.files > 0 && state.last_body_complete && !state.aborted &&
+                      !result.write_failed && state.failure == "" && result.files >= result.files_listed);
+    if (result.success)
+        journalDone(state.journal_job, result.body_bytes, state.body_hash);
+    else
+        journalFailed(state.journal_job, result.body_bytes, failureReason(result, state));
+    if (options.on_complete)
+        options.on_complete(result);
+
+    return result;
+}
+
+future<fetch_result> fetch(string url, fetch_options options)
+{
+    call_once(winsock_once, startWinsock);
+    return async(launch::async, runFetch, url, options);
+}
+
+//"host[:port]" of a URL, the key of its connection window (the same text getHostnameFromURL() returns)
+static string urlHost(const string &url)
+{
+    size_t scheme_end = url.find("://");
+    size_t host_start = (scheme_end == string::npos) ? 0 : scheme_end + 3;
+    return url.substr(host_start, url.find('/', host_start) - host_start);
+}
+
+//the URLs of one host in a queue, in the order they start
+struct host_queue
+{
+    string host;
+    vector<size_t> ranks;       //positions in fetch_queue::order
+    size_t next = 0;            //the first one not started yet
+};
+
+//the URLs one group of workers takes from: all of them, or those of one shard (shard.h)
+struct fetch_queue
+{
+    const vector<fetch_job>* jobs;
+    vector<size_t> order;       //indexes of this queue's jobs by priority, highest first
+    vector<host_queue> hosts;   //the same URLs by host
+    vector<fetch_result>* results;  //indexed like jobs, shared by the queues: each one only fills in its own jobs
+    vector<bool> started;       //indexed like jobs
+    size_t remaining = 0;       //URLs not started yet
+    int shard = 0;
+    mutex queue_m;
+    condition_variable room;    //a connection was released somewhere
+};
+
+static void fetchWorker(fetch_queue* queue, fetch_options options)
+{
+    enterShard(queue->shard);
+
+    while (true)
+    {
+        size_t url_idx = 0;
+        string host;
+        {
+            unique_lock<mutex> lock(queue->queue_m);
+            while (true)
+            {
+                if (queue->remaining == 0)
+                    return;
+
+                //no new URL while the memory budget is used up (budget.h), the running ones release it
+                if (!budgetHasRoom())
+                {
+                    queue->room.wait_for(lock, chrono::milliseconds(AIMD_INTERVAL_MS));
+                    continue;
+                }
+
+                //the first waiting URL whose host has room, by priority and then in the order they were given: the
+                //hosts are tried once each, by the rank of their next URL
+                vector<pair<size_t, host_queue*>> waiting;
+                for (size_t h = 0; h < queue->hosts.size(); h++)
+                {
+                    host_queue &candidate = queue->hosts[h];
+                    if (candidate.next < candidate.ranks.size())
+                        waiting.push_back(make_pair(candidate.ranks[candidate.next], &candidate));
+                }
+                sort(waiting.begin(), waiting.end());
+
+                host_queue* found = NULL;
+                for (size_t h = 0; h < waiting.size() && found == NULL; h++)
+                    if (aimdTryAcquireConnection(waiting[h].second->host))
+                        found = waiting[h].second;
+
+                if (found != NULL)
+                {
+                    url_idx = queue->order[found->ranks[found->next++]];
+                    host = found->host;
+                    break;
+                }
+
+                //every window is full, a release (or a window growing while transfers run) makes room
+                queue->room.wait_for(lock, chrono::milliseconds(AIMD_INTERVAL_MS));
+            }
+
+            queue->started[url_idx] = true;
+            queue->remaining--;
+        }
+
+        fetch_result result = runFetch((*queue->jobs)[url_idx].url, options);
+        aimdReleaseConnection(host);
+
+        {
+            lock_guard<mutex> lock(queue->queue_m);
+            (*queue->results)[url_idx] = result;
+        }
+        queue->room.notify_all();
+    }
+}
+
+//connections for the URLs of the queue that start next (preconnect.h), opened while the workers run
+static void preconnectWorker(fetch_queue* queue, int budget)
+{
+    enterShard(queue->shard);
+    vector<size_t> warm;        //URLs with a connection parked for them, not started yet
+
+    for (size_t k = 0; k < queue->order.size(); k++)
+    {
+        size_t url_idx = queue->order[k];
+        string origin = urlOrigin((*queue->jobs)[url_idx].url);
+        {
+            unique_lock<mutex> lock(queue->queue_m);
+            while (true)
+            {
+                for (size_t w = 0; w < warm.size(); )
+                    if (queue->started[warm[w]])
+                        warm.erase(warm.begin() + w);
+                    else
+                        w++;
+
+                if (queue->started[url_idx] || (int)warm.size() < budget)
+                    break;
+
+                //the next URL to start takes one of the warm connections
+                queue->room.wait_for(lock, chrono::milliseconds(AIMD_INTERVAL_MS));
+            }
+
+            if (queue->started[url_idx]) //too late, its worker connects on its own
+                continue;
+
+            bool origin_warm = false;
+            for (size_t w = 0; w < warm.size() && !origin_warm; w++)
+                origin_warm = (urlOrigin((*queue->jobs)[warm[w]].url) == origin);
+            if (origin_warm)
+                continue;
+        }
+
+        if (preconnectURL((*queue->jobs)[url_idx].url))
+            warm.push_back(url_idx);
+    }
+}
+
+static bool higherPriority(const fetch_job* jobs, size_t a, size_t b)
+{
+    return jobs[a].priority > jobs[b].priority;
+}
+
+vector<fetch_result> fetchAll(const vector<fetch_job> &jobs, fetch_options options)
+{
+    call_once(winsock_once, startWinsock);
+
+    vector<size_t> order;
+    for (size_t i = 0; i < jobs.size(); i++)
+        order.push_back(i);
+    stable_sort(order.begin(), order.end(), bind(higherPriority, jobs.data(), placeholders::_1, placeholders::_2));
+    vector<fetch_result> results(jobs.size());
+    vector<bool> done(jobs.size(), false);
+
+    //what the journal records as done is not fetched again, the rest is queued in it
+    if (journalActive())
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            long long done_bytes = journalDoneBytes(jobs[i].url);
+            if (done_bytes < 0)
+            {
+                journalQueue(jobs[i].url, jobs[i].priority);
+                continue;
+            }
+
+            results[i].url = jobs[i].url;
+            results[i].success = true;
+            results[i].status_code = 200;
+            results[i].body_bytes = done_bytes;
+            results[i].from_journal = true;
+            done[i] = true;
+        }
+
+    //one queue for everything, or one per shard with the URLs of its hosts
+    int shards = shardCount();
+    vector<unique_ptr<fetch_queue>> queues;
+    for (int k = 0; k < shards; k++)
+    {
+        queues.push_back(unique_ptr<fetch_queue>(new fetch_queue()));
+        queues[k]->jobs = &jobs;
+        queues[k]->results = &results;
+        queues[k]->started = done;
+        queues[k]->shard = k;
+    }
+    vector<map<string, size_t>> host_index(shards);
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        if (done[order[k]])
+            continue;
+
+        string host = urlHost(jobs[order[k]].url);
+        int shard = (shards == 1) ? 0 : shardOfHost(host);
+        fetch_queue &queue = *queues[shard];
+        if (host_index[shard].count(host) == 0)
+        {
+            host_index[shard][host] = queue.hosts.size();
+            queue.hosts.push_back(host_queue());
+            queue.hosts.back().host = host;
+        }
+        queue.hosts[host_index[shard][host]].ranks.push_back(queue.order.size());
+        queue.order.push_back(order[k]);
+        queue.remaining++;
+    }
+
+    //a shard needs as many workers as its hosts can run at the same time: each of its hosts up to its largest
+    //connection window (aimd.h) or its number of URLs
+    int host_window = (fixed_connections > 0) ? fixed_connections : AIMD_MAX_CONNECTIONS;
+    vector<size_t> wanted(shards, 0);
+    size_t wanted_total = 0;
+    for (int k = 0; k < shards; k++)
+    {
+        for (size_t h = 0; h < queues[k]->hosts.size(); h++)
+            wanted[k] += (min)(queues[k]->hosts[h].ranks.size(), (size_t)host_window);
+        wanted_total += wanted[k];
+    }
+
+    //the workers are split between the shards by what they need, every shard with URLs gets at least one, and the
+    //write-behind buffers (writebehind.h) follow the workers
+    vector<size_t> worker_counts(shards, 0);
+    for (int k = 0; k < shards; k++)
+    {
+        worker_counts[k] = wanted[k];
+        if (wanted_total > FETCH_MAX_WORKERS)
+            worker_counts[k] = (max)((size_t)(wanted[k] > 0 ? 1 : 0), wanted[k] * FETCH_MAX_WORKERS / wanted_total);
+    }
+    shareWriteBehindBuffers(worker_counts);
+
+    vector<thread> workers;
+    for (int k = 0; k < shards; k++)
+        for (size_t i = 0; i < worker_counts[k]; i++)
+            workers.push_back(thread(fetchWorker, queues[k].get(), options));
+
+    //and one preconnect thread per shard with URLs, the budget split exactly between them (a shard whose share is
+    //0 has none)
+    vector<int> busy_shards;
+    for (int k = 0; k < shards; k++)
+        if (queues[k]->remaining > 0)
+            busy_shards.push_back(k);
+    for (size_t i = 0; preconnect_budget > 0 && i < busy_shards.size(); i++)
+    {
+        int share = preconnect_budget / (int)busy_shards.size() + ((int)i < preconnect_budget % (int)busy_shards.size() ? 1 : 0);
+        if (share > 0)
+            workers.push_back(thread(preconnectWorker, queues[busy_shards[i]].get(), share));
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    return results;
+}
+
+vector<fetch_result> fetchAll(const vector<string> &urls, fetch_options options)
+{
+    vector<fetch_job> jobs(urls.size());
+    for (size_t i = 0; i < urls.size(); i++)
+        jobs[i].url = urls[i];
+
+    return fetchAll(jobs, options);
+}
+
+fetch_context currentFetchContext()
+{
+    fetch_context context;
+    context.state = active_fetch;
+    context.sink = currentBodySink();
+    context.console = consoleOutputEnabled();
+    context.shard = currentShard();
+    return context;
+}
+
+void adoptFetchContext(const fetch_context &context)
+{
+    active_fetch = context.state;
+    setBodySink(context.sink);
+    setConsoleOutput(context.console);
+    if (context.shard >= 0)
+        enterShard(context.shard);
+}
+
+void fetchNoteStatus(int status_code)
+{
+    if (active_fetch == NULL)
+        return;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    active_fetch->result->status_code = status_code;
+}
+
+void fetchNoteBody(long long bytes, const body_digest* digest)
+{
+    if (active_fetch == NULL)
+        return;
+
+    if (digest == NULL)
+        digest = receiving_body;
+
+    long long body_bytes;
+    {
+        lock_guard<mutex> lock(active_fetch->state_m);
+        active_fetch->result->files++;
+        active_fetch->result->body_bytes += bytes;
+        active_fetch->last_body_complete = true;
+        if (digest != NULL)
+            active_fetch->body_hash += digestValue(*digest);
+        body_bytes = active_fetch->result->body_bytes;
+    }
+
+    journalRunning(active_fetch->journal_job, body_bytes);
+}
+
+void fetchNoteBodyStarted()
+{
+    if (active_fetch == NULL)
+        return;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    active_fetch->last_body_complete = false;
+}
+
+//a running record in the middle of a body too, the journal decides how often it is written
+void fetchNoteBodyProgress(long long body_offset)
+{
+    if (active_fetch == NULL || active_fetch->journal_job < 0)
+        return;
+
+    long long body_bytes;
+    {
+        lock_guard<mutex> lock(active_fetch->state_m);
+        body_bytes = active_fetch->result->body_bytes;
+    }
+
+    journalRunning(active_fetch->journal_job, body_bytes + body_offset);
+}
+
+void fetchNoteWriteFailed()
+{
+    if (active_fetch == NULL)
+        return;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    active_fetch->result->write_failed = true;
+}
+
+void fetchNoteFilesListed(int count)
+{
+    if (active_fetch == NULL)
+        return;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    active_fetch->result->files_listed += count;
+}
+
+void fetchFail(const string &reason)
+{
+    if (active_fetch == NULL)
+        return;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    if (active_fetch->failure == "")
+        active_fetch->failure = reason;
+}
+
+write_behind_group* fetchWriteGroup()
+{
+    return (active_fetch == NULL) ? NULL : &active_fetch->writes;
+}
+
+void fetchAbort()
+{
+    if (active_fetch == NULL)
+        return;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    active_fetch->aborted = true;
+}
+
+bool fetchAborted()
+{
+    if (active_fetch == NULL)
+        return false;
+
+    lock_guard<mutex> lock(active_fetch->state_m);
+    return active_fetch->aborted;
+}
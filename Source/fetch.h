@@ -0,0 +1,87 @@
+#pragma once
+#include <future>
+#include <functional>
+#include <vector>
+#include "client.h"
+#include "sink.h"
+
+//Library API: fetch a URL (a single file, or every file of a folder listing) on its own thread
+//Without on_body_chunk the files are written into the current directory, exactly like the command line client.
+//With on_body_chunk or sink set, every body is streamed there as it arrives and nothing touches the disk.
+//The library is every .cpp file except cli.cpp (the command line front end), bench*.cpp and microbench.cpp.
+//Redirects are followed (redirect.h), idle keep-alive connections are kept for the next fetch until closePooledConnections() (pool.h).
+
+//runs on the fetch thread (concurrent fetches call it concurrently), file_name: the body being delivered, return false to abort the fetch
+typedef function<bool(const string &file_name, const char* data, size_t len)> body_chunk_callback;
+
+struct fetch_result
+{
+    string url;
+    bool success = false;           //the last response was 200 OK and every body (every listed file) arrived completely
+    int status_code = 0;            //status code of the last response, 0 = no response
+    int files = 0;                  //bodies received completely (one per file for a folder)
+    int files_listed = 0;           //files of the folder listing, 0 for a single file
+    long long body_bytes = 0;       //bytes of those bodies
+    bool write_failed = false;      //a body arrived but could not be written to disk
+    bool from_journal = false;      //not fetched, the job journal (journal.h) records it as done with body_bytes
+};
+
+typedef function<void(const fetch_result &result)> completion_callback;
+
+struct fetch_options
+{
+    body_chunk_callback on_body_chunk;  //stream bodies here instead of writing files
+    body_sink* sink = NULL;             //or hand them to a sink (sink.h: memory, stdout, null), owned by the caller
+    completion_callback on_complete;    //called on the fetch thread just before the future becomes ready
+    bool console = false;               //print the same log as the command line client
+    bool exclusive_console = false;     //this is the only transfer printing: no per-thread blocks
+};
+
+future<fetch_result> fetch(string url, fetch_options options);
+
+//one entry of a batch, a higher priority starts first (a manifest line, see schedule.h)
+struct fetch_job
+{
+    string url;
+    int priority = 0;
+};
+
+//fetch every URL, at most FETCH_MAX_WORKERS at the same time and per host only as many as its adaptive connection
+//window allows (aimd.h): a URL whose host is full waits while URLs of other hosts go ahead, and none starts while
+//the memory budget is used up (budget.h); with --shards every shard runs the URLs of its hosts (shard.h)
+//URLs start by priority, then in the order given; the results are in the order of jobs, options.on_complete is
+//called as each one finishes
+//while a journal is open (journal.h) every URL is journaled, and URLs it records as done are not fetched again
+//with a preconnect budget (preconnect.h) the connections of the URLs that start next are opened ahead of them
+#define FETCH_MAX_WORKERS 64
+vector<fetch_result> fetchAll(const vector<fetch_job> &jobs, fetch_options options);
+vector<fetch_result> fetchAll(const vector<string> &urls, fetch_options options); //every URL with priority 0
+
+//the fetch running on the calling thread (its progress, console and body sink), for helper threads that work on the
+//same fetch, e.g. the extra connections of a scheduled folder (schedule.h); adopt fetch_context() again when done
+struct fetch_state;
+struct fetch_context
+{
+    fetch_state* state = NULL;
+    body_sink* sink = NULL;
+    bool console = true;
+    int shard = -1;                     //shard.h, -1 = the thread stays where it is
+};
+
+fetch_context currentFetchContext();
+void adoptFetchContext(const fetch_context &context);
+
+//progress of the fetch running on the calling thread, called by the engine, no-ops outside fetch()
+//(safe to call from the helper threads of a fetch at the same time)
+void fetchNoteStatus(int status_code);
+struct body_digest;
+void fetchNoteBody(long long bytes, const body_digest* digest = NULL); //digest: for the journal, NULL = receiving_body
+void fetchNoteBodyStarted();
+void fetchNoteBodyProgress(long long body_offset);  //bytes of the body being received so far, for the journal
+void fetchNoteWriteFailed();
+void fetchNoteFilesListed(int count);   //a folder listing named count files, all of them have to arrive
+void fetchFail(const string &reason);   //the fetch cannot succeed any more (the first reason goes to the journal)
+struct write_behind_group;
+write_behind_group* fetchWriteGroup();  //the write-behind files of the fetch (writebehind.h), NULL outside fetch()
+void fetchAbort();
+bool fetchAborted();
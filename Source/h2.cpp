@@ -0,0 +1,749 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <cstdlib>
+#include "h2.h"
+#include "redirect.h"
+#include "hpack.h"
+#include "netio.h"
+#include "stats.h"
+#include "trace.h"
+#include "sink.h"
+#include "fetch.h"
+#include "aimd.h"
+#include "progress.h"
+#include "journal.h"
+#include "budget.h"
+#include "layout.h"
+
+using namespace std;
+
+extern mutex m; //console lock, defined in client.cpp
+
+int h2c_mode = H2C_OFF;
+
+struct h2_stream
+{
+    unsigned int id;
+    string file_name;
+    string path;                //what the request asked for
+    int status_code = 0;        //0 until the response headers have arrived
+    long long body_bytes = 0;
+    int unacked = 0;            //bytes consumed since the last WINDOW_UPDATE of this stream
+    bool buffered = false;      //kept in memory: the folder listing, or every body when a body sink is set
+    string body;
+    memory_reservation body_memory; //the capacity of body, counted against the memory budget (budget.h)
+    ofstream fout;
+    long long start_us = 0;
+    progress_transfer* progress = NULL;
+    body_digest digest;         //for the journal, the streams of a connection share its thread
+};
+
+struct h2_connection
+{
+    SOCKET sock;
+    char* addr;
+    char* host_name;
+    string abs_path;
+    bool multi_threaded;
+    string folder_dir;
+
+    hpack_decoder decoder;
+    unsigned int next_stream_id = 1;
+    unsigned int listing_stream = 0;            //stream of index.html for a folder, 0 for a single file
+    unsigned int max_open_streams = H2_MAX_OPEN_STREAMS;
+    int connection_unacked = 0;                 //bytes consumed since the last WINDOW_UPDATE of the connection
+    map<unsigned int, unique_ptr<h2_stream>> streams;   //requested and not finished yet
+    deque<string> waiting;                      //files of the listing that are not requested yet
+    vector<char> payload;
+
+    string header_block;                        //HEADERS and CONTINUATION fragments until END_HEADERS
+    unsigned int header_stream = 0;             //stream of the unfinished header block, 0 = none
+    bool header_end_stream = false;
+
+    bool got_frame = false;                     //false until the first frame: "HTTP/" instead means no h2c
+    bool not_h2 = false;
+    bool going_away = false;                    //GOAWAY received, or the consumer stopped: no new streams
+    bool failed = false;                        //the connection is unusable, every open stream is lost
+    int files_failed = 0;
+    response_info* response;                    //status and redirect of stream 1 (the URL itself), for the caller
+};
+
+string h2Uint32(unsigned int value)
+{
+    string bytes(4, '\0');
+    bytes[0] = (char)(value >> 24);
+    bytes[1] = (char)(value >> 16);
+    bytes[2] = (char)(value >> 8);
+    bytes[3] = (char)value;
+    return bytes;
+}
+
+unsigned int h2ReadUint32(const unsigned char* data)
+{
+    return ((unsigned int)data[0] << 24) | ((unsigned int)data[1] << 16) | ((unsigned int)data[2] << 8) | data[3];
+}
+
+//9-byte frame header (24-bit length, type, flags, 31-bit stream id) followed by the payload
+string h2Frame(int type, int flags, unsigned int stream_id, const string &payload)
+{
+    string frame(3, '\0');
+    frame[0] = (char)(payload.length() >> 16);
+    frame[1] = (char)(payload.length() >> 8);
+    frame[2] = (char)payload.length();
+    frame += (char)type;
+    frame += (char)flags;
+    frame += h2Uint32(stream_id & 0x7fffffff);
+    frame += payload;
+    return frame;
+}
+
+string h2Setting(int id, unsigned int value)
+{
+    string setting(2, '\0');
+    setting[0] = (char)(id >> 8);
+    setting[1] = (char)id;
+    return setting + h2Uint32(value);
+}
+
+//no server push, a larger window for every stream (the connection window is raised with a WINDOW_UPDATE)
+static string clientSettings()
+{
+    return h2Setting(H2_SETTINGS_ENABLE_PUSH, 0) + h2Setting(H2_SETTINGS_INITIAL_WINDOW_SIZE, H2_STREAM_WINDOW);
+}
+
+//value of the HTTP2-Settings header: base64url without padding (RFC 7540 section 3.2.1)
+static string base64url(const string &data)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    string encoded;
+
+    for (size_t i = 0; i < data.length(); i += 3)
+    {
+        unsigned int group = (unsigned char)data[i] << 16;
+        if (i + 1 < data.length())
+            group |= (unsigned char)data[i + 1] << 8;
+        if (i + 2 < data.length())
+            group |= (unsigned char)data[i + 2];
+
+        encoded += alphabet[(group >> 18) & 63];
+        encoded += alphabet[(group >> 12) & 63];
+        if (i + 1 < data.length())
+            encoded += alphabet[(group >> 6) & 63];
+        if (i + 2 < data.length())
+            encoded += alphabet[group & 63];
+    }
+
+    return encoded;
+}
+
+static void h2Log(h2_connection &conn, const string &text)
+{
+    if (conn.multi_threaded)
+    {
+        m.lock();
+        console() << "[Thread " << this_thread::get_id() << "] - " << conn.addr << ":\n";
+        console() << text;
+        m.unlock();
+    }
+    else
+        console() << text;
+}
+
+static bool sendFrames(h2_connection &conn, const string &frames)
+{
+    if (conn.failed)
+        return false;
+
+    if (sendAll(conn.sock, frames.data(), (int)frames.length()) <= 0)
+    {
+        h2Log(conn, "Failed to send HTTP/2 frames to server. (Connection closed)\n");
+        conn.failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+static void connectionError(h2_connection &conn, int error_code, string reason)
+{
+    h2Log(conn, "HTTP/2 connection error: " + reason + "\n");
+    sendFrames(conn, h2Frame(H2_GOAWAY, 0, 0, h2Uint32(0) + h2Uint32(error_code)));
+    conn.failed = true;
+}
+
+static h2_stream* addStream(h2_connection &conn, string path, string file_name, bool buffered)
+{
+    unique_ptr<h2_stream> stream(new h2_stream());
+    stream->id = conn.next_stream_id;
+    stream->file_name = file_name;
+    stream->path = path;
+    stream->buffered = buffered;
+    stream->start_us = trace_now();
+
+    conn.next_stream_id += 2; //client streams are odd
+    h2_stream* added = stream.get();
+    conn.streams[added->id] = move(stream);
+    return added;
+}
+
+//register a stream and return its HEADERS frame (a GET has no body, the request ends with its headers)
+static string openStream(h2_connection &conn, string path, string file_name, bool buffered)
+{
+    h2_stream* stream = addStream(conn, path, file_name, buffered);
+
+    string block;
+    hpackEncode(block, ":method", "GET");
+    hpackEncode(block, ":scheme", "http");
+    hpackEncode(block, ":authority", conn.host_name);
+    hpackEncode(block, ":path", path);
+
+    h2Log(conn, "\nQUERY: GET " + file_name + " at " + conn.host_name + " (stream " + to_string(stream->id) + ").\n");
+    return h2Frame(H2_HEADERS, H2_FLAG_END_STREAM | H2_FLAG_END_HEADERS, stream->id, block);
+}
+
+//request files of the listing until the concurrency limit is reached, all HEADERS frames go out in one send
+static void openWaitingStreams(h2_connection &conn)
+{
+    string frames;
+    while (!conn.going_away && !conn.waiting.empty() && conn.streams.size() < conn.max_open_streams)
+    {
+        string file_name = conn.waiting.front();
+        conn.waiting.pop_front();
+        frames += openStream(conn, conn.abs_path + file_name, file_name, currentBodySink() != NULL);
+    }
+
+    if (!frames.empty())
+        sendFrames(conn, frames);
+}
+
+//a whole body at a time: begin()/end() of streams that arrive interleaved must not overlap (see stdout_sink)
+static bool deliverToSink(h2_stream* stream, bool complete)
+{
+    body_sink* sink = currentBodySink();
+    if (!sink->begin(stream->file_name, stream->body.length()))
+    {
+        sink->end(false);
+        return false;
+    }
+
+    for (size_t sent = 0; sent < stream->body.length(); sent += 1 << 20)
+    {
+        int n = (int)min(stream->body.length() - sent, (size_t)(1 << 20));
+        if (!sink->write(stream->body.data() + sent, n))
+        {
+            sink->end(false);
+            return false;
+        }
+    }
+
+    sink->end(complete);
+    return true;
+}
+
+static void listingReceived(h2_connection &conn, h2_stream* stream)
+{
+    stats_mark_phase(PHASE_BODY, stream->body.length(), "index.html");
+    h2Log(conn, "\nSuccessfully fetched file 'index.html'.\n");
+
+    arena_string contents(stream->body.data(), stream->body.length());
+    arena_string_list file_names;
+    extractFileNames(contents, file_names);
+
+    string list = "List of files to be downloaded:\n";
+    for (size_t i = 0; i < file_names.size(); i++)
+    {
+        list += string(file_names[i].c_str(), file_names[i].length()) + "\n";
+        conn.waiting.push_back(string(file_names[i].c_str(), file_names[i].length()));
+    }
+    h2Log(conn, list);
+    fetchNoteFilesListed((int)file_names.size());
+
+    conn.folder_dir = createFolder(conn.addr, getFolderName(conn.abs_path), conn.multi_threaded);
+}
+
+//the stream is over: complete (END_STREAM) or cut short (reason says why), it is removed from the connection
+static void finishStream(h2_connection &conn, h2_stream* stream, bool complete, string reason)
+{
+    progressEnd(stream->progress);
+
+    if (stream->status_code == 200 && stream->id == conn.listing_stream)
+    {
+        if (complete)
+            listingReceived(conn, stream);
+        else
+        {
+            h2Log(conn, "Download interupted. Cannot fetch 'index.html'. " + reason + "\n");
+            fetchFail("incomplete folder listing");
+        }
+    }
+    else if (stream->status_code == 200)
+    {
+        bool consumer_stopped = false;
+        if (stream->buffered)
+            consumer_stopped = !deliverToSink(stream, complete);
+        else
+        {
+            stream->fout.close();
+            if (stream->fout.fail())
+                fetchNoteWriteFailed();
+        }
+
+        if (consumer_stopped) //not a connection failure: the rest of the folder is skipped
+        {
+            h2Log(conn, "Transfer of '" + stream->file_name + "' stopped by the consumer.\n");
+            fetchAbort();
+            conn.going_away = true;
+        }
+        else if (complete)
+        {
+            h2Log(conn, "Successfully received '" + stream->file_name + "' (" + to_string(stream->body_bytes) + " bytes).\n");
+            stats_mark_phase(PHASE_BODY, stream->body_bytes, stream->file_name.c_str());
+            fetchNoteBody(stream->body_bytes, &stream->digest);
+            aimdRecordBody(stream->body_bytes);
+        }
+        else
+        {
+            h2Log(conn, "Download interupted. Cannot download '" + stream->file_name + "'. " + reason + "\n");
+            conn.files_failed++;
+        }
+    }
+    else if (!complete && stream->status_code == 0) //no response at all
+    {
+        h2Log(conn, "Failed to download '" + stream->file_name + "'. " + reason + "\n");
+        conn.files_failed++;
+    }
+
+    trace_span("h2_stream", "http2", stream->start_us, trace_now(), stream->file_name.c_str());
+    conn.streams.erase(stream->id);
+    beginRequestDeadline(); //every finished stream is progress, the request timeout restarts
+}
+
+static h2_stream* findStream(h2_connection &conn, unsigned int stream_id)
+{
+    map<unsigned int, unique_ptr<h2_stream>>::iterator found = conn.streams.find(stream_id);
+    return (found == conn.streams.end()) ? NULL : found->second.get();
+}
+
+static void headersReceived(h2_connection &conn)
+{
+    vector<hpack_header> headers;
+    bool decoded = hpackDecode(conn.decoder, (const unsigned char*)conn.header_block.data(), conn.header_block.length(), headers);
+    unsigned int stream_id = conn.header_stream;
+    conn.header_stream = 0;
+    conn.header_block.clear();
+
+    if (!decoded) //the dynamic table is out of sync with the server's, nothing on this connection can be trusted
+    {
+        connectionError(conn, H2_COMPRESSION_ERROR, "malformed header block.");
+        return;
+    }
+
+    h2_stream* stream = findStream(conn, stream_id);
+    if (stream == NULL) //a stream that was already finished or reset
+        return;
+
+    if (stream->status_code == 0) //response headers, anything later is a trailer
+    {
+        int status_code = 0;
+        for (size_t i = 0; i < headers.size(); i++)
+            if (headers[i].name == ":status")
+                status_code = atoi(headers[i].value.c_str());
+
+        if (status_code >= 100 && status_code < 200) //informational, the real response follows
+            return;
+
+        stream->status_code = status_code;
+        fetchNoteStatus(status_code);
+        if (stream->id == 1)
+        {
+            stats_mark_phase(PHASE_STATUS_LINE);
+            stats_mark_phase(PHASE_HEADERS);
+            conn.response->status_code = status_code;
+        }
+
+        if (status_code == 200)
+        {
+            h2Log(conn, "Status: 200 OK ('" + stream->file_name + "', stream " + to_string(stream->id) + ")\n");
+            long long content_length = -1;
+            for (size_t i = 0; i < headers.size(); i++)
+                if (headers[i].name == "content-length")
+                    content_length = atoll(headers[i].value.c_str());
+            stream->progress = progressBegin(stream->file_name, content_length);
+            if (!stream->buffered)
+            {
+                fetchNoteBodyStarted();
+                stream->fout.open(outputPath(conn.host_name + stream->path, conn.folder_dir, stream->file_name), ios::binary);
+                if (!stream->fout.is_open())
+                {
+                    sendFrames(conn, h2Frame(H2_RST_STREAM, 0, stream->id, h2Uint32(H2_CANCEL)));
+                    stream->status_code = 0;
+                    finishStream(conn, stream, false, "Cannot create the file.");
+                    return;
+                }
+            }
+        }
+        else if (stream->id == 1 && isRedirect(status_code)) //the caller follows it (redirects of the files of a folder are not)
+        {
+            for (size_t i = 0; i < headers.size(); i++)
+                if (headers[i].name == "location")
+                    conn.response->location = headers[i].value;
+            h2Log(conn, "Status: " + to_string(status_code) + " " + getStatus(status_code) + " ('" + stream->file_name + "')\n");
+        }
+        else
+        {
+            h2Log(conn, "Status: " + to_string(status_code) + " " + getStatus(status_code) + " ('" + stream->file_name + "')\n"
+                        "Server responded with non-OK status code for '" + stream->file_name + "'.\n");
+            if (conn.listing_stream != 0 && stream->id != conn.listing_stream)
+                fetchFail("status " + to_string(status_code) + " for '" + stream->file_name + "'");
+        }
+    }
+
+    if (conn.header_end_stream)
+        finishStream(conn, stream, true, "");
+}
+
+static void dataReceived(h2_connection &conn, h2_stream* stream, int flags, const char* data, int len, int frame_len)
+{
+    string window_updates;
+
+    //the whole frame (padding included) counts against both windows, even for a stream that is gone
+    conn.connection_unacked += frame_len;
+    if (conn.connection_unacked >= H2_CONNECTION_WINDOW / 2)
+    {
+        window_updates += h2Frame(H2_WINDOW_UPDATE, 0, 0, h2Uint32(conn.connection_unacked));
+        conn.connection_unacked = 0;
+    }
+
+    if (stream != NULL)
+    {
+        if (stream->status_code == 200)
+        {
+            if (stream->buffered)
+            {
+                size_t capacity = stream->body.capacity();
+                stream->body.append(data, len);
+                //counted without waiting: this thread is the one that finishes the streams holding the budget
+                if (stream->body.capacity() > capacity)
+                    budgetCharge(stream->body_memory, stream->body.capacity() - capacity);
+            }
+            else
+                stream->fout.write(data, len);
+            stream->body_bytes += len;
+            progressAdvance(stream->progress, len);
+            fetchNoteBodyProgress(stream->body_bytes);
+            if (journalActive())
+                digestAdd(stream->digest, data, len);
+        }
+
+        //the window is given back once the bytes are written out, so a slow disk slows down this stream only
+        stream->unacked += frame_len;
+        if (!(flags & H2_FLAG_END_STREAM) && stream->unacked >= H2_STREAM_WINDOW / 2)
+        {
+            window_updates += h2Frame(H2_WINDOW_UPDATE, 0, stream->id, h2Uint32(stream->unacked));
+            stream->unacked = 0;
+        }
+    }
+
+    if (!window_updates.empty())
+        sendFrames(conn, window_updates);
+
+    if (stream != NULL && (flags & H2_FLAG_END_STREAM))
+        finishStream(conn, stream, true, "");
+}
+
+static void goawayReceived(h2_connection &conn, const unsigned char* payload, int len)
+{
+    if (len < 8)
+    {
+        connectionError(conn, H2_FRAME_SIZE_ERROR, "GOAWAY frame too short.");
+        return;
+    }
+
+    unsigned int last_stream_id = h2ReadUint32(payload) & 0x7fffffff;
+    unsigned int error_code = h2ReadUint32(payload + 4);
+    h2Log(conn, "Server is closing the HTTP/2 connection (GOAWAY, error code " + to_string(error_code) + ").\n");
+    conn.going_away = true;
+
+    //streams above last_stream_id were never processed by the server
+    vector<h2_stream*> refused;
+    for (map<unsigned int, unique_ptr<h2_stream>>::iterator it = conn.streams.begin(); it != conn.streams.end(); it++)
+        if (it->first > last_stream_id)
+            refused.push_back(it->second.get());
+
+    for (size_t i = 0; i < refused.size(); i++)
+        finishStream(conn, refused[i], false, "Refused by the server (GOAWAY).");
+}
+
+//receive and handle one frame, returns false when the connection cannot be used any more
+static bool receiveFrame(h2_connection &conn)
+{
+    unsigned char header[H2_FRAME_HEADER_BYTES];
+    int byte_recv = recvExact(conn.sock, (char*)header, H2_FRAME_HEADER_BYTES);
+    if (byte_recv <= 0)
+    {
+        if (!conn.got_frame) //closed instead of answering the preface
+            conn.not_h2 = true;
+        else
+            h2Log(conn, "HTTP/2 connection lost. " + ioErrorText(byte_recv) + "\n");
+
+        conn.failed = true;
+        return false;
+    }
+
+    if (!conn.got_frame && memcmp(header, "HTTP/", 5) == 0) //an HTTP/1.1 server answering the preface
+    {
+        conn.not_h2 = true;
+        conn.failed = true;
+        return false;
+    }
+    conn.got_frame = true;
+
+    int len = (header[0] << 16) | (header[1] << 8) | header[2];
+    int type = header[3];
+    int flags = header[4];
+    unsigned int stream_id = h2ReadUint32(header + 5) & 0x7fffffff;
+
+    if (len > H2_MAX_FRAME_SIZE)
+    {
+        connectionError(conn, H2_FRAME_SIZE_ERROR, "frame larger than " + to_string(H2_MAX_FRAME_SIZE) + " bytes.");
+        return false;
+    }
+
+    unsigned char* payload = (unsigned char*)conn.payload.data();
+    if (len > 0)
+    {
+        byte_recv = recvExact(conn.sock, (char*)payload, len);
+        if (byte_recv <= 0)
+        {
+            h2Log(conn, "HTTP/2 connection lost. " + ioErrorText(byte_recv) + "\n");
+            conn.failed = true;
+            return false;
+        }
+    }
+
+    if (conn.header_stream != 0 && type != H2_CONTINUATION) //a header block must not be interrupted
+    {
+        connectionError(conn, H2_PROTOCOL_ERROR, "header block interrupted.");
+        return false;
+    }
+
+    int pad = 0;
+    int offset = 0;
+    switch (type)
+    {
+        case H2_DATA:
+            if (flags & H2_FLAG_PADDED)
+            {
+                pad = (len > 0) ? payload[0] : len + 1;
+                offset = 1;
+            }
+            if (offset + pad > len)
+            {
+                connectionError(conn, H2_PROTOCOL_ERROR, "bad DATA padding.");
+                return false;
+            }
+            dataReceived(conn, findStream(conn, stream_id), flags, (const char*)payload + offset, len - offset - pad, len);
+            break;
+
+        case H2_HEADERS:
+            if (flags & H2_FLAG_PADDED)
+            {
+                pad = (len > 0) ? payload[0] : len + 1;
+                offset = 1;
+            }
+            if (flags & H2_FLAG_PRIORITY)
+                offset += 5;
+            if (offset + pad > len || stream_id == 0)
+            {
+                connectionError(conn, H2_PROTOCOL_ERROR, "bad HEADERS frame.");
+                return false;
+            }
+
+            conn.header_block.assign((const char*)payload + offset, len - offset - pad);
+            conn.header_stream = stream_id;
+            conn.header_end_stream = (flags & H2_FLAG_END_STREAM) != 0;
+            if (flags & H2_FLAG_END_HEADERS)
+                headersReceived(conn);
+            break;
+
+        case H2_CONTINUATION:
+            if (conn.header_stream == 0 || stream_id != conn.header_stream)
+            {
+                connectionError(conn, H2_PROTOCOL_ERROR, "unexpected CONTINUATION frame.");
+                return false;
+            }
+
+            if (conn.header_block.length() + len > MAX_HEADER_BYTES)
+            {
+                connectionError(conn, H2_PROTOCOL_ERROR, "header block larger than " + to_string(MAX_HEADER_BYTES) + " bytes.");
+                return false;
+            }
+            conn.header_block.append((const char*)payload, len);
+            if (flags & H2_FLAG_END_HEADERS)
+                headersReceived(conn);
+            break;
+
+        case H2_RST_STREAM:
+            if (len == 4 && findStream(conn, stream_id) != NULL)
+                finishStream(conn, findStream(conn, stream_id), false,
+                             "Stream reset by the server (error code " + to_string(h2ReadUint32(payload)) + ").");
+            break;
+
+        case H2_SETTINGS:
+            if (flags & H2_FLAG_ACK)
+                break;
+            if (len % 6 != 0)
+            {
+                connectionError(conn, H2_FRAME_SIZE_ERROR, "bad SETTINGS frame.");
+                return false;
+            }
+
+            for (int i = 0; i < len; i += 6)
+            {
+                int id = (payload[i] << 8) | payload[i + 1];
+                unsigned int value = h2ReadUint32(payload + i + 2);
+                if (id == H2_SETTINGS_MAX_CONCURRENT_STREAMS)
+                    conn.max_open_streams = min(value, (unsigned int)H2_MAX_OPEN_STREAMS);
+            }
+            sendFrames(conn, h2Frame(H2_SETTINGS, H2_FLAG_ACK, 0, ""));
+            break;
+
+        case H2_PING:
+            if (!(flags & H2_FLAG_ACK))
+                sendFrames(conn, h2Frame(H2_PING, H2_FLAG_ACK, 0, string((const char*)payload, len)));
+            break;
+
+        case H2_GOAWAY:
+            goawayReceived(conn, payload, len);
+            break;
+
+        case H2_PUSH_PROMISE: //disabled in our SETTINGS
+            connectionError(conn, H2_PROTOCOL_ERROR, "unexpected PUSH_PROMISE.");
+            return false;
+
+        default: //WINDOW_UPDATE (the client sends no DATA), PRIORITY and unknown frame types
+            break;
+    }
+
+    return !conn.failed;
+}
+
+//send the HTTP/1.1 request for abs_path with "Upgrade: h2c", returns 1 when the server switched to HTTP/2
+//(its response comes on stream 1), 0 when it answered over HTTP/1.1 and -1 when the connection failed
+static int upgradeConnection(h2_connection &conn)
+{
+    string request = "GET " + conn.abs_path + " HTTP/1.1\r\nHost: " + conn.host_name + "\r\n";
+    request += "Connection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: " + base64url(clientSettings()) + "\r\n\r\n";
+
+    if (sendAll(conn.sock, request.data(), (int)request.length()) <= 0)
+        return -1;
+
+    h2Log(conn, "\nSent HTTP/1.1 request with 'Upgrade: h2c' to '" + string(conn.host_name) + "'.\n");
+
+    arena_string_list lines;
+    arena_string line = recvALineFromServerRepsonse(conn.sock, lines);
+    if (line == "")
+        return -1;
+    if (line.compare(0, 12, "HTTP/1.1 101") != 0)
+        return 0;
+
+    while ((line != "\r\n") && (line != ""))
+        line = recvALineFromServerRepsonse(conn.sock, lines);
+
+    return (line == "") ? -1 : 1;
+}
+
+bool fetchH2C(SOCKET sock_Connect, char* addr, char* host_name, string abs_path, bool multi_threaded, response_info &response)
+{
+    h2_connection conn;
+    conn.response = &response;
+    conn.sock = sock_Connect;
+    conn.addr = addr;
+    conn.host_name = host_name;
+    conn.abs_path = abs_path;
+    conn.multi_threaded = multi_threaded;
+    conn.payload.resize(H2_MAX_FRAME_SIZE);
+
+    bool folder = hasFolderName(abs_path);
+    string file_name = folder ? "index.html" : get_filename(addr);
+    bool buffered = folder || currentBodySink() != NULL;
+    if (folder)
+        conn.listing_stream = 1;
+
+    //small control frames (SETTINGS ACK, WINDOW_UPDATE) are followed by HEADERS, Nagle's algorithm would hold those
+    //back until the server's delayed ACK
+    int no_delay = 1;
+    setsockopt(sock_Connect, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+
+    //the client preface: magic, SETTINGS and a larger connection window
+    string frames = H2_PREFACE;
+    frames += h2Frame(H2_SETTINGS, 0, 0, clientSettings());
+    frames += h2Frame(H2_WINDOW_UPDATE, 0, 0, h2Uint32(H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW));
+
+    beginRequestDeadline();
+    if (h2c_mode == H2C_UPGRADE)
+    {
+        int upgraded = upgradeConnection(conn);
+        if (upgraded <= 0)
+        {
+            h2Log(conn, (upgraded == 0) ? "Server declined the h2c upgrade. Using HTTP/1.1.\n"
+                                        : "Connection failed during the h2c upgrade. Retrying with HTTP/1.1.\n");
+            return false;
+        }
+
+        h2Log(conn, "Switched to HTTP/2 (h2c).\n");
+        addStream(conn, abs_path, file_name, buffered); //stream 1 is the upgraded request, half closed already
+        conn.got_frame = true;
+    }
+    else
+        frames += openStream(conn, abs_path, file_name, buffered);
+
+    if (!sendFrames(conn, frames))
+        return false;
+    stats_mark_phase(PHASE_REQUEST_SENT);
+
+    while (!conn.failed && !fetchAborted())
+    {
+        openWaitingStreams(conn);
+        if (conn.streams.empty())
+            break;
+
+        receiveFrame(conn);
+    }
+
+    if (conn.not_h2)
+    {
+        h2Log(conn, "Server does not speak HTTP/2 over cleartext. Using HTTP/1.1.\n");
+        return false;
+    }
+
+    //whatever is still open was lost with the connection (or the consumer stopped the transfer)
+    vector<h2_stream*> lost;
+    for (map<unsigned int, unique_ptr<h2_stream>>::iterator it = conn.streams.begin(); it != conn.streams.end(); it++)
+        lost.push_back(it->second.get());
+    for (size_t i = 0; i < lost.size(); i++)
+        finishStream(conn, lost[i], false, fetchAborted() ? "Transfer stopped." : "HTTP/2 connection lost.");
+
+    if (!conn.waiting.empty() && !fetchAborted())
+    {
+        h2Log(conn, to_string(conn.waiting.size()) + " file(s) of the folder were not requested.\n");
+        conn.files_failed += (int)conn.waiting.size();
+    }
+
+    if (!conn.failed)
+        sendFrames(conn, h2Frame(H2_GOAWAY, 0, 0, h2Uint32(0) + h2Uint32(H2_NO_ERROR)));
+
+    if (conn.files_failed > 0) //the fetch() result reports the folder as incomplete
+        fetchFail(to_string(conn.files_failed) + " file(s) of the folder not downloaded");
+
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "client.h"
+
+//HTTP/2 over cleartext TCP (h2c, --h2c)
+//The URL is fetched over a single HTTP/2 connection. For a folder, every file of the listing is requested
+//as its own stream as soon as index.html has arrived, and the server interleaves the bodies. Head-of-line
+//blocking goes away without opening more TCP connections. Every stream has a receive window of
+//H2_STREAM_WINDOW bytes that is given back (WINDOW_UPDATE) once half of it has been written out. A slow
+//disk therefore holds back the server without stalling the other streams.
+//Headers are compressed with HPACK (hpack.h).
+//ref: https://www.rfc-editor.org/rfc/rfc9113 (HTTP/2), https://www.rfc-editor.org/rfc/rfc7540#section-3.2 (Upgrade: h2c)
+
+#define H2C_OFF 0
+#define H2C_PRIOR_KNOWLEDGE 1   //the connection starts with the HTTP/2 preface (--h2c)
+#define H2C_UPGRADE 2           //the first request asks for "Upgrade: h2c", HTTP/1.1 if the server declines (--h2c=upgrade)
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_BYTES 24
+
+//frame types (RFC 9113 section 6)
+#define H2_DATA 0x0
+#define H2_HEADERS 0x1
+#define H2_PRIORITY 0x2
+#define H2_RST_STREAM 0x3
+#define H2_SETTINGS 0x4
+#define H2_PUSH_PROMISE 0x5
+#define H2_PING 0x6
+#define H2_GOAWAY 0x7
+#define H2_WINDOW_UPDATE 0x8
+#define H2_CONTINUATION 0x9
+
+//frame flags
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+//settings
+#define H2_SETTINGS_HEADER_TABLE_SIZE 0x1
+#define H2_SETTINGS_ENABLE_PUSH 0x2
+#define H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define H2_SETTINGS_MAX_FRAME_SIZE 0x5
+
+//error codes
+#define H2_NO_ERROR 0x0
+#define H2_PROTOCOL_ERROR 0x1
+#define H2_FLOW_CONTROL_ERROR 0x3
+#define H2_FRAME_SIZE_ERROR 0x6
+#define H2_CANCEL 0x8
+#define H2_COMPRESSION_ERROR 0x9
+
+#define H2_FRAME_HEADER_BYTES 9
+#define H2_MAX_FRAME_SIZE 16384         //largest frame payload either side sends (the protocol default)
+#define H2_DEFAULT_WINDOW 65535         //initial flow control window of a connection and of every stream
+#define H2_STREAM_WINDOW (1 << 20)      //receive window the client gives every stream
+#define H2_CONNECTION_WINDOW (16 << 20) //receive window the client gives the whole connection
+#define H2_MAX_OPEN_STREAMS 100         //streams (and open files) at a time, lower if the server asks for it
+
+extern int h2c_mode; //H2C_OFF, H2C_PRIOR_KNOWLEDGE or H2C_UPGRADE
+
+//frame helpers, also used by the h2c server stand-in (bench_server.cpp)
+string h2Frame(int type, int flags, unsigned int stream_id, const string &payload);
+string h2Setting(int id, unsigned int value);
+string h2Uint32(unsigned int value);
+unsigned int h2ReadUint32(const unsigned char* data);
+
+//fetch addr over h2c on the connected socket, returns false when the server does not speak h2c
+//(nothing has been downloaded, the caller starts over with HTTP/1.1 on a new connection)
+//response.location is set when the server redirected addr itself
+bool fetchH2C(SOCKET sock_Connect, char* addr, char* host_name, string abs_path, bool multi_threaded, response_info &response);
@@ -0,0 +1,381 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include "hpack.h"
+
+using namespace std;
+
+struct hpack_static_entry
+{
+    const char* name;
+    const char* value;
+};
+
+//RFC 7541 Appendix A, index 1 is the first entry
+static const hpack_static_entry static_table[] =
+{
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""}
+};
+
+static const size_t static_table_entries = sizeof(static_table) / sizeof(static_table[0]);
+
+struct huffman_code
+{
+    unsigned int code;
+    int bits;
+};
+
+//RFC 7541 Appendix B, one code per byte value plus EOS (256)
+static const huffman_code huffman_codes[257] =
+{
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+struct huffman_node
+{
+    int child[2];   //index of the next node, 0 = no branch
+    int symbol;     //decoded byte on a leaf, -1 on an inner node
+};
+
+//decoding tree built once from huffman_codes, node 0 is the root
+static const vector<huffman_node>& huffmanTree()
+{
+    static const vector<huffman_node> tree = []
+    {
+        vector<huffman_node> nodes(1, huffman_node{{0, 0}, -1});
+        for (int symbol = 0; symbol < 257; symbol++)
+        {
+            int node = 0;
+            for (int bit = huffman_codes[symbol].bits - 1; bit >= 0; bit--)
+            {
+                int branch = (huffman_codes[symbol].code >> bit) & 1;
+                if (nodes[node].child[branch] == 0)
+                {
+                    nodes[node].child[branch] = (int)nodes.size();
+                    nodes.push_back(huffman_node{{0, 0}, -1});
+                }
+                node = nodes[node].child[branch];
+            }
+            nodes[node].symbol = symbol;
+        }
+        return nodes;
+    }();
+
+    return tree;
+}
+
+static bool huffmanDecode(const unsigned char* data, size_t len, string &out)
+{
+    const vector<huffman_node> &tree = huffmanTree();
+    int node = 0;
+    int pending_bits = 0;       //bits read since the last complete symbol
+    bool pending_ones = true;   //and all of them were 1: valid padding if the string ends here
+
+    for (size_t i = 0; i < len; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            int branch = (data[i] >> bit) & 1;
+            node = tree[node].child[branch];
+            if (node == 0)
+                return false;
+
+            pending_bits++;
+            pending_ones = pending_ones && (branch == 1);
+
+            if (tree[node].symbol >= 0)
+            {
+                if (tree[node].symbol == 256) //EOS inside a string is an error
+                    return false;
+
+                out += (char)tree[node].symbol;
+                node = 0;
+                pending_bits = 0;
+                pending_ones = true;
+            }
+        }
+    }
+
+    //padding: a prefix of EOS (all ones), shorter than a byte
+    return pending_bits < 8 && pending_ones;
+}
+
+//integer with an n-bit prefix (RFC 7541 section 5.1)
+static bool decodeInteger(const unsigned char* &pos, const unsigned char* end, int prefix_bits, size_t &value)
+{
+    if (pos >= end)
+        return false;
+
+    size_t prefix_max = (1 << prefix_bits) - 1;
+    value = *pos & prefix_max;
+    pos++;
+    if (value < prefix_max)
+        return true;
+
+    for (int shift = 0; pos < end; shift += 7)
+    {
+        if (shift > 28) //larger than any length or index a header block can hold
+            return false;
+
+        unsigned char byte = *pos++;
+        value += (size_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void encodeInteger(string &block, unsigned char first_byte, int prefix_bits, size_t value)
+{
+    size_t prefix_max = (1 << prefix_bits) - 1;
+    if (value < prefix_max)
+    {
+        block += (char)(first_byte | value);
+        return;
+    }
+
+    block += (char)(first_byte | prefix_max);
+    value -= prefix_max;
+    while (value >= 0x80)
+    {
+        block += (char)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    block += (char)value;
+}
+
+//string literal (RFC 7541 section 5.2), the H bit selects Huffman coding
+static bool decodeString(const unsigned char* &pos, const unsigned char* end, string &out)
+{
+    if (pos >= end)
+        return false;
+
+    bool huffman = (*pos & 0x80) != 0;
+    size_t len;
+    if (!decodeInteger(pos, end, 7, len) || len > (size_t)(end - pos))
+        return false;
+
+    out.clear();
+    if (huffman)
+    {
+        if (!huffmanDecode(pos, len, out))
+            return false;
+    }
+    else
+        out.assign((const char*)pos, len);
+
+    pos += len;
+    return true;
+}
+
+static void evictEntries(hpack_decoder &decoder, size_t max_size)
+{
+    while (decoder.table_size > max_size && !decoder.dynamic_table.empty())
+    {
+        const hpack_header &oldest = decoder.dynamic_table.back();
+        decoder.table_size -= oldest.name.length() + oldest.value.length() + 32;
+        decoder.dynamic_table.pop_back();
+    }
+}
+
+static void addEntry(hpack_decoder &decoder, const hpack_header &header)
+{
+    size_t entry_size = header.name.length() + header.value.length() + 32;
+    evictEntries(decoder, (entry_size > decoder.max_table_size) ? 0 : decoder.max_table_size - entry_size);
+
+    if (entry_size <= decoder.max_table_size) //an entry larger than the whole table just empties it
+    {
+        decoder.dynamic_table.push_front(header);
+        decoder.table_size += entry_size;
+    }
+}
+
+//index 1..61: static table, 62 and up: dynamic table, newest first
+static bool lookupIndex(hpack_decoder &decoder, size_t index, hpack_header &header)
+{
+    if (index == 0)
+        return false;
+
+    if (index <= static_table_entries)
+    {
+        header.name = static_table[index - 1].name;
+        header.value = static_table[index - 1].value;
+        return true;
+    }
+
+    index -= static_table_entries + 1;
+    if (index >= decoder.dynamic_table.size())
+        return false;
+
+    header = decoder.dynamic_table[index];
+    return true;
+}
+
+bool hpackDecode(hpack_decoder &decoder, const unsigned char* block, size_t len, vector<hpack_header> &headers)
+{
+    const unsigned char* pos = block;
+    const unsigned char* end = block + len;
+
+    while (pos < end)
+    {
+        hpack_header header;
+        size_t index;
+
+        if (*pos & 0x80) //indexed header field
+        {
+            if (!decodeInteger(pos, end, 7, index) || !lookupIndex(decoder, index, header))
+                return false;
+
+            headers.push_back(header);
+            continue;
+        }
+
+        if ((*pos & 0xe0) == 0x20) //dynamic table size update
+        {
+            size_t new_size;
+            if (!decodeInteger(pos, end, 5, new_size) || new_size > HPACK_DEFAULT_TABLE_SIZE) //above what we advertised
+                return false;
+
+            decoder.max_table_size = new_size;
+            evictEntries(decoder, new_size);
+            continue;
+        }
+
+        //literal: with incremental indexing (01), without indexing (0000) or never indexed (0001)
+        bool incremental = (*pos & 0xc0) == 0x40;
+        if (!decodeInteger(pos, end, incremental ? 6 : 4, index))
+            return false;
+
+        if (index == 0) //new name
+        {
+            if (!decodeString(pos, end, header.name))
+                return false;
+        }
+        else
+        {
+            hpack_header indexed;
+            if (!lookupIndex(decoder, index, indexed))
+                return false;
+            header.name = indexed.name;
+        }
+
+        if (!decodeString(pos, end, header.value))
+            return false;
+
+        if (incremental)
+            addEntry(decoder, header);
+        headers.push_back(header);
+    }
+
+    return true;
+}
+
+void hpackEncode(string &block, const string &name, const string &value)
+{
+    size_t name_index = 0;
+    for (size_t i = 0; i < static_table_entries; i++)
+    {
+        if (name != static_table[i].name)
+            continue;
+
+        if (value == static_table[i].value) //the whole field is in the static table: a single byte
+        {
+            encodeInteger(block, 0x80, 7, i + 1);
+            return;
+        }
+
+        if (name_index == 0)
+            name_index = i + 1;
+    }
+
+    //literal without indexing, the name is indexed when the static table has it
+    encodeInteger(block, 0x00, 4, name_index);
+    if (name_index == 0)
+    {
+        encodeInteger(block, 0x00, 7, name.length());
+        block += name;
+    }
+
+    encodeInteger(block, 0x00, 7, value.length());
+    block += value;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+
+using namespace std;
+
+//HPACK header compression for HTTP/2 (RFC 7541)
+//The decoder understands every representation a server may send: indexed fields, literals with or without
+//indexing, dynamic table size updates and Huffman coded strings. The encoder only emits what a GET needs:
+//indexed fields and literals without indexing (never Huffman coded), so it never touches the peer's dynamic table.
+//ref: https://www.rfc-editor.org/rfc/rfc7541
+
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+
+struct hpack_header
+{
+    string name;
+    string value;
+};
+
+//one per connection and direction, the dynamic table lives as long as the connection
+struct hpack_decoder
+{
+    deque<hpack_header> dynamic_table;  //newest entry first
+    size_t table_size = 0;              //sum of name + value + 32 over the entries (RFC 7541 section 4.1)
+    size_t max_table_size = HPACK_DEFAULT_TABLE_SIZE;
+};
+
+//decode one complete header block, returns false on a malformed block (a COMPRESSION_ERROR for the connection)
+bool hpackDecode(hpack_decoder &decoder, const unsigned char* block, size_t len, vector<hpack_header> &headers);
+
+//append the representation of one header field to block
+void hpackEncode(string &block, const string &name, const string &value);
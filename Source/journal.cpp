@@ -0,0 +1,364 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include "journal.h"
+
+//ref to file mapping: https://learn.microsoft.com/en-us/windows/win32/memory/creating-a-view-within-a-file
+
+using namespace std;
+
+thread_local body_digest* receiving_body = NULL;
+
+#define JOURNAL_MAGIC "DLJOURNAL1"
+#define JOURNAL_HEADER_BYTES 16
+#define JOURNAL_MAX_TEXT 4096 //longer URLs and reasons are cut
+
+//a record is this header and its text (the URL of a queued job, the reason of a failed one), padded to 8 bytes
+struct journal_record
+{
+    uint32_t checksum;  //of the rest of the record, 0 = never written
+    uint16_t length;    //of the whole record
+    uint8_t state;
+    uint8_t reserved;
+    int32_t job;
+    int32_t priority;
+    int64_t value;      //bytes received so far (running, failed), body bytes (done)
+    uint64_t hash;      //done only
+};
+
+struct journal_job
+{
+    long long queued_at;    //offset of the queued record, which holds the URL
+    int priority;
+    int state;
+    long long value;
+    long long logged_offset = 0;                    //of the last running record
+    chrono::steady_clock::time_point logged_time;
+};
+
+static HANDLE journal_file = INVALID_HANDLE_VALUE;
+static HANDLE journal_mapping = NULL;
+static char* journal_view = NULL;
+static long long mapped_bytes = 0;
+static long long used_bytes = 0;
+
+static vector<journal_job> jobs;
+static unordered_map<uint64_t, int> jobs_by_url;    //by URL hash, the URL itself is checked in the mapping
+static mutex journal_m;
+static atomic<bool> journal_open(false); //read for every body, without the lock
+
+static uint32_t recordChecksum(const char* record, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = sizeof(uint32_t); i < length; i++)
+        hash = (hash ^ (unsigned char)record[i]) * 16777619u;
+    return (hash == 0) ? 1 : hash;
+}
+
+static uint64_t textHash(const char* text, size_t length)
+{
+    body_digest digest;
+    digestAdd(digest, text, length);
+    return digestValue(digest);
+}
+
+//the text of the record at offset, in the mapping (valid until it grows)
+static const char* recordText(long long offset, size_t &length)
+{
+    journal_record* record = (journal_record*)(journal_view + offset);
+    const char* text = journal_view + offset + sizeof(journal_record);
+    length = record->length - sizeof(journal_record);
+    while (length > 0 && text[length - 1] == '\0') //padding
+        length--;
+    return text;
+}
+
+static bool setFileSize(HANDLE file, long long size)
+{
+    LARGE_INTEGER position;
+    position.QuadPart = size;
+
+    return SetFilePointerEx(file, position, NULL, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+//false if the records could not be flushed to the file
+static bool unmapJournal()
+{
+    bool flushed = true;
+    if (journal_view != NULL)
+    {
+        flushed = FlushViewOfFile(journal_view, (SIZE_T)mapped_bytes) != 0;
+        UnmapViewOfFile(journal_view);
+    }
+    if (journal_mapping != NULL)
+        CloseHandle(journal_mapping);
+    journal_view = NULL;
+    journal_mapping = NULL;
+    return flushed;
+}
+
+//map the whole file at its new size, a grown file reads as zeros (unwritten records)
+static bool mapJournal(long long size)
+{
+    if (!unmapJournal()) //the records so far may not be in the file, no more are appended
+        return false;
+    if (!setFileSize(journal_file, size))
+        return false;
+
+    journal_mapping = CreateFileMappingA(journal_file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (journal_mapping == NULL)
+        return false;
+
+    journal_view = (char*)MapViewOfFile(journal_mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+    if (journal_view == NULL)
+        return false;
+
+    mapped_bytes = size;
+    return true;
+}
+
+//the table of jobs as the records left it
+static void replay(journal_record* record, long long offset)
+{
+    if (record->state == JOURNAL_QUEUED)
+    {
+        if (record->job != (int)jobs.size()) //queued records number the jobs in order
+            return;
+
+        journal_job job;
+        job.queued_at = offset;
+        job.priority = record->priority;
+        job.state = JOURNAL_QUEUED;
+        job.value = 0;
+        jobs.push_back(job);
+
+        size_t length;
+        const char* url = recordText(offset, length);
+        jobs_by_url[textHash(url, length)] = record->job;
+    }
+    else if (record->job >= 0 && record->job < (int)jobs.size())
+    {
+        jobs[record->job].state = record->state;
+        jobs[record->job].value = record->value;
+    }
+}
+
+//journal_m is held
+static bool appendRecord(int state, int job, int priority, long long value, uint64_t hash, const string &text)
+{
+    if (journal_view == NULL)
+        return false;
+
+    size_t text_length = (min)(text.length(), (size_t)JOURNAL_MAX_TEXT);
+    int length = (int)((sizeof(journal_record) + text_length + 7) / 8 * 8);
+    if (used_bytes + length > mapped_bytes && !mapJournal(mapped_bytes + (max)(JOURNAL_GROW_BYTES, mapped_bytes / 4)))
+        return false;
+
+    char* at = journal_view + used_bytes;
+    journal_record* record = (journal_record*)at;
+    record->length = (uint16_t)length;
+    record->state = (uint8_t)state;
+    record->reserved = 0;
+    record->job = job;
+    record->priority = priority;
+    record->value = value;
+    record->hash = hash;
+    memcpy(at + sizeof(journal_record), text.c_str(), text_length);
+    memset(at + sizeof(journal_record) + text_length, 0, length - sizeof(journal_record) - text_length);
+    record->checksum = recordChecksum(at, length); //last: without it the record does not count
+
+    used_bytes += length;
+    return true;
+}
+
+//give up on the file without touching its records
+static void abandonJournal(long long file_size)
+{
+    unmapJournal();
+    setFileSize(journal_file, file_size);
+    CloseHandle(journal_file);
+    journal_file = INVALID_HANDLE_VALUE;
+}
+
+bool openJournal(const string &path)
+{
+    closeJournal();
+
+    journal_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (journal_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER zero, file_size;
+    zero.QuadPart = 0;
+    if (!SetFilePointerEx(journal_file, zero, &file_size, FILE_END))
+    {
+        CloseHandle(journal_file);
+        journal_file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    if (!mapJournal((max)(file_size.QuadPart, JOURNAL_GROW_BYTES)))
+    {
+        abandonJournal(file_size.QuadPart);
+        return false;
+    }
+
+    lock_guard<mutex> lock(journal_m);
+    if (file_size.QuadPart == 0)
+        memcpy(journal_view, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    else if (memcmp(journal_view, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0) //some other file, leave it alone
+    {
+        abandonJournal(file_size.QuadPart);
+        return false;
+    }
+
+    //replay up to the first record that was never completely written
+    used_bytes = JOURNAL_HEADER_BYTES;
+    while (used_bytes + (long long)sizeof(journal_record) <= mapped_bytes)
+    {
+        journal_record* record = (journal_record*)(journal_view + used_bytes);
+        if (record->checksum == 0 || record->length < sizeof(journal_record) || record->length % 8 != 0 ||
+            used_bytes + record->length > mapped_bytes || record->checksum != recordChecksum((char*)record, record->length))
+            break;
+
+        replay(record, used_bytes);
+        used_bytes += record->length;
+    }
+
+    //whatever follows a torn record is cleared, so that it cannot pass for a record after the next appends
+    memset(journal_view + used_bytes, 0, (size_t)(mapped_bytes - used_bytes));
+    journal_open = true;
+    return true;
+}
+
+bool closeJournal()
+{
+    lock_guard<mutex> lock(journal_m);
+    journal_open = false;
+    bool result = unmapJournal();
+
+    if (journal_file != INVALID_HANDLE_VALUE)
+    {
+        result = setFileSize(journal_file, used_bytes) && result;
+        CloseHandle(journal_file);
+    }
+    journal_file = INVALID_HANDLE_VALUE;
+
+    mapped_bytes = used_bytes = 0;
+    jobs.clear();
+    jobs_by_url.clear();
+    return result;
+}
+
+bool journalActive()
+{
+    return journal_open;
+}
+
+//the job of url, -1 if it has none, journal_m is held
+static int findJob(const string &url)
+{
+    unordered_map<uint64_t, int>::iterator it = jobs_by_url.find(textHash(url.c_str(), url.length()));
+    if (it == jobs_by_url.end())
+        return -1;
+
+    size_t length;
+    const char* queued_url = recordText(jobs[it->second].queued_at, length);
+    return (length == url.length() && memcmp(queued_url, url.c_str(), length) == 0) ? it->second : -1;
+}
+
+long long journalDoneBytes(const string &url)
+{
+    lock_guard<mutex> lock(journal_m);
+    int job = findJob(url);
+    return (job >= 0 && jobs[job].state == JOURNAL_DONE) ? jobs[job].value : -1;
+}
+
+void journalUnfinished(vector<fetch_job> &unfinished)
+{
+    lock_guard<mutex> lock(journal_m);
+    for (size_t i = 0; i < jobs.size(); i++)
+        if (jobs[i].state != JOURNAL_DONE)
+        {
+            size_t length;
+            const char* url = recordText(jobs[i].queued_at, length);
+
+            fetch_job job;
+            job.url = string(url, length);
+            job.priority = jobs[i].priority;
+            unfinished.push_back(job);
+        }
+}
+
+int journalQueue(const string &url, int priority)
+{
+    lock_guard<mutex> lock(journal_m);
+    int job = findJob(url);
+    if (job >= 0 || journal_view == NULL)
+        return job;
+
+    journal_job entry;
+    entry.queued_at = used_bytes;
+    entry.priority = priority;
+    entry.state = JOURNAL_QUEUED;
+    entry.value = 0;
+    if (!appendRecord(JOURNAL_QUEUED, (int)jobs.size(), priority, 0, 0, url))
+        return -1;
+
+    jobs.push_back(entry);
+    jobs_by_url[textHash(url.c_str(), url.length())] = (int)jobs.size() - 1;
+    return (int)jobs.size() - 1;
+}
+
+void journalRunning(int job, long long offset)
+{
+    lock_guard<mutex> lock(journal_m);
+    if (job < 0 || job >= (int)jobs.size())
+        return;
+
+    //every start is recorded, progress only once enough has changed: a folder of many small files would otherwise
+    //write a record per file
+    journal_job &entry = jobs[job];
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (entry.state == JOURNAL_RUNNING && offset - entry.logged_offset < JOURNAL_PROGRESS_BYTES &&
+        now - entry.logged_time < chrono::milliseconds(JOURNAL_PROGRESS_MS))
+        return;
+
+    if (appendRecord(JOURNAL_RUNNING, job, 0, offset, 0, ""))
+    {
+        entry.state = JOURNAL_RUNNING;
+        entry.value = offset;
+        entry.logged_offset = offset;
+        entry.logged_time = now;
+    }
+}
+
+void journalDone(int job, long long body_bytes, uint64_t hash)
+{
+    lock_guard<mutex> lock(journal_m);
+    if (job < 0 || job >= (int)jobs.size())
+        return;
+
+    if (appendRecord(JOURNAL_DONE, job, 0, body_bytes, hash, ""))
+    {
+        jobs[job].state = JOURNAL_DONE;
+        jobs[job].value = body_bytes;
+    }
+}
+
+void journalFailed(int job, long long offset, const string &reason)
+{
+    lock_guard<mutex> lock(journal_m);
+    if (job < 0 || job >= (int)jobs.size())
+        return;
+
+    if (appendRecord(JOURNAL_FAILED, job, 0, offset, 0, reason))
+    {
+        jobs[job].state = JOURNAL_FAILED;
+        jobs[job].value = offset;
+    }
+}
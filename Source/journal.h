@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "client.h"
+#include "fetch.h"
+
+//Crash-safe job journal (--journal)
+//An append-only file of records, memory-mapped and written with a memcpy under one lock, so recording a job costs
+//no system call. Each record says what happened to one job (one URL of the batch): queued (with its URL and
+//priority), running (with the bytes of its bodies received so far), done (with its size and hash) or failed (with a reason).
+//A job's URL is written once, in its queued record, the others refer to it by number.
+//Whatever a crashed process had copied into the mapping is in the OS page cache and reaches the file anyway. Each
+//record carries a checksum: a torn record at the end (power loss) is where the replay stops and appending resumes.
+//On open the journal is replayed into a table of jobs; fetchAll() (fetch.h) skips the ones that are done and
+//journals the rest, and the client run without URLs picks up every job that did not finish.
+//The hash of a job is the sum of the 64 bit hashes of its bodies (a folder's files may finish in any order).
+//ref: https://learn.microsoft.com/en-us/windows/win32/memory/creating-a-view-within-a-file
+
+#define JOURNAL_GROW_BYTES (4LL << 20)          //the file grows by this much when the mapping is full
+#define JOURNAL_PROGRESS_BYTES (16LL << 20)     //a running record at most once per this many bytes of a job
+#define JOURNAL_PROGRESS_MS 1000                //or once per second
+
+enum journal_state
+{
+    JOURNAL_QUEUED = 1,
+    JOURNAL_RUNNING,
+    JOURNAL_DONE,
+    JOURNAL_FAILED
+};
+
+//running hash of a body, 8 bytes at a time (a multiply-xor like FNV-1a), the bytes of a partial word wait in tail
+//so that the hash does not depend on how the body was split into reads
+struct body_digest
+{
+    uint64_t hash = 14695981039346656037ULL;
+    uint64_t tail = 0;
+    int tail_len = 0;
+};
+
+inline void digestWord(body_digest &digest, uint64_t word)
+{
+    digest.hash = (digest.hash ^ word) * 1099511628211ULL;
+    digest.hash ^= digest.hash >> 29;
+}
+
+inline void digestAdd(body_digest &digest, const char* data, size_t len)
+{
+    while (len > 0 && digest.tail_len > 0 && digest.tail_len < 8)
+    {
+        digest.tail |= (uint64_t)(unsigned char)*data++ << (8 * digest.tail_len++);
+        len--;
+    }
+    if (digest.tail_len == 8)
+    {
+        digestWord(digest, digest.tail);
+        digest.tail = 0;
+        digest.tail_len = 0;
+    }
+
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        digestWord(digest, word);
+    }
+
+    while (len > 0)
+    {
+        digest.tail |= (uint64_t)(unsigned char)*data++ << (8 * digest.tail_len++);
+        len--;
+    }
+}
+
+inline uint64_t digestValue(const body_digest &digest)
+{
+    body_digest last = digest;
+    digestWord(last, last.tail ^ ((uint64_t)last.tail_len << 59));
+    return last.hash;
+}
+
+//the body downloadFile() is receiving on this thread, while the journal is open; the receive loops hand it every
+//byte they get (HTTP/2 streams keep their own)
+extern thread_local body_digest* receiving_body;
+
+inline void digestBody(const char* data, size_t len)
+{
+    if (receiving_body != NULL)
+        digestAdd(*receiving_body, data, len);
+}
+
+bool openJournal(const string &path); //replays an existing journal, false if it cannot be opened or mapped
+bool closeJournal();                  //flushes the mapping and cuts the file back to the records, false if that failed
+bool journalActive();
+
+//body_bytes of a job the journal records as done, -1 if it is not done
+long long journalDoneBytes(const string &url);
+void journalUnfinished(vector<fetch_job> &jobs); //appends the jobs that were queued but never finished
+
+//the state of a job changes, the engine calls these through fetch.cpp
+int journalQueue(const string &url, int priority);  //the job's number, queued once per URL
+void journalRunning(int job, long long offset);
+void journalDone(int job, long long body_bytes, uint64_t hash);
+void journalFailed(int job, long long offset, const string &reason);
@@ -0,0 +1,83 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <direct.h>
+#include "layout.h"
+
+using namespace std;
+
+int layout_fanout = 0;
+
+static unordered_map<string, unsigned long long> claimed_paths;    //path -> hash of the source that writes it
+static unordered_set<string> created_dirs;
+static mutex layout_m;
+
+static unsigned long long fnv1a(const string &text)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < text.length(); i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//"ab/cd/" for two levels: two hex digits of the name's hash per level
+static string fanoutDirs(const string &file_name)
+{
+    static const char HEX[] = "0123456789abcdef";
+    unsigned long long hash = fnv1a(file_name);
+    int levels = (min)(layout_fanout, LAYOUT_MAX_FANOUT);
+
+    string dirs;
+    for (int level = 0; level < levels; level++)
+    {
+        unsigned int digits = (unsigned int)(hash >> (level * 8)) & 0xff;
+        dirs += HEX[digits >> 4];
+        dirs += HEX[digits & 0xf];
+        dirs += '/';
+    }
+    return dirs;
+}
+
+//create every directory of dirs below base that was not created before, layout_m is held
+static void createDirs(const string &base, const string &dirs)
+{
+    for (size_t end = dirs.find('/'); end != string::npos; end = dirs.find('/', end + 1))
+    {
+        string dir = base + dirs.substr(0, end);
+        if (created_dirs.count(dir) > 0)
+            continue;
+
+        _mkdir(dir.c_str()); //it may exist from an earlier run, opening the file reports a real failure
+        created_dirs.insert(dir);
+    }
+}
+
+string outputPath(const string &source, const string &folder_dir, const string &file_name)
+{
+    string dirs = fanoutDirs(file_name);
+    unsigned long long source_hash = fnv1a(source);
+
+    lock_guard<mutex> lock(layout_m);
+    createDirs(folder_dir, dirs);
+
+    string path = folder_dir + dirs + file_name;
+    for (int suffix = 1; ; suffix++)
+    {
+        unordered_map<string, unsigned long long>::iterator claimed = claimed_paths.find(path);
+        if (claimed == claimed_paths.end())
+        {
+            claimed_paths[path] = source_hash;
+            return path;
+        }
+        if (claimed->second == source_hash)
+            return path;
+
+        path = folder_dir + dirs + file_name + "." + to_string(suffix);
+    }
+}
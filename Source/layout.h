@@ -0,0 +1,21 @@
+#pragma once
+#include "client.h"
+
+//Output layout of the downloaded files
+//A file used to be written under its plain name into the program directory or its folder's directory, so two URLs
+//ending in the same name overwrote each other, and a folder of millions of files became one huge directory in which
+//every create is slow. Every output path now comes from outputPath():
+//- with --fanout=N the name is placed N levels of directories deep, each level named by two hex digits of a hash of
+//  the name ("ab/cd/<name>" for N = 2), so no directory holds more than a small share of the files; the same name
+//  always lands in the same place
+//- a path that another URL already wrote in this run gets a numbered suffix ("<name>.1", "<name>.2", ...); the same
+//  URL (a retried download) gets its own path again. Files left by earlier runs are overwritten as before
+//- directories are created once and remembered, so every later file under them skips the mkdir calls
+//  (Windows has no openat(), the remaining per-file cost is the path lookup of the create itself)
+
+#define LAYOUT_MAX_FANOUT 4
+
+extern int layout_fanout; //directory levels below the folder, 0 = flat (--fanout)
+
+//where the body of source (host and path of the URL) named file_name goes, folder_dir: its folder's directory or ""
+string outputPath(const string &source, const string &folder_dir, const string &file_name);
@@ -0,0 +1,331 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "client.h"
+#include "journal.h"
+
+//Microbenchmark of the URL and protocol parsing helpers that run on every request, and of the job journal
+//Every case prints one JSON object per line on stdout: ns/op, heap allocations/op and heap bytes/op
+
+//Note to compiler: the microbenchmark links the engine without cli.cpp, please compile with:
+//"g++ -std=c++11 -O2 -pthread -o microbench.exe microbench.cpp client.cpp stats.cpp trace.cpp netio.cpp output.cpp writebehind.cpp arena.cpp sink.cpp fetch.cpp hpack.cpp h2.cpp tls.cpp redirect.cpp pool.cpp aimd.cpp progress.cpp schedule.cpp journal.cpp capture.cpp budget.cpp shard.cpp preconnect.cpp layout.cpp -lws2_32 -lssl -lcrypto"
+
+//Usage: microbench.exe [--min-time=SECONDS] [--filter=SUBSTRING]
+
+using namespace std;
+
+//count every heap allocation made by the process (the helpers are the only thing running while measuring):
+//operator new below, and the blocks the request arena (arena.h) takes with malloc
+static atomic<unsigned long long> alloc_count(0);
+static atomic<unsigned long long> alloc_bytes(0);
+
+static void count_arena_block(size_t size)
+{
+    alloc_count.fetch_add(1, memory_order_relaxed);
+    alloc_bytes.fetch_add(size, memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+    alloc_count.fetch_add(1, memory_order_relaxed);
+    alloc_bytes.fetch_add(size, memory_order_relaxed);
+
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+        throw bad_alloc();
+
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+//the counting operator new above allocates with malloc, so free is the matching release; GCC cannot see that once
+//these are inlined into a caller and warns about every delete (-Wmismatched-new-delete)
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+static double min_time = 0.25; //seconds spent measuring every case
+static string filter = "";
+
+//results are accumulated here so the compiler cannot drop the calls
+static volatile long long sink;
+
+//discards everything the helpers print to cout (getStatusCodeInfo prints the status)
+class null_buffer : public streambuf
+{
+protected:
+    int overflow(int c) { return c; }
+    streamsize xsputn(const char*, streamsize n) { return n; }
+};
+
+void run_case(string name, function<void()> op)
+{
+    if (filter != "" && name.find(filter) == string::npos)
+        return;
+
+    null_buffer discard;
+    streambuf* console = cout.rdbuf(&discard);
+
+    op(); //warm up
+
+    long long iterations = 0;
+    long long batch = 1;
+    double seconds = 0;
+    unsigned long long allocs_start = alloc_count.load();
+    unsigned long long bytes_start = alloc_bytes.load();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    while (seconds < min_time)
+    {
+        for (long long i = 0; i < batch; i++)
+            op();
+
+        iterations += batch;
+        batch *= 2;
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    unsigned long long allocs = alloc_count.load() - allocs_start;
+    unsigned long long bytes = alloc_bytes.load() - bytes_start;
+    cout.rdbuf(console);
+
+    printf("{\"benchmark\":\"%s\",\"iterations\":%lld,\"ns_per_op\":%.2f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.2f}\n",
+           name.c_str(), iterations, seconds * 1e9 / iterations, double(allocs) / iterations, double(bytes) / iterations);
+    fflush(stdout);
+}
+
+void bench_url_helpers(string name, string url)
+{
+    vector<char> url_buffer(url.c_str(), url.c_str() + url.length() + 1);
+    char* URL = url_buffer.data();
+    vector<char> host_buffer;
+    {
+        arena_scope scope;
+        char* host_name = getHostnameFromURL(URL);
+        if (host_name == NULL)
+            return;
+
+        host_buffer.assign(host_name, host_name + strlen(host_name) + 1);
+    }
+
+    //every case runs inside its own request scope, like process_address() does
+    run_case("getHostnameFromURL/" + name, [&]()
+    {
+        arena_scope scope;
+        char* result = getHostnameFromURL(URL);
+        sink = sink + (result != NULL ? result[0] : 0);
+    });
+
+    run_case("create_GET_query/" + name, [&]()
+    {
+        arena_scope scope;
+        sink = sink + create_GET_query(URL, host_buffer.data()).length();
+    });
+
+    run_case("get_abs_path/" + name, [&]()
+    {
+        sink = sink + get_abs_path(URL, host_buffer.data()).length();
+    });
+
+    run_case("get_filename/" + name, [&]()
+    {
+        sink = sink + get_filename(URL).length();
+    });
+}
+
+void bench_status_lines()
+{
+    arena_string ok = "HTTP/1.1 200 OK\r\n";
+    arena_string long_reason = ("HTTP/1.1 404 " + string(4096, 'N') + "\r\n").c_str();
+    int status_code;
+
+    run_case("getStatusCodeInfo/ok", [&]()
+    {
+        getStatusCodeInfo(ok, status_code);
+        sink = sink + status_code;
+    });
+
+    run_case("getStatusCodeInfo/long_reason", [&]()
+    {
+        getStatusCodeInfo(long_reason, status_code);
+        sink = sink + status_code;
+    });
+}
+
+void bench_content_length()
+{
+    arena_string typical = "Content-Length: 1048576\r\n";
+    arena_string padded = ("Content-Length:" + string(1024, ' ') + "1048576\r\n").c_str();
+
+    run_case("getContentLength/typical", [&]()
+    {
+        sink = sink + getContentLength(typical);
+    });
+
+    run_case("getContentLength/padded", [&]()
+    {
+        sink = sink + getContentLength(padded);
+    });
+}
+
+void bench_chunk_sizes()
+{
+    vector<pair<string, string>> lines = {
+        {"typical", "4000\r\n"},
+        {"uppercase", "1A2B\r\n"},
+        {"leading_zeros", string(256, '0') + "1a\r\n"},
+        {"extension", "1a;name=value;other=\"quoted\"\r\n"},
+        {"overflow", "ffffffffffff\r\n"},
+        {"whitespace", "   1a   \r\n"}
+    };
+
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        arena_string line = lines[i].second.c_str();
+        run_case("getChunkSize/" + lines[i].first, [line]()
+        {
+            sink = sink + getChunkSize(line);
+        });
+    }
+}
+
+void bench_file_names()
+{
+    //a huge listing: every href of a 10000 entry directory index goes through isFileName()
+    arena_string_list listing;
+    for (int i = 0; i < 10000; i++)
+        listing.push_back(("file" + to_string(i) + (i % 3 == 0 ? ".tex" : (i % 3 == 1 ? ".pdf" : "/"))).c_str());
+
+    run_case("isFileName/listing_10000", [&]()
+    {
+        int n = listing.size();
+        for (int i = 0; i < n; i++)
+            sink = sink + isFileName(listing[i]);
+    });
+
+    arena_string no_extension(2048, 'a');
+    run_case("isFileName/long_no_match", [&]()
+    {
+        sink = sink + isFileName(no_extension);
+    });
+
+    run_case("isFileName/last_table_entry", [&]()
+    {
+        sink = sink + isFileName("lecture.tex");
+    });
+}
+
+void bench_journal()
+{
+    //a job queued and done per op, until the journal holds as many as fit into the measuring time (millions)
+    remove("microbench.jnl");
+    if (!openJournal("microbench.jnl"))
+        return;
+
+    long long next_job = 0;
+    run_case("journal/queue_done", [&]()
+    {
+        int job = journalQueue("http://example.com/files/batch/" + to_string(next_job++) + ".bin", 0);
+        journalRunning(job, 0);
+        journalDone(job, 1 << 20, 0x9e3779b97f4a7c15ULL);
+    });
+    closeJournal();
+
+    //every op reads all of those jobs back
+    run_case("journal/replay_" + to_string(next_job), [&]()
+    {
+        openJournal("microbench.jnl");
+        sink = sink + journalDoneBytes("http://example.com/files/batch/0.bin");
+        closeJournal();
+    });
+    remove("microbench.jnl");
+
+    vector<char> body(16384, 'b');
+    run_case("digestAdd/16k", [&]()
+    {
+        body_digest digest;
+        digestAdd(digest, body.data(), body.size());
+        sink = sink + (long long)digestValue(digest);
+    });
+}
+
+static bool parseOption(const char* arg, const char* name, string &value)
+{
+    size_t n = strlen(name);
+    if (strncmp(arg, name, n) != 0 || arg[n] != '=')
+        return false;
+
+    value = arg + n + 1;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    string value;
+    for (int i = 1; i < argc; i++)
+    {
+        if (parseOption(argv[i], "--min-time", value))
+            min_time = atof(value.c_str());
+        else if (parseOption(argv[i], "--filter", value))
+            filter = value;
+        else
+        {
+            printf("Unknown option '%s'.\n", argv[i]);
+            return 1;
+        }
+    }
+    arena_block_hook = count_arena_block;
+
+    bench_url_helpers("typical", "http://web.stanford.edu/dept/its/support/techtraining/techbriefing-media/Intro_Net_91407.ppt");
+    bench_url_helpers("folder", "http://example.com/courses/networking/");
+    bench_url_helpers("no_scheme", "example.com/index.html");
+    bench_url_helpers("long_path", "http://example.com/" + string(65536, 'p') + "/file.pdf");
+    bench_url_helpers("long_host", "http://" + string(4096, 'h') + ".com/index.html");
+    bench_url_helpers("deep_path", [] { string url = "http://example.com"; for (int i = 0; i < 4096; i++) url += "/d"; return url + "/a.txt"; }());
+
+    bench_status_lines();
+    bench_content_length();
+    bench_chunk_sizes();
+    bench_file_names();
+    bench_journal();
+
+    return 0;
+}
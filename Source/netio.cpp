@@ -0,0 +1,396 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include "netio.h"
+#include "tls.h"
+#include "trace.h"
+#include "capture.h"
+#include "preconnect.h"
+
+//ref to WSAPoll: https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-wsapoll
+//ref to non-blocking connect: https://learn.microsoft.com/en-us/windows/win32/api/winsock2/nf-winsock2-connect
+
+#ifndef WSAEINPROGRESS
+#define WSAEINPROGRESS EINPROGRESS
+#endif
+
+using namespace std;
+
+int io_timeout_ms = 30000;
+int request_timeout_ms = 0;
+int max_retries = 10;
+
+//every thread works on one request at a time
+static thread_local chrono::steady_clock::time_point request_deadline;
+static thread_local bool has_request_deadline = false;
+
+struct read_ahead
+{
+    SOCKET sock = INVALID_SOCKET;
+    int pos = 0;
+    int len = 0;
+    char data[16384];
+};
+
+static thread_local read_ahead reader;
+
+//TLS target of the connections this thread opens, "" = plain TCP
+static thread_local string tls_server_name = "";
+static thread_local string tls_session_key = "";
+static thread_local string connect_error = "";
+
+void beginRequestDeadline()
+{
+    has_request_deadline = (request_timeout_ms > 0);
+    if (has_request_deadline)
+        request_deadline = chrono::steady_clock::now() + chrono::milliseconds(request_timeout_ms);
+}
+
+//milliseconds left before the earliest deadline, -1 = wait forever
+static int remainingWait(chrono::steady_clock::time_point operation_deadline)
+{
+    chrono::steady_clock::time_point deadline = operation_deadline;
+    if (has_request_deadline && request_deadline < deadline)
+        deadline = request_deadline;
+
+    if (io_timeout_ms <= 0 && !has_request_deadline)
+        return -1;
+
+    long long left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+    return (left > 0) ? (int)left : 0;
+}
+
+static chrono::steady_clock::time_point operationDeadline()
+{
+    if (io_timeout_ms <= 0) //no per-operation limit, only the request deadline (if any) applies
+        return (chrono::steady_clock::time_point::max)(); //parentheses keep the windows.h max() macro out
+
+    return chrono::steady_clock::now() + chrono::milliseconds(io_timeout_ms);
+}
+
+//wait until the socket is readable (POLLRDNORM) or writable (POLLWRNORM), returns false on timeout or error
+static bool waitForSocket(SOCKET sock, short events, chrono::steady_clock::time_point operation_deadline)
+{
+    while (true)
+    {
+        int wait_ms = remainingWait(operation_deadline);
+        if (wait_ms == 0)
+            return false;
+
+        WSAPOLLFD poll_fd;
+        poll_fd.fd = sock;
+        poll_fd.events = events;
+        poll_fd.revents = 0;
+
+        int poll_result = WSAPoll(&poll_fd, 1, wait_ms);
+        if (poll_result > 0)
+            return true; //readable, writable, hung up or failed: the next send/recv reports which one
+        if (poll_result == 0)
+            return false;
+        if (WSAGetLastError() != WSAEINTR)
+            return false;
+    }
+}
+
+static bool setNonBlocking(SOCKET sock)
+{
+    u_long non_blocking = 1;
+    return ioctlsocket(sock, FIONBIO, &non_blocking) != SOCKET_ERROR;
+}
+
+//every connection this thread opens from now on is TLS to server_name ("" = plain TCP again),
+//session_key ("host:port") picks the cached session to resume
+void useTLS(string server_name, string session_key)
+{
+    tls_server_name = server_name;
+    tls_session_key = session_key;
+}
+
+string lastConnectError()
+{
+    return connect_error;
+}
+
+//run the TLS handshake on a connected socket, bounded by the same deadlines as the TCP connect
+static bool handshakeWithDeadline(SOCKET sock)
+{
+    long long handshake_start = trace_now();
+    if (!tlsAttach(sock, tls_server_name, tls_session_key))
+        return false;
+
+    chrono::steady_clock::time_point operation_deadline = operationDeadline();
+    while (true)
+    {
+        int handshake_result = tlsHandshake(sock);
+        if (handshake_result == 1)
+            break;
+
+        if (handshake_result == IO_ERROR || !waitForSocket(sock, (handshake_result == TLS_WANT_WRITE) ? POLLWRNORM : POLLRDNORM, operation_deadline))
+        {
+            if (handshake_result != IO_ERROR)
+                connect_error = "Timed out during the TLS handshake.";
+            tlsDetach(sock);
+            return false;
+        }
+    }
+
+    trace_span("tls_handshake", "connection", handshake_start, trace_now(), tls_server_name.c_str());
+    return true;
+}
+
+//try every address getaddrinfo returned until one accepts the connection, always on a fresh socket
+//with a TLS target (useTLS) the connection is only returned once the handshake has completed
+SOCKET connectWithDeadline(struct addrinfo* addr)
+{
+    connect_error = "";
+    for (struct addrinfo* ptr = addr; ptr != NULL; ptr = ptr->ai_next)
+    {
+        SOCKET sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+        if (sock == INVALID_SOCKET)
+            continue;
+
+        if (!setNonBlocking(sock))
+        {
+            closesocket(sock);
+            continue;
+        }
+
+        string address((const char*)ptr->ai_addr, ptr->ai_addrlen);
+#ifdef TCP_FASTOPEN_CONNECT
+        //connect() returns at once, the SYN goes out with the first send (preconnect.h)
+        if (fastOpenAddress(address))
+        {
+            int fast_open = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (const char*)&fast_open, sizeof(fast_open));
+        }
+#endif
+
+        int connect_Result = connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen);
+        if (connect_Result == SOCKET_ERROR)
+        {
+            int error = WSAGetLastError();
+            if ((error != WSAEWOULDBLOCK && error != WSAEINPROGRESS) || !waitForSocket(sock, POLLWRNORM, operationDeadline()))
+            {
+                closesocket(sock);
+                continue;
+            }
+
+            //the wait is over, SO_ERROR tells whether the connection was established
+            int socket_error = 0;
+            socklen_t error_len = sizeof(socket_error);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&socket_error, &error_len) == SOCKET_ERROR || socket_error != 0)
+            {
+                closesocket(sock);
+                continue;
+            }
+        }
+
+        if (tls_server_name != "" && !handshakeWithDeadline(sock))
+        {
+            if (connect_error == "")
+                connect_error = tlsError();
+            closesocket(sock);
+            continue;
+        }
+
+        rememberAddress(address);
+        captureOpen(sock);
+        return sock;
+    }
+
+    return INVALID_SOCKET;
+}
+
+//what the server sent, as the capture (capture.h) records it
+static void capturedReceive(SOCKET sock, const char* buff, int byte_recv)
+{
+    if (byte_recv > 0)
+        captureData(sock, CAPTURE_RECEIVED, buff, byte_recv);
+    else if (byte_recv == IO_CLOSED)
+        captureClose(sock, CAPTURE_SERVER_CLOSED);
+}
+
+static int recvWithDeadline(SOCKET sock, char* buff, int len)
+{
+    chrono::steady_clock::time_point operation_deadline = operationDeadline();
+
+    while (true)
+    {
+        if (tlsActive(sock)) //decrypted data OpenSSL already holds is returned without waiting for the socket
+        {
+            int byte_read = tlsRead(sock, buff, len);
+            if (byte_read >= 0 || byte_read == IO_ERROR)
+            {
+                capturedReceive(sock, buff, byte_read);
+                return byte_read;
+            }
+
+            if (!waitForSocket(sock, (byte_read == TLS_WANT_WRITE) ? POLLWRNORM : POLLRDNORM, operation_deadline))
+                return IO_TIMEOUT;
+
+            continue;
+        }
+
+        int byte_recv = recv(sock, buff, len, 0);
+        if (byte_recv >= 0)
+        {
+            capturedReceive(sock, buff, byte_recv);
+            return byte_recv; //0: the server closed the connection
+        }
+
+        if (WSAGetLastError() != WSAEWOULDBLOCK)
+            return IO_ERROR;
+
+        if (!waitForSocket(sock, POLLRDNORM, operation_deadline))
+            return IO_TIMEOUT;
+    }
+}
+
+//receive up to len bytes, returns the number of bytes received, IO_CLOSED, IO_ERROR or IO_TIMEOUT
+int recvSome(SOCKET sock, char* buff, int len)
+{
+    if (reader.sock != sock) //the buffered bytes belong to another connection
+    {
+        reader.sock = sock;
+        reader.pos = reader.len = 0;
+    }
+
+    if (reader.pos < reader.len)
+    {
+        int n = min(len, reader.len - reader.pos);
+        memcpy(buff, reader.data + reader.pos, n);
+        reader.pos += n;
+        return n;
+    }
+
+    //large reads go straight into the caller's buffer, small ones refill the read-ahead buffer
+    if (len >= (int)sizeof(reader.data))
+        return recvWithDeadline(sock, buff, len);
+
+    int byte_recv = recvWithDeadline(sock, reader.data, sizeof(reader.data));
+    if (byte_recv <= 0)
+        return byte_recv;
+
+    reader.pos = 0;
+    reader.len = byte_recv;
+
+    int n = min(len, byte_recv);
+    memcpy(buff, reader.data, n);
+    reader.pos = n;
+    return n;
+}
+
+//receive exactly len bytes, returns len, IO_CLOSED, IO_ERROR or IO_TIMEOUT
+int recvExact(SOCKET sock, char* buff, int len)
+{
+    int received = 0;
+    while (received < len)
+    {
+        int byte_recv = recvSome(sock, buff + received, len - received);
+        if (byte_recv <= 0)
+            return byte_recv;
+
+        received += byte_recv;
+    }
+
+    return received;
+}
+
+//send the whole buffer, returns len, IO_ERROR or IO_TIMEOUT
+int sendAll(SOCKET sock, const char* buff, int len)
+{
+    chrono::steady_clock::time_point operation_deadline = operationDeadline();
+    int sent = 0;
+
+    while (sent < len)
+    {
+        if (tlsActive(sock))
+        {
+            int byte_written = tlsWrite(sock, buff + sent, len - sent);
+            if (byte_written > 0)
+            {
+                sent += byte_written;
+                continue;
+            }
+
+            if (byte_written != TLS_WANT_READ && byte_written != TLS_WANT_WRITE)
+                return IO_ERROR;
+
+            if (!waitForSocket(sock, (byte_written == TLS_WANT_READ) ? POLLRDNORM : POLLWRNORM, operation_deadline))
+                return IO_TIMEOUT;
+
+            continue;
+        }
+
+        int byte_sent = send(sock, buff + sent, len - sent, 0);
+        if (byte_sent > 0)
+        {
+            sent += byte_sent;
+            continue;
+        }
+
+        //a Fast Open connection still opening reports it like a connect() in progress
+        if (byte_sent == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK && WSAGetLastError() != WSAEINPROGRESS)
+            return IO_ERROR;
+
+        if (!waitForSocket(sock, POLLWRNORM, operation_deadline))
+            return IO_TIMEOUT;
+    }
+
+    captureData(sock, CAPTURE_SENT, buff, len);
+    return sent;
+}
+
+//true when sock can carry another request: no received bytes left unparsed, and the server has neither closed it
+//nor sent anything since (a poll that does not wait)
+//a TLS connection is only known to the thread that opened it (tls.cpp), which also checks the records OpenSSL has
+//read from the socket but not handed out yet: the poll does not see those
+bool connectionIdle(SOCKET sock)
+{
+    if (sock == INVALID_SOCKET)
+        return false;
+
+    if (reader.sock == sock && reader.pos < reader.len)
+        return false;
+
+    if (tlsPending(sock))
+        return false;
+
+    WSAPOLLFD poll_fd;
+    poll_fd.fd = sock;
+    poll_fd.events = POLLRDNORM;
+    poll_fd.revents = 0;
+
+    return WSAPoll(&poll_fd, 1, 0) == 0;
+}
+
+void closeConnection(SOCKET sock)
+{
+    if (sock == INVALID_SOCKET)
+        return;
+
+    if (reader.sock == sock)
+    {
+        reader.sock = INVALID_SOCKET;
+        reader.pos = reader.len = 0;
+    }
+
+    tlsDetach(sock); //close_notify before the TCP shutdown
+    captureClose(sock, CAPTURE_CLIENT_CLOSED);
+
+    shutdown(sock, SD_SEND);
+    closesocket(sock);
+}
+
+string ioErrorText(int io_result)
+{
+    if (io_result == IO_CLOSED)
+        return "Server prematurely closes connection.";
+    if (io_result == IO_TIMEOUT)
+        return "Timed out waiting for the server.";
+
+    return "Connection error (" + to_string(WSAGetLastError()) + ").";
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "client.h"
+
+//Socket I/O with deadlines
+//Sockets are switched to non-blocking mode, every wait goes through WSAPoll and is bounded by both the
+//per-operation timeout and the deadline of the current request. Peer close and errors are reported to the caller
+//instead of being retried. Small reads are served from a per-thread read-ahead buffer, so parsing a response
+//one character at a time costs no extra system calls. Connections to https:// URLs run TLS (tls.h) underneath.
+
+#define IO_CLOSED 0         //the server closed the connection
+#define IO_ERROR -1         //socket error (same value as SOCKET_ERROR)
+#define IO_TIMEOUT -2       //a deadline expired
+
+extern int io_timeout_ms;       //longest wait for a single connect/send/recv (--timeout)
+extern int request_timeout_ms;  //longest time a whole request may take, 0 = no limit (--request-timeout)
+extern int max_retries;         //reconnect attempts after a failed request, 0 = until the user presses ESC (--retries)
+
+void beginRequestDeadline(); //restarts the request timeout of the calling thread (per response for pipelined requests)
+void useTLS(string server_name, string session_key);
+SOCKET connectWithDeadline(struct addrinfo* addr);
+string lastConnectError(); //why the last connectWithDeadline() failed, "" when no reason is known
+int recvSome(SOCKET sock, char* buff, int len);
+int recvExact(SOCKET sock, char* buff, int len);
+int sendAll(SOCKET sock, const char* buff, int len);
+bool connectionIdle(SOCKET sock); //another request may be sent on sock (see pool.h), TLS only on its own thread
+void closeConnection(SOCKET sock);
+string ioErrorText(int io_result);
@@ -0,0 +1,100 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include "output.h"
+
+//ref to file mapping: https://learn.microsoft.com/en-us/windows/win32/memory/creating-a-view-within-a-file
+//ref to SetEndOfFile: https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-setendoffile
+
+using namespace std;
+
+bool output_mmap = false;
+
+static bool setFileSize(HANDLE file, long long size)
+{
+    LARGE_INTEGER position;
+    position.QuadPart = size;
+
+    return SetFilePointerEx(file, position, NULL, FILE_BEGIN) && SetEndOfFile(file);
+}
+
+static void unmapWindow(mapped_output &out)
+{
+    if (out.view == NULL)
+        return;
+
+    if (!FlushViewOfFile(out.view, (SIZE_T)out.window_len)) //one flush per window instead of many small writes
+        out.flush_failed = true;
+    UnmapViewOfFile(out.view);
+    out.view = NULL;
+}
+
+bool openMappedOutput(mapped_output &out, string path, long long size)
+{
+    out = mapped_output();
+    out.size = size;
+
+    out.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (out.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    //reserve the whole body at once, so the file system can place it contiguously
+    if (!setFileSize(out.file, size))
+    {
+        CloseHandle(out.file);
+        out.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    out.mapping = CreateFileMappingA(out.file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (out.mapping == NULL)
+    {
+        CloseHandle(out.file);
+        out.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    return true;
+}
+
+//pointer to the byte at offset, available is set to the number of bytes left in the mapped window
+char* mappedOutputAt(mapped_output &out, long long offset, int &available)
+{
+    if (out.view == NULL || offset < out.window_start || offset >= out.window_start + out.window_len)
+    {
+        unmapWindow(out);
+
+        out.window_start = offset - (offset % OUTPUT_WINDOW_BYTES);
+        out.window_len = min(OUTPUT_WINDOW_BYTES, out.size - out.window_start);
+        out.view = (char*)MapViewOfFile(out.mapping, FILE_MAP_WRITE, (DWORD)(out.window_start >> 32),
+                                        (DWORD)(out.window_start & 0xFFFFFFFF), (SIZE_T)out.window_len);
+        if (out.view == NULL)
+            return NULL;
+    }
+
+    available = (int)(out.window_start + out.window_len - offset);
+    return out.view + (offset - out.window_start);
+}
+
+//bytes_written < size (interrupted download): the file is cut back to what was actually received
+bool closeMappedOutput(mapped_output &out, long long bytes_written)
+{
+    unmapWindow(out);
+
+    if (out.mapping != NULL)
+        CloseHandle(out.mapping);
+    out.mapping = NULL;
+
+    if (out.file == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool result = !out.flush_failed;
+    if (bytes_written < out.size)
+        result = setFileSize(out.file, bytes_written) && result;
+
+    CloseHandle(out.file);
+    out.file = INVALID_HANDLE_VALUE;
+
+    return result;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "client.h"
+
+//Memory-mapped output for bodies whose size is known up front (--mmap)
+//The file is sized once with SetEndOfFile (the Windows counterpart of ftruncate/fallocate), then mapped one window
+//at a time. The body is received straight into the mapped window, so the copy through an ofstream buffer disappears.
+//A finished window is flushed with a single FlushViewOfFile and unmapped, which drops its pages like madvise(DONTNEED).
+
+#define OUTPUT_WINDOW_BYTES (64LL << 20) //a multiple of the 64 KiB allocation granularity
+
+extern bool output_mmap;
+
+struct mapped_output
+{
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    long long size = 0;
+    long long window_start = 0;
+    long long window_len = 0;
+    char* view = NULL;
+    bool flush_failed = false;      //a window could not be flushed, closeMappedOutput() reports it
+};
+
+bool openMappedOutput(mapped_output &out, string path, long long size);
+char* mappedOutputAt(mapped_output &out, long long offset, int &available);
+bool closeMappedOutput(mapped_output &out, long long bytes_written); //false if the body may not be on disk
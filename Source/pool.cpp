@@ -0,0 +1,84 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include "pool.h"
+#include "netio.h"
+#include "tls.h"
+#include "shard.h"
+
+using namespace std;
+
+//one pool per shard (shard.h): a host's URLs all run on the same shard, so its connections are parked and taken there
+struct alignas(64) idle_pool
+{
+    map<string, vector<SOCKET>> idle_connections; //origin -> parked connections, newest last
+    mutex idle_connections_m;
+};
+
+static idle_pool pools[MAX_SHARDS];
+
+void poolConnection(const string &origin, SOCKET sock)
+{
+    if (sock == INVALID_SOCKET)
+        return;
+
+    if (tlsActive(sock) || !connectionIdle(sock)) //its TLS session cannot move to another thread
+    {
+        closeConnection(sock);
+        return;
+    }
+
+    idle_pool &pool = pools[currentShard()];
+    SOCKET evicted = INVALID_SOCKET;
+    {
+        lock_guard<mutex> lock(pool.idle_connections_m);
+        vector<SOCKET> &parked = pool.idle_connections[origin];
+        if (parked.size() >= POOL_MAX_IDLE_PER_ORIGIN) //the oldest one is the most likely to be timed out by the server
+        {
+            evicted = parked.front();
+            parked.erase(parked.begin());
+        }
+        parked.push_back(sock);
+    }
+
+    closeConnection(evicted);
+}
+
+SOCKET takePooledConnection(const string &origin)
+{
+    idle_pool &pool = pools[currentShard()];
+    while (true)
+    {
+        SOCKET sock;
+        {
+            lock_guard<mutex> lock(pool.idle_connections_m);
+            map<string, vector<SOCKET>>::iterator parked = pool.idle_connections.find(origin);
+            if (parked == pool.idle_connections.end() || parked->second.empty())
+                return INVALID_SOCKET;
+
+            sock = parked->second.back();
+            parked->second.pop_back();
+        }
+
+        if (connectionIdle(sock))
+            return sock;
+
+        closeConnection(sock); //closed by the server while it was parked
+    }
+}
+
+void closePooledConnections()
+{
+    for (int k = 0; k < MAX_SHARDS; k++)
+    {
+        lock_guard<mutex> lock(pools[k].idle_connections_m);
+        for (map<string, vector<SOCKET>>::iterator it = pools[k].idle_connections.begin(); it != pools[k].idle_connections.end(); it++)
+            for (size_t i = 0; i < it->second.size(); i++)
+                closeConnection(it->second[i]);
+
+        pools[k].idle_connections.clear();
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "client.h"
+
+//Keep-alive connection pool
+//A connection whose last response was read completely is parked here under its origin ("http://host:port") instead
+//of being closed. The next URL or redirect target on that origin takes it back and skips the TCP handshake.
+//A parked connection is checked before it is handed out: if the server has closed it meanwhile (or sent bytes
+//nobody asked for), it is dropped and the next one is tried.
+//Only plain TCP connections are pooled. A TLS connection belongs to the thread that opened it (tls.cpp) and is
+//closed instead, its session is resumed on the next connection to the same server.
+//With --shards every shard parks its connections in a pool of its own (shard.h).
+
+#define POOL_MAX_IDLE_PER_ORIGIN 4
+
+void poolConnection(const string &origin, SOCKET sock);    //park sock, or close it when it cannot be reused
+SOCKET takePooledConnection(const string &origin);          //INVALID_SOCKET when no live connection is parked
+void closePooledConnections();
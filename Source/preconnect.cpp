@@ -0,0 +1,75 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include "preconnect.h"
+#include "netio.h"
+#include "pool.h"
+#include "h2.h"
+
+//ref to TCP_FASTOPEN_CONNECT: https://man7.org/linux/man-pages/man7/tcp.7.html
+
+using namespace std;
+
+int preconnect_budget = 0;
+bool tcp_fast_open = false;
+
+static set<string> seen_addresses; //addresses that accepted a connection, the server may have given a cookie
+static mutex seen_addresses_m;
+
+bool preconnectURL(const string &url)
+{
+    string origin = urlOrigin(url);
+    if (origin == "")
+        return false;
+
+    //origin is "scheme://node:port"
+    string node_port = origin.substr(origin.find("://") + 3);
+    string node = node_port.substr(0, node_port.rfind(':'));
+    string port = node_port.substr(node_port.rfind(':') + 1);
+
+    struct addrinfo *result = NULL,
+                    hints;
+    ZeroMemory(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if (getaddrinfo(node.c_str(), port.c_str(), &hints, &result) != 0)
+        return false;
+
+    //TLS connections are not pooled and h2c never takes a pooled connection: those only had their host resolved
+    SOCKET sock_Connect = INVALID_SOCKET;
+    if (origin.compare(0, 7, "http://") == 0 && h2c_mode == H2C_OFF)
+    {
+        useTLS("", node_port);
+        beginRequestDeadline();
+        sock_Connect = connectWithDeadline(result);
+    }
+    freeaddrinfo(result);
+
+    if (sock_Connect == INVALID_SOCKET)
+        return false;
+
+    poolConnection(origin, sock_Connect);
+    return true;
+}
+
+bool fastOpenAddress(const string &address)
+{
+    if (!tcp_fast_open)
+        return false;
+
+    lock_guard<mutex> lock(seen_addresses_m);
+    return seen_addresses.count(address) > 0;
+}
+
+void rememberAddress(const string &address)
+{
+    if (!tcp_fast_open)
+        return;
+
+    lock_guard<mutex> lock(seen_addresses_m);
+    seen_addresses.insert(address);
+}
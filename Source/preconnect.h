@@ -0,0 +1,23 @@
+#pragma once
+#include "client.h"
+
+//Connection pre-warming (--preconnect) and TCP Fast Open (--fast-open)
+//fetchAll() (fetch.h) knows its whole batch up front, but a URL's connection used to be opened only once the URL
+//started. With a preconnect budget of N, a helper thread of every queue walks the URLs that have not started yet in
+//the order they will start, resolves their hosts, opens a connection to each origin and parks it in the idle pool
+//(pool.h) of the host's shard. When the URL starts it takes that connection and skips the handshake. At most N warm
+//connections wait for their URLs at a time (split exactly between the shards that have URLs), one per origin. Only plain http:// origins
+//without h2c are connected ahead, as only those are taken from the pool; for the others the host is only resolved.
+//With --fast-open, a connection to an address that accepted one before is opened with TCP Fast Open where the
+//system offers it (TCP_FASTOPEN_CONNECT, Linux): connect() returns at once and the SYN carries the first bytes sent,
+//the request or the TLS ClientHello, with the cookie the server gave out on the earlier connection. A server
+//without Fast Open just completes the handshake as usual. Where it is not offered (Winsock) the option does nothing.
+
+extern int preconnect_budget;   //warm connections waiting for their URLs, 0 = none (--preconnect)
+extern bool tcp_fast_open;      //--fast-open
+
+bool preconnectURL(const string &url);      //resolve the URL's host and park a new connection to it, false if none was parked
+
+//TCP Fast Open bookkeeping of connectWithDeadline() (netio.h), address: the bytes of a sockaddr
+bool fastOpenAddress(const string &address);    //connect to address with TCP Fast Open
+void rememberAddress(const string &address);    //address accepted a connection
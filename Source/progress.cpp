@@ -0,0 +1,230 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include "progress.h"
+
+using namespace std;
+
+extern mutex m; //console lock, defined in client.cpp
+
+bool progress_enabled = true;
+
+static vector<shared_ptr<progress_transfer>> transfers; //begun and not yet reported as finished
+static mutex transfers_m;
+
+static thread reporter;
+static atomic<bool> reporter_running(false); //read by every transfer thread in progressBegin()
+static bool reporter_stop = false;
+static mutex reporter_m;
+static condition_variable reporter_wake;
+
+//totals of the transfers that are over, reporter thread only
+static int finished_count = 0;
+static long long finished_bytes = 0;
+static chrono::steady_clock::time_point run_start;
+static chrono::steady_clock::time_point last_sample;
+
+static string formatBytes(double bytes)
+{
+    const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4)
+    {
+        bytes /= 1024;
+        unit++;
+    }
+
+    char text[32];
+    snprintf(text, sizeof(text), (unit == 0) ? "%.0f %s" : "%.1f %s", bytes, units[unit]);
+    return text;
+}
+
+static string formatSeconds(double seconds)
+{
+    char text[32];
+    if (seconds >= 3600)
+        snprintf(text, sizeof(text), "%dh%02dm", (int)(seconds / 3600), ((int)seconds % 3600) / 60);
+    else if (seconds >= 60)
+        snprintf(text, sizeof(text), "%dm%02ds", (int)(seconds / 60), (int)seconds % 60);
+    else
+        snprintf(text, sizeof(text), "%.0fs", seconds);
+    return text;
+}
+
+//"  'name': received / total (percent) at rate, ETA"
+static string formatRow(const string &name, long long received, long long total, double rate)
+{
+    string row = "  '" + name + "': " + formatBytes((double)received);
+    if (total > 0)
+    {
+        char percent[16];
+        snprintf(percent, sizeof(percent), " (%.0f%%)", received * 100.0 / total);
+        row += " / " + formatBytes((double)total) + percent;
+    }
+    row += " at " + formatBytes(rate) + "/s";
+    if (total > 0 && rate > 0)
+        row += ", ETA " + formatSeconds((total - received) / rate);
+    return row + "\n";
+}
+
+//sample every counter and print one dashboard block
+static void report()
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double elapsed_s = (max)(0.001, chrono::duration_cast<chrono::microseconds>(now - last_sample).count() / 1000000.0);
+    last_sample = now;
+
+    vector<shared_ptr<progress_transfer>> sampled;
+    {
+        lock_guard<mutex> lock(transfers_m);
+        sampled = transfers;
+    }
+
+    string rows;
+    int active = 0;
+    bool changed = false;
+    bool all_known = true;
+    long long active_bytes = 0;
+    long long remaining_bytes = 0;
+    double total_rate = 0;
+    bool any_done = false;
+
+    for (size_t i = 0; i < sampled.size(); i++)
+    {
+        progress_transfer* transfer = sampled[i].get();
+        bool finished = transfer->finished.load(memory_order_acquire);
+        long long received = transfer->received.load(memory_order_relaxed);
+
+        double rate = (received - transfer->sampled_bytes) / elapsed_s;
+        transfer->rate = (transfer->sampled_bytes == 0) ? rate : (transfer->rate + rate) / 2;
+        total_rate += rate;
+        changed = changed || (received != transfer->sampled_bytes) || finished;
+        transfer->sampled_bytes = received;
+
+        if (finished)
+        {
+            finished_count++;
+            finished_bytes += received;
+            transfer->reported = true;
+            any_done = true;
+            continue;
+        }
+
+        active++;
+        active_bytes += received;
+        if (transfer->total_bytes > 0)
+            remaining_bytes += (max)(0LL, transfer->total_bytes - received);
+        else
+            all_known = false;
+
+        if (active <= PROGRESS_MAX_ROWS)
+            rows += formatRow(transfer->name, received, transfer->total_bytes, transfer->rate);
+    }
+
+    //one pass over the list, however many finished (a transfer that finished after the sample stays for the next one)
+    if (any_done)
+    {
+        lock_guard<mutex> lock(transfers_m);
+        transfers.erase(remove_if(transfers.begin(), transfers.end(),
+                                  [](const shared_ptr<progress_transfer> &transfer) { return transfer->reported; }),
+                        transfers.end());
+    }
+
+    if (!changed) //nothing moved (e.g. waiting for a server), the last block still holds
+        return;
+
+    string block = "== Progress: " + to_string(active) + " running, " + to_string(finished_count) + " done, " +
+                   formatBytes((double)(finished_bytes + active_bytes)) + " received at " + formatBytes(total_rate) + "/s";
+    if (active > 0 && all_known && total_rate > 0)
+        block += ", ETA " + formatSeconds(remaining_bytes / total_rate);
+    block += "\n" + rows;
+    if (active > PROGRESS_MAX_ROWS)
+        block += "  ... and " + to_string(active - PROGRESS_MAX_ROWS) + " more\n";
+
+    m.lock();
+    console() << block;
+    console().flush();
+    m.unlock();
+}
+
+static void reporterLoop()
+{
+    unique_lock<mutex> lock(reporter_m);
+    while (!reporter_stop)
+    {
+        reporter_wake.wait_for(lock, chrono::milliseconds(PROGRESS_INTERVAL_MS));
+        if (reporter_stop)
+            break;
+
+        lock.unlock();
+        report();
+        lock.lock();
+    }
+}
+
+void startProgressReporter()
+{
+    if (!progress_enabled || reporter_running)
+        return;
+
+    run_start = chrono::steady_clock::now();
+    last_sample = run_start;
+    reporter_stop = false;
+    reporter_running = true;
+    reporter = thread(reporterLoop);
+}
+
+void stopProgressReporter()
+{
+    if (!reporter_running)
+        return;
+
+    {
+        lock_guard<mutex> lock(reporter_m);
+        reporter_stop = true;
+    }
+    reporter_wake.notify_all();
+    reporter.join();
+    reporter_running = false;
+
+    //the last sample counts whatever finished after it
+    report();
+
+    if (finished_count == 0)
+        return;
+
+    double seconds = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - run_start).count() / 1000000.0;
+    m.lock();
+    console() << "== Received " << formatBytes((double)finished_bytes) << " in " << finished_count << " transfer(s) in "
+              << formatSeconds(seconds) << " (" << formatBytes(finished_bytes / (max)(seconds, 0.001)) << "/s).\n";
+    m.unlock();
+}
+
+progress_transfer* progressBegin(const string &name, long long total_bytes)
+{
+    if (!reporter_running)
+        return NULL;
+
+    shared_ptr<progress_transfer> transfer = make_shared<progress_transfer>();
+    transfer->name = name;
+    transfer->total_bytes = total_bytes;
+
+    //allocated before the lock, the reporter and the other transfers only wait for the push_back
+    lock_guard<mutex> lock(transfers_m);
+    transfers.push_back(transfer);
+    return transfer.get();
+}
+
+void progressEnd(progress_transfer* transfer)
+{
+    if (transfer != NULL)
+        transfer->finished.store(true, memory_order_release); //the reporter drops it after its next sample
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <atomic>
+#include "client.h"
+
+//Transfer progress dashboard (--progress)
+//The receive loops only add what they got to a relaxed atomic counter of their transfer: nothing is formatted, printed
+//or locked per read. One reporter thread samples every counter each PROGRESS_INTERVAL_MS and prints one block with
+//the bytes, rate and ETA of each running transfer and of all of them together, so concurrent transfers no longer
+//interleave their progress lines. Until startProgressReporter() is called (--progress=off, or a library user that
+//does not want it) progressBegin() returns NULL and the loops skip even the counter.
+
+#define PROGRESS_INTERVAL_MS 500
+#define PROGRESS_MAX_ROWS 16 //running transfers listed one by one, the rest only count in the total line
+
+struct progress_transfer
+{
+    string name;
+    long long total_bytes = -1;         //-1 = unknown (chunked)
+    atomic<long long> received{0};
+    atomic<bool> finished{false};
+
+    //reporter thread only
+    long long sampled_bytes = 0;
+    double rate = 0;                    //bytes per second, smoothed over the samples
+    bool reported = false;              //counted as finished, dropped from the list after this sample
+};
+
+extern bool progress_enabled; //--progress=off clears it
+
+void startProgressReporter();
+void stopProgressReporter(); //prints the summary of the whole run
+
+progress_transfer* progressBegin(const string &name, long long total_bytes);
+void progressEnd(progress_transfer* transfer);
+
+inline void progressAdvance(progress_transfer* transfer, long long bytes)
+{
+    if (transfer != NULL)
+        transfer->received.fetch_add(bytes, memory_order_relaxed);
+}
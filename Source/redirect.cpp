@@ -0,0 +1,125 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include "redirect.h"
+
+using namespace std;
+
+int max_redirects = MAX_REDIRECTS;
+
+static map<string, string> permanent_redirects; //requested URL -> Location of its 301/308, shared by every thread
+static mutex permanent_redirects_m;
+
+bool isRedirect(int status_code)
+{
+    return status_code == 301 || status_code == 302 || status_code == 303 || status_code == 307 || status_code == 308;
+}
+
+bool isPermanentRedirect(int status_code)
+{
+    return status_code == 301 || status_code == 308;
+}
+
+//resolve "." and ".." segments of an absolute path, the query is kept as it is
+//(e.g: "/a/b/../c/./d.bin" -> "/a/c/d.bin")
+static string removeDotSegments(const string &path)
+{
+    size_t query_start = path.find('?');
+    string segments_str = path.substr(0, query_start);
+    string query = (query_start == string::npos) ? "" : path.substr(query_start);
+
+    vector<string> segments;
+    size_t start = 1; //skip the leading '/'
+    while (true)
+    {
+        size_t end = segments_str.find('/', start);
+        bool last = (end == string::npos);
+        string segment = segments_str.substr(start, last ? string::npos : end - start);
+
+        if (segment == "..")
+        {
+            if (!segments.empty())
+                segments.pop_back();
+            if (last)
+                segments.push_back(""); //"/a/.." names the folder "/"
+        }
+        else if (segment == ".")
+        {
+            if (last)
+                segments.push_back("");
+        }
+        else
+            segments.push_back(segment);
+
+        if (last)
+            break;
+        start = end + 1;
+    }
+
+    string result = "";
+    for (size_t i = 0; i < segments.size(); i++)
+        result += "/" + segments[i];
+
+    return ((result == "") ? "/" : result) + query;
+}
+
+string resolveLocation(const string &base_url, const string &location)
+{
+    string target = location.substr(0, location.find('#')); //the fragment is never sent to the server
+
+    //already absolute: "http://..." or "https://..."
+    size_t target_scheme_end = target.find("://");
+    if (target_scheme_end != string::npos && target.find_first_of("/?") > target_scheme_end)
+        return target;
+
+    //the URLs on the command line may leave out "http://"
+    size_t scheme_end = base_url.find("://");
+    string scheme = (scheme_end == string::npos) ? "http:" : base_url.substr(0, scheme_end + 1);
+    size_t host_start = (scheme_end == string::npos) ? 0 : scheme_end + 3;
+    size_t path_start = base_url.find('/', host_start);
+    if (path_start == string::npos)
+        path_start = base_url.length();
+
+    string authority = scheme + "//" + base_url.substr(host_start, path_start - host_start);
+    string base_path = base_url.substr(path_start, base_url.find_first_of("?#", path_start) - path_start);
+    if (base_path == "")
+        base_path = "/";
+
+    if (target == "") //same resource
+        return authority + base_url.substr(path_start, base_url.find('#', path_start) - path_start);
+    if (target.compare(0, 2, "//") == 0) //same scheme, other host
+        return scheme + target;
+    if (target[0] == '/')
+        return authority + removeDotSegments(target);
+    if (target[0] == '?')
+        return authority + base_path + target;
+
+    //relative to the folder of the requested path
+    return authority + removeDotSegments(base_path.substr(0, base_path.rfind('/') + 1) + target);
+}
+
+string permanentRedirectTarget(const string &url)
+{
+    lock_guard<mutex> lock(permanent_redirects_m);
+
+    string target = url;
+    for (int hop = 0; hop < MAX_REDIRECTS; hop++) //a redirect loop in the cache stops here, the server then reports it
+    {
+        map<string, string>::iterator cached = permanent_redirects.find(target);
+        if (cached == permanent_redirects.end())
+            break;
+
+        target = cached->second;
+    }
+
+    return target;
+}
+
+void rememberPermanentRedirect(const string &url, const string &target)
+{
+    lock_guard<mutex> lock(permanent_redirects_m);
+    permanent_redirects[url] = target;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "client.h"
+
+//Redirect following (301, 302, 303, 307 and 308)
+//process_address() follows the "Location" of a redirect for up to max_redirects hops. A target on the same origin
+//(scheme, host and port) is requested on the same keep-alive connection, any other target goes through the
+//connection pool (pool.h). Permanent redirects (301, 308) are remembered for the rest of the run, so later URLs
+//go straight to the final target without the extra round trip.
+//Only GET requests are sent, so 303 and the other codes are all followed the same way.
+//ref: https://www.rfc-editor.org/rfc/rfc9110#section-15.4, https://www.rfc-editor.org/rfc/rfc3986#section-5.2 (relative references)
+
+#define MAX_REDIRECTS 10
+
+extern int max_redirects; //hops followed per URL, 0 = report the redirect and stop (--max-redirects)
+
+bool isRedirect(int status_code);
+bool isPermanentRedirect(int status_code);
+
+//absolute URL of location (as sent in the "Location" header) relative to the URL that was requested
+string resolveLocation(const string &base_url, const string &location);
+
+//the URL a cached permanent redirect leads to (following chains), url itself when none is known
+string permanentRedirectTarget(const string &url);
+void rememberPermanentRedirect(const string &url, const string &target);
@@ -0,0 +1,421 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include "schedule.h"
+#include "netio.h"
+#include "stats.h"
+#include "aimd.h"
+#include "pool.h"
+#include "sink.h"
+
+using namespace std;
+
+extern mutex m; //console lock, defined in client.cpp
+
+int folder_schedule = SCHEDULE_LISTING;
+
+//a folder being downloaded over several connections, shared by their threads
+struct folder_job
+{
+    struct addrinfo* result;
+    string origin;
+    string tls_name;            //"" for http://
+    string tls_key;
+    char* addr;
+    char* host_name;
+    string abs_path;
+    string folder_dir;
+    fetch_context context;
+
+    vector<string> file_names;
+    vector<long long> sizes;    //from the HEAD responses, -1 = unknown
+    vector<size_t> order;       //indexes into file_names in download order
+    size_t next = 0;            //next entry of order to hand out
+    int failed = 0;             //files handed out whose retries gave up
+    mutex queue_m;
+};
+
+static void scheduleLog(char* addr, const string &text)
+{
+    m.lock();
+    console() << "[Thread " << this_thread::get_id() << "] - " << addr << ":\n" << text;
+    m.unlock();
+}
+
+//status code of a status line ("HTTP/1.1 200 OK" -> 200), 0 if it is not one
+static int statusOf(const arena_string &line)
+{
+    if (line.length() < 12 || strncmp(line.c_str(), "HTTP/", 5) != 0)
+        return 0;
+    return atoi(line.c_str() + 9);
+}
+
+//HEAD every file, up to SCHEDULE_HEAD_PIPELINE requests ahead of the responses, and note the Content-Lengths
+//a failure leaves the remaining sizes unknown and closes the connection (the downloads then reconnect)
+static void sizeFiles(SOCKET &sock_Connect, folder_job &job)
+{
+    size_t count = job.file_names.size();
+    size_t sent = 0;
+    size_t received = 0;
+    job.sizes.assign(count, -1);
+
+    while (received < count)
+    {
+        arena_scope batch_scope;
+
+        //top up the pipeline with one send once half of it has been answered
+        arena_string requests;
+        while (sent < count && sent - received < SCHEDULE_HEAD_PIPELINE && (requests.length() > 0 || sent - received <= SCHEDULE_HEAD_PIPELINE / 2))
+        {
+            requests.append("HEAD ").append(job.abs_path.c_str(), job.abs_path.length());
+            requests.append(job.file_names[sent].c_str(), job.file_names[sent].length());
+            requests.append(" HTTP/1.1\r\nHost: ").append(job.host_name).append("\r\nConnection: keep-alive\r\n\r\n");
+            sent++;
+        }
+        beginRequestDeadline();
+        if (requests.length() > 0 && sendAll(sock_Connect, requests.c_str(), (int)requests.length()) <= 0)
+            break;
+
+        //a HEAD response is the status line and headers only, whatever its Content-Length says
+        arena_string_list headers;
+        arena_string line = recvALineFromServerRepsonse(sock_Connect, headers);
+        int status_code = statusOf(line);
+        while ((line != "\r\n") && (line != ""))
+            line = recvALineFromServerRepsonse(sock_Connect, headers);
+        if (line == "" || status_code == 0)
+            break;
+
+        string content_length = getHeaderValue(headers, "Content-Length");
+        if (status_code == 200 && content_length != "")
+            job.sizes[received] = atoll(content_length.c_str());
+        received++;
+
+        if (!keepsConnectionOpen(headers)) //the requests after this one are not answered
+            break;
+    }
+
+    if (received < count)
+    {
+        closeConnection(sock_Connect);
+        sock_Connect = INVALID_SOCKET;
+    }
+
+    int known = 0;
+    long long total_bytes = 0;
+    for (size_t i = 0; i < count; i++)
+        if (job.sizes[i] >= 0)
+        {
+            known++;
+            total_bytes += job.sizes[i];
+        }
+
+    scheduleLog(job.addr, "Sized " + to_string(known) + " of " + to_string(count) + " files with HEAD requests (" + to_string(total_bytes) + " bytes).\n");
+}
+
+static bool largerFile(const vector<long long>* sizes, size_t a, size_t b)
+{
+    if ((*sizes)[b] < 0) //unknown sizes go last
+        return (*sizes)[a] >= 0;
+    return (*sizes)[a] > (*sizes)[b];
+}
+
+static bool smallerFile(const vector<long long>* sizes, size_t a, size_t b)
+{
+    if ((*sizes)[b] < 0)
+        return (*sizes)[a] >= 0;
+    return (*sizes)[a] >= 0 && (*sizes)[a] < (*sizes)[b];
+}
+
+//download one file of the folder, retrying a lost connection like the listing order loop in request_address() does;
+//false when the retries gave up
+static bool downloadFolderFile(SOCKET &sock_Connect, folder_job &job, const string &file_name, bool &keep_alive)
+{
+    response_info file_response;
+    bool REQUEST_result = (sock_Connect != INVALID_SOCKET) && REQUEST_QUERY_FILENAME(sock_Connect, job.host_name, job.abs_path, file_name, true);
+
+    while (!REQUEST_result || !RESPONSE_QUERY_FILENAME(sock_Connect, job.addr, job.host_name, file_name, true, job.folder_dir, file_response))
+    {
+        aimdRecordFailure();
+        scheduleLog(job.addr, "Failed to download '" + file_name + "'. (Connection closed)\n");
+
+        REQUEST_result = retryRequest(sock_Connect, job.result, job.addr, job.host_name, job.abs_path, file_name, true);
+        if (!REQUEST_result)
+        {
+            keep_alive = false;
+            return false;
+        }
+    }
+
+    keep_alive = file_response.keep_alive;
+    return true;
+}
+
+//take the files off the shared queue one at a time until it is empty; false when the retries gave up
+static bool downloadQueuedFiles(SOCKET &sock_Connect, folder_job &job, bool &keep_alive)
+{
+    while (!fetchAborted())
+    {
+        size_t file_idx;
+        {
+            lock_guard<mutex> lock(job.queue_m);
+            if (job.next == job.order.size())
+                return true;
+            file_idx = job.order[job.next++];
+        }
+
+        if (!downloadFolderFile(sock_Connect, job, job.file_names[file_idx], keep_alive))
+        {
+            lock_guard<mutex> lock(job.queue_m);
+            job.failed++;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//the connection a helper thread of the folder starts with: an idle one of the pool or a new one
+static SOCKET connectFolderWorker(folder_job &job)
+{
+    adoptFetchContext(job.context);
+    aimdUseHost(job.host_name);
+    useTLS(job.tls_name, job.tls_key);
+    stats_begin_request();
+
+    SOCKET sock_Connect = (job.tls_name == "") ? takePooledConnection(job.origin) : INVALID_SOCKET;
+    if (sock_Connect == INVALID_SOCKET)
+        sock_Connect = connectWithDeadline(job.result);
+
+    if (sock_Connect == INVALID_SOCKET)
+    {
+        aimdRecordFailure();
+        scheduleLog(job.addr, "Extra connection failed. " + lastConnectError() + "\n");
+    }
+    return sock_Connect;
+}
+
+//hand the connection of a helper thread back and leave the folder
+static void leaveFolderWorker(folder_job &job, SOCKET sock_Connect, bool keep_alive)
+{
+    if (sock_Connect != INVALID_SOCKET)
+    {
+        if (keep_alive && !fetchAborted() && job.tls_name == "")
+            poolConnection(job.origin, sock_Connect);
+        else
+            closeConnection(sock_Connect);
+    }
+
+    aimdReleaseConnection(job.host_name);
+    adoptFetchContext(fetch_context());
+}
+
+//an extra connection of the folder, on its own thread (the socket reader, TLS and arena are per thread)
+//if it cannot connect, the other connections take over its share
+static void folderWorker(folder_job* job)
+{
+    SOCKET sock_Connect = connectFolderWorker(*job);
+    bool keep_alive = false;
+    if (sock_Connect != INVALID_SOCKET)
+        downloadQueuedFiles(sock_Connect, *job, keep_alive);
+
+    leaveFolderWorker(*job, sock_Connect, keep_alive);
+}
+
+static void initFolderJob(folder_job &job, struct addrinfo* result, const string &origin, char* addr, char* host_name, string abs_path)
+{
+    job.result = result;
+    job.origin = origin;
+    job.addr = addr;
+    job.host_name = host_name;
+    job.abs_path = abs_path;
+    job.context = currentFetchContext();
+
+    //origin is "scheme://node:port", the TLS session key is "node:port"
+    job.tls_key = origin.substr(origin.find("://") + 3);
+    if (origin.compare(0, 8, "https://") == 0)
+        job.tls_name = job.tls_key.substr(0, job.tls_key.rfind(':'));
+}
+
+bool downloadFolderScheduled(SOCKET &sock_Connect, struct addrinfo* result, const string &origin, char* addr, char* host_name,
+                             string abs_path, string folder_dir, const arena_string_list &file_names, bool &keep_alive)
+{
+    folder_job job;
+    initFolderJob(job, result, origin, addr, host_name, abs_path);
+    job.folder_dir = folder_dir;
+
+    for (size_t i = 0; i < file_names.size(); i++)
+        job.file_names.push_back(string(file_names[i].c_str(), file_names[i].length()));
+
+    sizeFiles(sock_Connect, job);
+
+    for (size_t i = 0; i < job.file_names.size(); i++)
+        job.order.push_back(i);
+    if (folder_schedule == SCHEDULE_LARGEST_FIRST)
+        stable_sort(job.order.begin(), job.order.end(), bind(largerFile, &job.sizes, placeholders::_1, placeholders::_2));
+    else
+        stable_sort(job.order.begin(), job.order.end(), bind(smallerFile, &job.sizes, placeholders::_1, placeholders::_2));
+
+    //extra connections while the host's window has room, never more than one per file
+    int extra = 0;
+    if (currentBodySink() == NULL)
+        while (extra + 1 < SCHEDULE_MAX_CONNECTIONS && extra + 1 < (int)job.file_names.size() && aimdTryAcquireConnection(host_name))
+            extra++;
+
+    scheduleLog(addr, string("Downloading ") + to_string(job.file_names.size()) + " files " +
+                ((folder_schedule == SCHEDULE_LARGEST_FIRST) ? "largest" : "smallest") + " first over " + to_string(extra + 1) + " connection(s).\n");
+
+    vector<thread> workers;
+    for (int i = 0; i < extra; i++)
+        workers.push_back(thread(folderWorker, &job));
+
+    keep_alive = true;
+    downloadQueuedFiles(sock_Connect, job, keep_alive);
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    //files whose retries gave up, and those no connection was left to take
+    int missing = job.failed + (int)(job.order.size() - job.next);
+    if (missing > 0 && !fetchAborted())
+        scheduleLog(addr, to_string(missing) + " file(s) of the folder were not downloaded.\n");
+    return missing == 0;
+}
+
+//a listing that hands its file names out while it is still being received
+struct listing_feed
+{
+    folder_job job;                 //file_names grows as the listing arrives, next is the first name not taken yet
+    string folder_name;
+    bool multi_threaded;
+    bool folder_created = false;
+    bool complete = false;          //the listing is over, its connection downloads the names left
+    size_t known = 0;               //names of the listing copied into job.file_names
+    thread worker;
+    condition_variable more;        //names were added or the listing is over
+};
+
+//the connection that downloads while the listing arrives, in listing order, until the listing is complete
+static void listingFeedWorker(listing_feed* feed)
+{
+    folder_job &job = feed->job;
+    SOCKET sock_Connect = connectFolderWorker(job);
+    bool keep_alive = false;
+
+    while (sock_Connect != INVALID_SOCKET && !fetchAborted())
+    {
+        string file_name;
+        {
+            unique_lock<mutex> lock(job.queue_m);
+            feed->more.wait(lock, [&] { return feed->complete || job.next < job.file_names.size(); });
+            if (feed->complete)
+                break;
+            file_name = job.file_names[job.next++];
+        }
+
+        if (!downloadFolderFile(sock_Connect, job, file_name, keep_alive))
+        {
+            //the listing's connection only takes the names after it, this one is lost to the folder
+            fetchFail("'" + file_name + "' not downloaded (connection lost)");
+            break;
+        }
+    }
+
+    leaveFolderWorker(job, sock_Connect, keep_alive);
+}
+
+listing_feed* beginListingFeed(struct addrinfo* result, const string &origin, char* addr, char* host_name, string abs_path,
+                               string folder_name, bool multi_threaded)
+{
+    listing_feed* feed = new listing_feed;
+    initFolderJob(feed->job, result, origin, addr, host_name, abs_path);
+    feed->folder_name = folder_name;
+    feed->multi_threaded = multi_threaded;
+    return feed;
+}
+
+void feedFileNames(listing_feed* feed, const arena_string_list &file_names)
+{
+    if (feed == NULL || feed->known == file_names.size())
+        return;
+
+    //the first names create the folder and, if the host's window has room, start the second connection
+    if (!feed->folder_created)
+    {
+        feed->job.folder_dir = createFolder(feed->job.addr, feed->folder_name, feed->multi_threaded);
+        feed->folder_created = true;
+        if (aimdTryAcquireConnection(feed->job.host_name))
+            feed->worker = thread(listingFeedWorker, feed);
+    }
+
+    {
+        lock_guard<mutex> lock(feed->job.queue_m);
+        for (; feed->known < file_names.size(); feed->known++)
+            feed->job.file_names.push_back(string(file_names[feed->known].c_str(), file_names[feed->known].length()));
+    }
+    feed->more.notify_one();
+}
+
+size_t endListingFeed(listing_feed* feed)
+{
+    if (feed == NULL)
+        return 0;
+
+    size_t taken;
+    {
+        lock_guard<mutex> lock(feed->job.queue_m);
+        feed->complete = true;
+        taken = feed->job.next;
+    }
+    feed->more.notify_one();
+    return taken;
+}
+
+bool listingFeedFolder(listing_feed* feed, string &folder_dir)
+{
+    if (feed == NULL || !feed->folder_created)
+        return false;
+
+    folder_dir = feed->job.folder_dir;
+    return true;
+}
+
+void finishListingFeed(listing_feed* feed)
+{
+    if (feed == NULL)
+        return;
+
+    endListingFeed(feed);
+    if (feed->worker.joinable())
+        feed->worker.join();
+    delete feed;
+}
+
+bool loadManifest(const string &path, vector<fetch_job> &jobs)
+{
+    ifstream manifest(path);
+    if (!manifest.is_open())
+        return false;
+
+    string line;
+    while (getline(manifest, line))
+    {
+        istringstream fields(line);
+        fetch_job job;
+        if (!(fields >> job.url) || job.url[0] == '#')
+            continue;
+        if (!(fields >> job.priority))
+            job.priority = 0;
+
+        jobs.push_back(job);
+    }
+
+    return true;
+}
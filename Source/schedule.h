@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include "client.h"
+#include "fetch.h"
+
+//Size-aware scheduling of folder downloads (--schedule) and batch priorities (--manifest)
+//With --schedule=largest or smallest, the files of a folder are not fetched in listing order: HEAD requests for all
+//of them go out first, pipelined on the folder's connection, to learn their sizes. Then the files are handed out in
+//the chosen order to whichever connection of the folder is free, the one it already has plus as many more as the
+//host's connection window (aimd.h) allows. Largest first is the LPT rule: huge files at the end of a listing no longer
+//finish late on their own (shortest makespan). Smallest first finishes most files soonest (shortest mean completion
+//time). Files whose size is unknown (no Content-Length) come last, in listing order.
+//With a body sink (sink.h) the files stay on the one connection in the chosen order, a sink takes one body at a time.
+//With the default listing order, a folder does not wait for its whole listing: the names are handed out while the
+//listing is still arriving (deduplicated, each name once), and a second connection (if the host's window allows it)
+//downloads them in listing order meanwhile. Once the listing is complete, the listing's own connection takes the
+//names the second one has not started, pipelined as before. Not with a body sink, which takes one body at a time.
+//A manifest lists URLs one per line, each optionally followed by a priority (higher starts first, default 0);
+//empty lines and lines starting with '#' are skipped.
+
+enum folder_schedule_mode
+{
+    SCHEDULE_LISTING,           //listing order on one connection (default)
+    SCHEDULE_LARGEST_FIRST,
+    SCHEDULE_SMALLEST_FIRST
+};
+
+#define SCHEDULE_HEAD_PIPELINE 32       //HEAD requests in flight while a folder is sized
+#define SCHEDULE_MAX_CONNECTIONS 16     //connections per folder, if the host's window allows that many
+
+extern int folder_schedule; //--schedule
+
+//download file_names into folder_dir, sock_Connect is the folder's connection to origin (it may be replaced by a
+//reconnect), keep_alive tells whether it can carry another request afterwards
+//false when files were left undownloaded (their retries gave up, or no connection was left to take them)
+bool downloadFolderScheduled(SOCKET &sock_Connect, struct addrinfo* result, const string &origin, char* addr, char* host_name,
+                             string abs_path, string folder_dir, const arena_string_list &file_names, bool &keep_alive);
+
+//the names of a folder listing while it is received (SCHEDULE_LISTING): beginListingFeed() before the listing is
+//requested, feedFileNames() whenever file_names grew, endListingFeed() once the listing is over (returns how many of
+//its names are already taken, in listing order), finishListingFeed() after the folder is done (waits for the second
+//connection and deletes the feed); NULL is a feed that hands out nothing
+struct listing_feed;
+listing_feed* beginListingFeed(struct addrinfo* result, const string &origin, char* addr, char* host_name, string abs_path,
+                               string folder_name, bool multi_threaded);
+void feedFileNames(listing_feed* feed, const arena_string_list &file_names);
+size_t endListingFeed(listing_feed* feed);
+bool listingFeedFolder(listing_feed* feed, string &folder_dir);     //false while the feed has created no folder
+void finishListingFeed(listing_feed* feed);
+
+bool loadManifest(const string &path, vector<fetch_job> &jobs); //appends the manifest's entries, false if it cannot be read
@@ -0,0 +1,51 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <thread>
+#include "shard.h"
+
+//ref to SetThreadAffinityMask: https://learn.microsoft.com/en-us/windows/win32/api/winbase/nf-winbase-setthreadaffinitymask
+
+using namespace std;
+
+int engine_shards = 0;
+
+static thread_local int current_shard = 0;
+
+int shardCount()
+{
+    if (engine_shards <= 0)
+        return 1;
+
+    return (min)(engine_shards, MAX_SHARDS);
+}
+
+int shardOfHost(const string &host)
+{
+    //FNV-1a, the same host always lands on the same shard
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < host.length(); i++)
+    {
+        hash ^= (unsigned char)host[i];
+        hash *= 16777619u;
+    }
+
+    return (int)(hash % (unsigned int)shardCount());
+}
+
+void enterShard(int shard)
+{
+    current_shard = shard;
+    if (engine_shards <= 0)
+        return;
+
+    //more shards than cores share them round robin, an affinity mask holds at most 64 of them
+    int cores = (min)((int)thread::hardware_concurrency(), 64);
+    if (cores > 0)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (shard % cores));
+}
+
+int currentShard()
+{
+    return current_shard;
+}
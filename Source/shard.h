@@ -0,0 +1,22 @@
+#pragma once
+#include "client.h"
+
+//Sharded engine (--shards=N)
+//Without it, every URL of fetchAll() (fetch.h) is taken by whichever of the shared worker threads is free next, and
+//the OS moves those threads between cores as it likes. With N shards, every host belongs to one shard (by a hash of
+//"host:port"), and each shard is a group of worker threads pinned to one core with its own job queue, its own idle
+//connection pool (pool.h) and its own write-behind buffer pool (writebehind.h). fetchAll() only posts URLs to the
+//queue of their shard and collects the results, so the per-connection state a transfer touches stays on one core and
+//the shards do not contend for the same locks. A shard gets as many workers as its hosts' connection windows can use
+//(aimd.h), so a batch whose URLs all land on one shard is not held to a fraction of the workers. Helper threads of a
+//fetch (schedule.h) join the shard of the fetch.
+//The shards are still blocking threads (a connection per thread), not event loops.
+
+#define MAX_SHARDS 64
+
+extern int engine_shards; //0 = no shards (default), N = N shards, one per core from the first (--shards)
+
+int shardCount();                       //1 without shards
+int shardOfHost(const string &host);    //the shard whose queue, connections and buffers the host's URLs use
+void enterShard(int shard);             //the calling thread works for shard from now on, pinned to its core
+int currentShard();                     //0 on a thread outside every shard
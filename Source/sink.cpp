@@ -0,0 +1,393 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <ctime>
+#include <cstring>
+#include <algorithm>
+#define WIN32_LEAN_AND_MEAN
+
+#include "sink.h"
+
+using namespace std;
+
+static thread_local body_sink* thread_sink = NULL; //NULL: bodies are written to files
+static mutex stdout_m; //held from begin() to end() of a body, so concurrent bodies never interleave on stdout
+
+body_sink* currentBodySink()
+{
+    return thread_sink;
+}
+
+void setBodySink(body_sink* sink)
+{
+    thread_sink = sink;
+}
+
+bool callback_sink::begin(const string &name, long long content_length)
+{
+    file_name = name;
+    return true;
+}
+
+bool callback_sink::write(const char* data, int len)
+{
+    return callback(file_name, data, (size_t)len);
+}
+
+bool memory_sink::begin(const string &name, long long content_length)
+{
+    bodies.push_back(memory_body());
+    bodies.back().file_name = name;
+    if (content_length > 0) //known size: a single allocation for the whole body
+        bodies.back().data.reserve((size_t)content_length);
+
+    return true;
+}
+
+bool memory_sink::write(const char* data, int len)
+{
+    vector<char> &body = bodies.back().data;
+    body.insert(body.end(), data, data + len);
+    return true;
+}
+
+void memory_sink::end(bool complete)
+{
+    bodies.back().complete = complete;
+}
+
+bool stdout_sink::begin(const string &name, long long content_length)
+{
+    stdout_m.lock();
+    return true;
+}
+
+bool stdout_sink::write(const char* data, int len)
+{
+    return fwrite(data, 1, len, stdout) == (size_t)len; //false (e.g. the reading end of the pipe closed) stops the transfer
+}
+
+void stdout_sink::end(bool complete)
+{
+    fflush(stdout);
+    stdout_m.unlock();
+}
+
+bool null_sink::write(const char* data, int len)
+{
+    bytes.fetch_add(len, memory_order_relaxed);
+    return true;
+}
+
+#define TAR_BLOCK 512
+
+//ref to the ustar and pax formats: https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+
+//octal, zero padded and NUL terminated in a field of width bytes; sizes too large for it use the base-256 form
+static void tarNumber(char* field, int width, long long value)
+{
+    if (value >= (1LL << (3 * (width - 1))))
+    {
+        memset(field, 0, width);
+        for (int i = width - 1; i > 0 && value > 0; i--, value >>= 8)
+            field[i] = (char)(value & 0xff);
+        field[0] = (char)0x80;
+        return;
+    }
+
+    snprintf(field, width, "%0*llo", width - 1, value);
+}
+
+static string tarHeader(const string &name, long long size, char type)
+{
+    char header[TAR_BLOCK];
+    memset(header, 0, sizeof(header));
+
+    memcpy(header, name.c_str(), (min)(name.length(), (size_t)100));
+    tarNumber(header + 100, 8, 0644);           //mode
+    tarNumber(header + 108, 8, 0);              //uid
+    tarNumber(header + 116, 8, 0);              //gid
+    tarNumber(header + 124, 12, size);
+    tarNumber(header + 136, 12, (long long)time(NULL));
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    //the checksum is computed with its own field set to spaces
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++)
+        checksum += (unsigned char)header[i];
+    snprintf(header + 148, 8, "%06o", checksum);
+
+    return string(header, sizeof(header));
+}
+
+static string tarPadding(long long size)
+{
+    return string((size_t)((TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK), '\0');
+}
+
+//the header(s) of a member: a name that does not fit the ustar header goes into a PAX extended header before it
+static string tarHeaders(const string &name, long long size)
+{
+    string headers;
+    if (name.length() > 100)
+    {
+        //"<length> path=<name>\n", where the length counts its own digits: grow it until the digits stop changing
+        string record = " path=" + name + "\n";
+        size_t length = record.length();
+        while (length != record.length() + to_string(length).length())
+            length = record.length() + to_string(length).length();
+        record = to_string(length) + record;
+        headers = tarHeader("PaxHeader", record.length(), 'x') + record + tarPadding(record.length());
+    }
+
+    return headers + tarHeader(name, size, '0');
+}
+
+static bool writeAt(HANDLE file, long long offset, const char* data, long long len)
+{
+    while (len > 0)
+    {
+        OVERLAPPED position;
+        memset(&position, 0, sizeof(position));
+        position.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        position.OffsetHigh = (DWORD)(offset >> 32);
+
+        DWORD written = 0;
+        if (!WriteFile(file, data, (DWORD)(min)(len, 1LL << 30), &written, &position) || written == 0)
+            return false;
+
+        data += written;
+        offset += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+//the body the calling thread is handing to a tar_sink, between begin() and end()
+struct tar_body
+{
+    tar_entry entry;
+    long long entry_start = 0;  //of its header(s), -1 = no range claimed yet (chunked)
+    long long entry_end = 0;    //end of the claimed range
+    long long received = 0;
+    string spool;               //a chunked body, until it reaches TAR_SPOOL_BYTES
+    HANDLE spool_file = INVALID_HANDLE_VALUE;   //then the rest of it
+    string spool_path;
+    bool failed = false;
+};
+
+static thread_local tar_body tar_receiving;
+
+//a chunked body that grew past TAR_SPOOL_BYTES continues in a file
+static bool spillSpool(tar_sink &sink, tar_body &body)
+{
+    {
+        lock_guard<mutex> lock(sink.archive_m);
+        body.spool_path = sink.path + ".spool" + to_string(sink.spools++);
+    }
+
+    body.spool_file = CreateFileA(body.spool_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (body.spool_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool written = writeAt(body.spool_file, 0, body.spool.data(), body.spool.length());
+    string().swap(body.spool);
+    return written;
+}
+
+static void dropSpool(tar_body &body)
+{
+    string().swap(body.spool);
+    if (body.spool_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(body.spool_file);
+        DeleteFileA(body.spool_path.c_str());
+        body.spool_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+//copy the spooled body into its range of the archive
+static bool copySpool(tar_sink &sink, tar_body &body)
+{
+    if (body.spool_file == INVALID_HANDLE_VALUE)
+        return writeAt(sink.archive, body.entry.offset, body.spool.data(), body.spool.length());
+
+    LARGE_INTEGER start;
+    start.QuadPart = 0;
+    if (!SetFilePointerEx(body.spool_file, start, NULL, FILE_BEGIN))
+        return false;
+
+    vector<char> buffer(1 << 20);
+    for (long long copied = 0; copied < body.received; )
+    {
+        DWORD byte_read = 0;
+        if (!ReadFile(body.spool_file, buffer.data(), (DWORD)buffer.size(), &byte_read, NULL) || byte_read == 0)
+            return false;
+        if (!writeAt(sink.archive, body.entry.offset + copied, buffer.data(), byte_read))
+            return false;
+        copied += byte_read;
+    }
+
+    return true;
+}
+
+//a claimed range whose body was cut short: the last one is given back, any other one becomes a PAX global header
+//holding a single comment record that spans it, which readers skip (only the first and last bytes of the record are
+//written, whatever the body left in between is part of the comment; a global header, as an extended one would merge
+//with the PAX header of the member after it)
+static void voidRange(tar_sink &sink, tar_body &body)
+{
+    {
+        lock_guard<mutex> lock(sink.archive_m);
+        if (sink.archive_end == body.entry_end)
+        {
+            sink.archive_end = body.entry_start;
+            return;
+        }
+    }
+
+    long long length = body.entry_end - body.entry_start - TAR_BLOCK;
+    string header = tarHeader("GlobalHead", length, 'g') + to_string(length) + " comment=";
+    if (!writeAt(sink.archive, body.entry_start, header.data(), header.length()) ||
+        !writeAt(sink.archive, body.entry_end - 1, "\n", 1))
+    {
+        lock_guard<mutex> lock(sink.archive_m);
+        sink.failed = true;
+    }
+}
+
+bool tar_sink::open(const string &archive_path)
+{
+    path = archive_path;
+    archive = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    return archive != INVALID_HANDLE_VALUE;
+}
+
+bool tar_sink::begin(const string &file_name, long long content_length)
+{
+    tar_body &body = tar_receiving;
+    body = tar_body();
+    body.entry.size = (content_length > 0) ? content_length : 0;
+    body.entry_start = -1;
+
+    string headers;
+    {
+        lock_guard<mutex> lock(archive_m);
+        body.entry.name = file_name;
+        for (int suffix = 1; names.count(body.entry.name) > 0; suffix++)
+            body.entry.name = file_name + "." + to_string(suffix);
+        names.insert(body.entry.name);
+
+        //a known size: claim the whole member now, the body is written straight into it
+        if (content_length > 0)
+        {
+            headers = tarHeaders(body.entry.name, body.entry.size);
+            body.entry_start = archive_end;
+            body.entry.offset = archive_end + headers.length();
+            body.entry_end = body.entry.offset + body.entry.size + tarPadding(body.entry.size).length();
+            archive_end = body.entry_end;
+        }
+    }
+
+    if (body.entry_start >= 0 && !writeAt(archive, body.entry_start, headers.data(), headers.length()))
+        body.failed = true;
+
+    return !body.failed;
+}
+
+bool tar_sink::write(const char* data, int len)
+{
+    tar_body &body = tar_receiving;
+    if (body.entry_start >= 0)
+    {
+        if (body.received + len > body.entry.size || !writeAt(archive, body.entry.offset + body.received, data, len))
+            body.failed = true;
+    }
+    else if (body.spool_file != INVALID_HANDLE_VALUE)
+    {
+        if (!writeAt(body.spool_file, body.received, data, len))
+            body.failed = true;
+    }
+    else
+    {
+        body.spool.append(data, len);
+        if (body.spool.length() > TAR_SPOOL_BYTES && !spillSpool(*this, body))
+            body.failed = true;
+    }
+
+    body.received += len;
+    return !body.failed;
+}
+
+void tar_sink::end(bool complete)
+{
+    tar_body &body = tar_receiving;
+
+    //a chunked body learns its size only now, it claims its range and is copied from the spool
+    if (complete && !body.failed && body.entry_start < 0)
+    {
+        body.entry.size = body.received;
+        string headers = tarHeaders(body.entry.name, body.entry.size);
+        {
+            lock_guard<mutex> lock(archive_m);
+            body.entry_start = archive_end;
+            body.entry.offset = archive_end + headers.length();
+            body.entry_end = body.entry.offset + body.entry.size + tarPadding(body.entry.size).length();
+            archive_end = body.entry_end;
+        }
+
+        if (!writeAt(archive, body.entry_start, headers.data(), headers.length()) || !copySpool(*this, body))
+            body.failed = true;
+    }
+    dropSpool(body);
+
+    if (complete && !body.failed && body.received == body.entry.size)
+    {
+        string padding = tarPadding(body.entry.size);
+        if (writeAt(archive, body.entry.offset + body.entry.size, padding.data(), padding.length()))
+        {
+            lock_guard<mutex> lock(archive_m);
+            entries.push_back(body.entry);
+            return;
+        }
+        body.failed = true;
+    }
+
+    if (body.entry_start >= 0)
+        voidRange(*this, body);
+
+    lock_guard<mutex> lock(archive_m);
+    names.erase(body.entry.name);
+    if (body.failed) //the disk is full or gone, the archive cannot be finished
+        failed = true;
+}
+
+bool tar_sink::finish()
+{
+    lock_guard<mutex> lock(archive_m);
+    if (archive == INVALID_HANDLE_VALUE)
+        return false;
+
+    string index;
+    for (size_t i = 0; i < entries.size(); i++)
+        index += to_string(entries[i].offset) + " " + to_string(entries[i].size) + " " + entries[i].name + "\n";
+
+    string tail = tarHeader(".archive-index", index.length(), '0') + index + tarPadding(index.length());
+    tail += string(2 * TAR_BLOCK, '\0'); //end of archive
+    bool written = writeAt(archive, archive_end, tail.data(), tail.length());
+
+    //nothing after the end blocks: a range given back by a body cut short may have left bytes there
+    LARGE_INTEGER size;
+    size.QuadPart = archive_end + tail.length();
+    written = written && SetFilePointerEx(archive, size, NULL, FILE_BEGIN) && SetEndOfFile(archive);
+
+    CloseHandle(archive);
+    archive = INVALID_HANDLE_VALUE;
+
+    return !failed && written;
+}
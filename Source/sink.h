@@ -0,0 +1,101 @@
+#pragma once
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include "client.h"
+
+//Body sinks: where a response body goes when it is not written to a file
+//When the calling thread has a sink (setBodySink), downloadFile() hands it every received buffer instead of opening a
+//file. begin() and end() bracket each body, a folder fetch delivers one body per file.
+
+struct body_sink
+{
+    virtual ~body_sink() {}
+
+    virtual bool begin(const string &file_name, long long content_length) { return true; } //content_length -1: chunked, size unknown
+    virtual bool write(const char* data, int len) = 0;  //false: the consumer wants no more, the transfer is aborted
+    virtual void end(bool complete) {}                  //complete == false: the body was cut short
+};
+
+//hands every buffer to a callback, for library users that never touch the disk (see fetch.h)
+struct callback_sink : body_sink
+{
+    function<bool(const string &file_name, const char* data, size_t len)> callback;
+    string file_name;
+
+    bool begin(const string &file_name, long long content_length);
+    bool write(const char* data, int len);
+};
+
+//keeps every body in a growable buffer, for the caller to read once the fetch is done (one fetch per sink)
+struct memory_body
+{
+    string file_name;
+    vector<char> data;
+    bool complete = false;
+};
+
+struct memory_sink : body_sink
+{
+    vector<memory_body> bodies;
+
+    bool begin(const string &file_name, long long content_length);
+    bool write(const char* data, int len);
+    void end(bool complete);
+};
+
+//writes the bodies to stdout for piping into another tool, a whole body at a time when several transfers share it
+struct stdout_sink : body_sink
+{
+    bool begin(const string &file_name, long long content_length);
+    bool write(const char* data, int len);
+    void end(bool complete);
+};
+
+//counts the bytes and throws them away: network and parsing throughput without any disk effects
+struct null_sink : body_sink
+{
+    atomic<long long> bytes{0};
+
+    bool write(const char* data, int len);
+};
+
+//packs every body into one tar archive as it arrives (--sink=tar:file), instead of a file per body
+//Each body is a ustar member (a PAX header carries names over 100 bytes). A body of known size claims its byte range
+//of the archive in begin() and is written into it at offsets, so the transfers fill the archive side by side and the
+//lock is only held to claim the range and to record the entry. A body of unknown size (chunked) is spooled, in memory
+//up to TAR_SPOOL_BYTES and then in a file next to the archive, and claims its range once it has ended. The range of a
+//body cut short becomes a PAX global header holding only a comment, which readers skip, so a retry starts it anew. A name
+//already in the archive gets a numbered suffix ("name.1"). finish() appends the index as the last member,
+//".archive-index": one line "<offset of the data> <size> <name>" per body, so a reader can seek straight to any
+//body, then the end-of-archive blocks.
+#define TAR_SPOOL_BYTES (4 << 20)
+
+struct tar_entry
+{
+    long long offset;           //of the data, the header is the 512 bytes before it
+    long long size;
+    string name;
+};
+
+struct tar_sink : body_sink
+{
+    HANDLE archive = INVALID_HANDLE_VALUE;
+    string path;
+    long long archive_end = 0;  //where the next member starts
+    vector<tar_entry> entries;
+    set<string> names;          //of the entries and of the bodies being received
+    int spools = 0;             //spool files created, for their names
+    bool failed = false;
+    mutex archive_m;            //held to claim a range or a name and to record an entry, never while receiving
+
+    bool open(const string &path);
+    bool begin(const string &file_name, long long content_length);
+    bool write(const char* data, int len);
+    void end(bool complete);
+    bool finish();              //index and end-of-archive blocks, false if anything could not be written
+};
+
+body_sink* currentBodySink();
+void setBodySink(body_sink* sink);
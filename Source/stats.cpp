@@ -0,0 +1,204 @@
+#include <cstdio>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include "stats.h"
+#include "trace.h"
+
+using namespace std;
+
+//values are recorded in microseconds, values below 64 get their own bucket,
+//larger values keep their 6 most significant bits (32 sub-buckets per power of two, ~3% precision)
+#define SUB_BUCKET_BITS 5
+#define HISTOGRAM_BUCKETS (64 + (64 - 6) * 32)
+
+struct phase_histogram
+{
+    atomic<unsigned long long> buckets[HISTOGRAM_BUCKETS];
+    atomic<unsigned long long> count;
+    atomic<unsigned long long> sum;
+    atomic<unsigned long long> max;
+};
+
+bool stats_enabled = false;
+
+static const char* phase_names[PHASE_COUNT + 1] = {"dns", "connect", "request_sent", "status_line", "headers", "body", "request_total"};
+static phase_histogram histograms[PHASE_COUNT + 1]; //last one holds the whole request (from its start to body done)
+static atomic<unsigned long long> requests_done(0);
+static atomic<unsigned long long> body_bytes_total(0);
+static chrono::steady_clock::time_point program_start = chrono::steady_clock::now();
+
+//every thread handles one connection at a time, so the phase boundaries are kept per thread; on a pipelined
+//connection its responses arrive in the order of the requests: first the one sent last with PHASE_REQUEST_SENT,
+//then those sent ahead of their turn with stats_pipelined_request()
+static thread_local chrono::steady_clock::time_point last_mark;
+static thread_local chrono::steady_clock::time_point request_start;
+static thread_local bool request_due = false;       //the response of the last PHASE_REQUEST_SENT has not started
+static thread_local int pipelined_due = 0;          //responses of pipelined requests that have not started
+static thread_local bool pipelined_response = false; //the response being received belongs to a pipelined request
+
+static int bucketIndex(unsigned long long value)
+{
+    if (value < 64)
+        return (int)value;
+
+    int msb = 63;
+    while (!(value >> msb))
+        msb--;
+
+    int shift = msb - SUB_BUCKET_BITS;
+    return 64 + (msb - 6) * 32 + (int)((value >> shift) & 31);
+}
+
+//lowest value that falls into a bucket
+static unsigned long long bucketValue(int index)
+{
+    if (index < 64)
+        return index;
+
+    int msb = (index - 64) / 32 + 6;
+    unsigned long long sub_bucket = (index - 64) % 32;
+    return (32 + sub_bucket) << (msb - SUB_BUCKET_BITS);
+}
+
+static void record(phase_histogram &histogram, unsigned long long value)
+{
+    histogram.buckets[bucketIndex(value)].fetch_add(1, memory_order_relaxed);
+    histogram.count.fetch_add(1, memory_order_relaxed);
+    histogram.sum.fetch_add(value, memory_order_relaxed);
+
+    unsigned long long current_max = histogram.max.load(memory_order_relaxed);
+    while (value > current_max && !histogram.max.compare_exchange_weak(current_max, value, memory_order_relaxed))
+        ;
+}
+
+static unsigned long long percentile(phase_histogram &histogram, double p)
+{
+    unsigned long long count = histogram.count.load();
+    if (count == 0)
+        return 0;
+
+    unsigned long long rank = (unsigned long long)(p / 100.0 * count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram.buckets[i].load();
+        if (seen >= rank)
+            return bucketValue(i);
+    }
+
+    return histogram.max.load();
+}
+
+//the phase boundaries also become the spans of the --trace timeline
+void stats_begin_request()
+{
+    if (!stats_enabled && !trace_enabled)
+        return;
+
+    last_mark = chrono::steady_clock::now();
+    request_start = last_mark;
+}
+
+void stats_skip_phase()
+{
+    if (!stats_enabled && !trace_enabled)
+        return;
+
+    last_mark = chrono::steady_clock::now();
+}
+
+void stats_pipelined_request()
+{
+    if (!stats_enabled && !trace_enabled)
+        return;
+
+    pipelined_due++;
+}
+
+void stats_mark_phase(request_phase phase, long long body_bytes, const char* detail)
+{
+    if (!stats_enabled && !trace_enabled)
+        return;
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+    //a request sent on its own: nothing is due before it (a lost connection took the pipelined ones with it)
+    if (phase == PHASE_REQUEST_SENT)
+    {
+        request_due = true;
+        pipelined_due = 0;
+    }
+
+    //the wait for the status line of a pipelined request was spent on the responses before it
+    if (phase == PHASE_STATUS_LINE)
+    {
+        pipelined_response = (!request_due && pipelined_due > 0);
+        if (pipelined_response)
+        {
+            pipelined_due--;
+            last_mark = now;
+            return;
+        }
+        request_due = false;
+    }
+
+    trace_span(phase_names[phase], "phase", trace_timestamp(last_mark), trace_timestamp(now), detail);
+
+    if (!stats_enabled)
+    {
+        last_mark = now;
+        return;
+    }
+
+    record(histograms[phase], chrono::duration_cast<chrono::microseconds>(now - last_mark).count());
+    last_mark = now;
+
+    //a request ends with its body, the next request on the same connection starts right here
+    if (phase == PHASE_BODY)
+    {
+        if (!pipelined_response)
+            record(histograms[PHASE_COUNT], chrono::duration_cast<chrono::microseconds>(now - request_start).count());
+        requests_done.fetch_add(1, memory_order_relaxed);
+        body_bytes_total.fetch_add(body_bytes, memory_order_relaxed);
+        request_start = now;
+    }
+}
+
+bool stats_dump(string path)
+{
+    if (!stats_enabled)
+        return true;
+
+    FILE* out = (path == "") ? stderr : fopen(path.c_str(), "w");
+    if (out == NULL)
+        return false;
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - program_start).count();
+    unsigned long long requests = requests_done.load();
+    unsigned long long bytes = body_bytes_total.load();
+
+    fprintf(out, "{\"requests\":%llu,\"body_bytes\":%llu,\"wall_seconds\":%.6f,\"requests_per_s\":%.3f,\"mb_per_s\":%.3f,\"phases_us\":{",
+            requests, bytes, seconds, requests / seconds, bytes / (1024.0 * 1024.0) / seconds);
+
+    for (int i = 0; i <= PHASE_COUNT; i++)
+    {
+        phase_histogram &histogram = histograms[i];
+        unsigned long long count = histogram.count.load();
+
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                (i == 0) ? "" : ",", phase_names[i], count, count ? double(histogram.sum.load()) / count : 0.0,
+                percentile(histogram, 50), percentile(histogram, 90), percentile(histogram, 99), percentile(histogram, 99.9),
+                histogram.max.load());
+    }
+
+    fprintf(out, "}}\n");
+
+    if (out != stderr)
+        fclose(out);
+
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+
+using namespace std;
+
+//Per-request phase timing (enabled with --stats)
+//Every thread keeps the timestamp of its last phase boundary, each mark records the time spent since then
+//into a per-phase log-linear (HDR-style) latency histogram. Histograms are dumped as JSON when the program exits.
+//A request pipelined behind others (HTTP/1.1) overlaps them: its send, its wait for the status line and its total are
+//not recorded, only its headers and body. A connection taken from the pool records no connect phase.
+//The same boundaries are recorded as spans when --trace is on (the body span ends once the file is closed).
+enum request_phase
+{
+    PHASE_DNS,              //getaddrinfo
+    PHASE_CONNECT,          //TCP connect
+    PHASE_REQUEST_SENT,     //building and sending the HTTP request
+    PHASE_STATUS_LINE,      //waiting for the status line (time to first byte)
+    PHASE_HEADERS,          //receiving the remaining headers
+    PHASE_BODY,             //receiving the message body
+    PHASE_COUNT
+};
+
+extern bool stats_enabled;
+
+void stats_begin_request();
+void stats_skip_phase();            //the phase did not happen for this request (e.g. no connect), the next one starts now
+void stats_pipelined_request();     //a request was sent while the responses of earlier ones are still due
+void stats_mark_phase(request_phase phase, long long body_bytes = 0, const char* detail = ""); //detail names the span in the trace
+bool stats_dump(string path); //path "" writes to stderr
@@ -0,0 +1,280 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <string>
+#include <map>
+#include <mutex>
+#include "tls.h"
+#include "netio.h"
+
+#ifndef NO_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#endif
+
+using namespace std;
+
+bool tls_verify = true;
+string tls_ca_file = "";
+
+static thread_local string tls_error = "";
+
+#ifndef NO_TLS
+
+//every thread works on one connection at a time (like the read-ahead buffer in netio.cpp)
+struct tls_connection
+{
+    SOCKET sock = INVALID_SOCKET;
+    SSL* ssl = NULL;
+    string session_key;
+};
+
+static thread_local tls_connection tls;
+
+static SSL_CTX* tls_context = NULL;
+static once_flag tls_context_once;
+
+static map<string, SSL_SESSION*> sessions; //host:port -> newest session or ticket from that server
+static mutex sessions_m;
+
+//called by OpenSSL whenever the server hands out a session (TLS 1.3 tickets arrive after the handshake)
+static int storeSession(SSL* ssl, SSL_SESSION* session)
+{
+    tls_connection* connection = (tls_connection*)SSL_get_app_data(ssl);
+    if (connection == NULL)
+        return 0;
+
+    lock_guard<mutex> lock(sessions_m);
+    SSL_SESSION* &cached = sessions[connection->session_key];
+    if (cached != NULL)
+        SSL_SESSION_free(cached);
+    cached = session;
+
+    return 1; //we keep the reference
+}
+
+static void createContext()
+{
+    tls_context = SSL_CTX_new(TLS_client_method());
+    if (tls_context == NULL)
+        return;
+
+    SSL_CTX_set_min_proto_version(tls_context, TLS1_2_VERSION);
+    SSL_CTX_set_mode(tls_context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    //a server closing without close_notify is how many HTTP/1.0 servers end a body, the length checks catch truncation
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    SSL_CTX_set_options(tls_context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+    //kernel TLS: OpenSSL hands the keys to the kernel after the handshake if the kernel has the tls module
+#if defined(SSL_OP_ENABLE_KTLS) && defined(__linux__)
+    SSL_CTX_set_options(tls_context, SSL_OP_ENABLE_KTLS);
+#endif
+
+    if (tls_verify)
+    {
+        SSL_CTX_set_verify(tls_context, SSL_VERIFY_PEER, NULL);
+        if (tls_ca_file != "")
+            SSL_CTX_load_verify_locations(tls_context, tls_ca_file.c_str(), NULL);
+        else
+            SSL_CTX_set_default_verify_paths(tls_context);
+    }
+    else
+        SSL_CTX_set_verify(tls_context, SSL_VERIFY_NONE, NULL);
+
+    //sessions are kept in our own per-server cache, not in OpenSSL's internal one
+    SSL_CTX_set_session_cache_mode(tls_context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tls_context, storeSession);
+
+    //OpenSSL writes with write(), not send(MSG_NOSIGNAL): a record (or close_notify) sent after the server has
+    //closed would raise SIGPIPE outside Windows, the write has to fail with EPIPE instead
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+static bool isIPAddress(const string &name)
+{
+    unsigned char address[16];
+    return inet_pton(AF_INET, name.c_str(), address) == 1 || inet_pton(AF_INET6, name.c_str(), address) == 1;
+}
+
+bool tlsAttach(SOCKET sock, string server_name, string session_key)
+{
+    call_once(tls_context_once, createContext);
+    tlsDetach(tls.sock);
+    tls_error = "";
+
+    if (tls_context == NULL)
+    {
+        tls_error = "Failed to initialize OpenSSL.";
+        return false;
+    }
+
+    SSL* ssl = SSL_new(tls_context);
+    if (ssl == NULL || !SSL_set_fd(ssl, (int)sock))
+    {
+        SSL_free(ssl);
+        tls_error = "Failed to create the TLS session.";
+        return false;
+    }
+
+    //SNI and certificate name check, an IP address is matched against the certificate's IP entries instead
+    if (isIPAddress(server_name))
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), server_name.c_str());
+    else
+    {
+        SSL_set_tlsext_host_name(ssl, server_name.c_str());
+        SSL_set1_host(ssl, server_name.c_str());
+    }
+
+    {
+        lock_guard<mutex> lock(sessions_m);
+        map<string, SSL_SESSION*>::iterator cached = sessions.find(session_key);
+        if (cached != sessions.end())
+            SSL_set_session(ssl, cached->second); //resumption is attempted, a full handshake follows if the server refuses
+    }
+
+    tls.sock = sock;
+    tls.ssl = ssl;
+    tls.session_key = session_key;
+    SSL_set_app_data(ssl, &tls);
+    SSL_set_connect_state(ssl);
+
+    return true;
+}
+
+//map an SSL_get_error() result to the netio return values
+static int tlsResult(int ssl_result)
+{
+    switch (SSL_get_error(tls.ssl, ssl_result))
+    {
+        case SSL_ERROR_WANT_READ:
+            return TLS_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return TLS_WANT_WRITE;
+        case SSL_ERROR_ZERO_RETURN: //close_notify
+            return IO_CLOSED;
+        case SSL_ERROR_SYSCALL:
+            return (ERR_peek_error() == 0 && ssl_result == 0) ? IO_CLOSED : IO_ERROR;
+        default:
+            return IO_ERROR;
+    }
+}
+
+int tlsHandshake(SOCKET sock)
+{
+    if (!tlsActive(sock))
+        return IO_ERROR;
+
+    ERR_clear_error();
+    int handshake_result = SSL_do_handshake(tls.ssl);
+    if (handshake_result == 1)
+        return 1;
+
+    int result = tlsResult(handshake_result);
+    if (result == TLS_WANT_READ || result == TLS_WANT_WRITE)
+        return result;
+
+    long verify_result = SSL_get_verify_result(tls.ssl);
+    if (verify_result != X509_V_OK)
+        tls_error = string("Certificate verification failed: ") + X509_verify_cert_error_string(verify_result) + ".";
+    else if (ERR_peek_error() != 0)
+    {
+        char error_text[256];
+        ERR_error_string_n(ERR_get_error(), error_text, sizeof(error_text));
+        tls_error = string("TLS handshake failed: ") + error_text + ".";
+    }
+    else
+        tls_error = "Connection closed during the TLS handshake.";
+
+    return IO_ERROR;
+}
+
+int tlsRead(SOCKET sock, char* buff, int len)
+{
+    if (!tlsActive(sock))
+        return IO_ERROR;
+
+    ERR_clear_error();
+    int byte_read = SSL_read(tls.ssl, buff, len);
+    return (byte_read > 0) ? byte_read : tlsResult(byte_read);
+}
+
+int tlsWrite(SOCKET sock, const char* buff, int len)
+{
+    if (!tlsActive(sock))
+        return IO_ERROR;
+
+    ERR_clear_error();
+    int byte_written = SSL_write(tls.ssl, buff, len);
+    return (byte_written > 0) ? byte_written : tlsResult(byte_written);
+}
+
+bool tlsActive(SOCKET sock)
+{
+    return tls.ssl != NULL && tls.sock == sock && sock != INVALID_SOCKET;
+}
+
+bool tlsPending(SOCKET sock)
+{
+    return tlsActive(sock) && SSL_has_pending(tls.ssl);
+}
+
+void tlsDetach(SOCKET sock)
+{
+    if (!tlsActive(sock))
+        return;
+
+    SSL_shutdown(tls.ssl); //non-blocking socket: close_notify is sent if it fits, the server's reply is not awaited
+    SSL_free(tls.ssl);
+    tls.ssl = NULL;
+    tls.sock = INVALID_SOCKET;
+}
+
+string tlsDescription(SOCKET sock)
+{
+    if (!tlsActive(sock))
+        return "";
+
+    string description = string(SSL_get_version(tls.ssl)) + ", " + SSL_get_cipher_name(tls.ssl);
+    description += SSL_session_reused(tls.ssl) ? ", resumed session" : ", full handshake";
+
+#if defined(BIO_get_ktls_send) && defined(BIO_get_ktls_recv)
+    bool ktls_send = BIO_get_ktls_send(SSL_get_wbio(tls.ssl));
+    bool ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(tls.ssl));
+    if (ktls_send || ktls_recv)
+        description += string(", kTLS") + (ktls_recv ? " receive" : "") + (ktls_send && ktls_recv ? " and" : "") + (ktls_send ? " send" : "");
+    else
+        description += ", kTLS not available";
+#endif
+
+    return description;
+}
+
+#else //NO_TLS: built without OpenSSL
+
+bool tlsAttach(SOCKET sock, string server_name, string session_key)
+{
+    tls_error = "HTTPS is not supported by this build (compiled with NO_TLS).";
+    return false;
+}
+
+int tlsHandshake(SOCKET sock) { return IO_ERROR; }
+int tlsRead(SOCKET sock, char* buff, int len) { return IO_ERROR; }
+int tlsWrite(SOCKET sock, const char* buff, int len) { return IO_ERROR; }
+bool tlsActive(SOCKET sock) { return false; }
+bool tlsPending(SOCKET sock) { return false; }
+void tlsDetach(SOCKET sock) {}
+string tlsDescription(SOCKET sock) { return ""; }
+
+#endif
+
+string tlsError()
+{
+    return tls_error;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "client.h"
+
+//TLS for https:// URLs (OpenSSL)
+//The socket layer (netio.cpp) drives every TLS connection. connectWithDeadline() runs the handshake right after
+//the TCP connect when the thread has a TLS target (useTLS), recvSome() and sendAll() go through SSL_read and
+//SSL_write with the same deadlines, and closeConnection() sends close_notify.
+//Sessions (TLS 1.2 session ids and TLS 1.3 tickets) are cached per host:port, so a reconnect to the same server
+//resumes the session instead of running the full handshake. On Linux the record layer is handed to the kernel
+//(kTLS) when both the kernel and OpenSSL support it. The bytes are then decrypted straight into the caller's
+//buffer (a memory-mapped file with --mmap) and no copy passes through OpenSSL's own buffers.
+//Link with -lssl -lcrypto, or build without OpenSSL with -DNO_TLS (https:// URLs then fail to connect).
+//ref: https://docs.openssl.org/3.0/man3/SSL_read/, https://docs.openssl.org/3.0/man3/SSL_CTX_sess_set_new_cb/
+
+#define TLS_WANT_READ -3    //the TLS operation waits for the socket to become readable
+#define TLS_WANT_WRITE -4   //or writable, then the same call is repeated
+
+extern bool tls_verify;     //check the server certificate and its host name (--insecure turns it off)
+extern string tls_ca_file;  //trusted CA certificates (PEM), "" = OpenSSL's default paths (--cacert=file)
+
+//start a client session on a connected socket, session_key ("host:port") selects the cached session to resume
+bool tlsAttach(SOCKET sock, string server_name, string session_key);
+int tlsHandshake(SOCKET sock);                  //1 when done, TLS_WANT_READ, TLS_WANT_WRITE or IO_ERROR
+int tlsRead(SOCKET sock, char* buff, int len);  //bytes read, IO_CLOSED, IO_ERROR, TLS_WANT_READ or TLS_WANT_WRITE
+int tlsWrite(SOCKET sock, const char* buff, int len);
+bool tlsActive(SOCKET sock);
+bool tlsPending(SOCKET sock);                   //OpenSSL holds bytes of the socket that were not read yet
+void tlsDetach(SOCKET sock);                    //send close_notify (best effort) and free the session
+
+string tlsDescription(SOCKET sock); //protocol, cipher, resumed or full handshake, kTLS, for the log
+string tlsError();                  //why the last handshake of this thread failed
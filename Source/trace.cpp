@@ -0,0 +1,187 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include "trace.h"
+
+using namespace std;
+
+struct trace_event
+{
+    const char* name;       //string literals only, so recording never copies the name
+    const char* category;
+    long long start_us;
+    long long duration_us;
+    string detail;          //URL or file name, empty for the phase spans
+};
+
+struct trace_buffer
+{
+    int tid;
+    bool named = false;     //its thread_name record is in the file
+    bool in_use = true;     //false once its thread has exited, the next new thread takes it
+    vector<trace_event> events;
+};
+
+//marks the buffer of a thread free when the thread exits
+struct buffer_owner
+{
+    trace_buffer* buffer = NULL;
+
+    ~buffer_owner();
+};
+
+bool trace_enabled = false;
+
+static chrono::steady_clock::time_point trace_origin = chrono::steady_clock::now();
+static vector<unique_ptr<trace_buffer>> buffers; //owned here so they outlive the threads that filled them
+static mutex buffers_m;
+static thread_local buffer_owner local_buffer;
+
+static FILE* trace_file = NULL;
+static bool first_record = true;
+static bool write_failed = false;
+static mutex file_m;
+
+buffer_owner::~buffer_owner()
+{
+    if (buffer == NULL)
+        return;
+
+    lock_guard<mutex> lock(buffers_m);
+    buffer->in_use = false;
+}
+
+static trace_buffer* getLocalBuffer()
+{
+    if (local_buffer.buffer == NULL)
+    {
+        lock_guard<mutex> lock(buffers_m); //taken once per thread
+        for (size_t b = 0; b < buffers.size() && local_buffer.buffer == NULL; b++)
+            if (!buffers[b]->in_use)
+            {
+                local_buffer.buffer = buffers[b].get();
+                local_buffer.buffer->in_use = true;
+            }
+
+        if (local_buffer.buffer == NULL)
+        {
+            buffers.push_back(unique_ptr<trace_buffer>(new trace_buffer()));
+            local_buffer.buffer = buffers.back().get();
+            local_buffer.buffer->tid = (int)buffers.size();
+        }
+    }
+
+    return local_buffer.buffer;
+}
+
+long long trace_timestamp(chrono::steady_clock::time_point t)
+{
+    return chrono::duration_cast<chrono::microseconds>(t - trace_origin).count();
+}
+
+long long trace_now()
+{
+    if (!trace_enabled)
+        return 0;
+
+    return trace_timestamp(chrono::steady_clock::now());
+}
+
+//escape the characters JSON does not allow inside a string (URLs and file names may contain them)
+static string jsonEscape(string text)
+{
+    string escaped = "";
+    for (size_t i = 0; i < text.length(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+            escaped += '\\';
+
+        if ((unsigned char)text[i] < 0x20)
+            continue;
+
+        escaped += text[i];
+    }
+
+    return escaped;
+}
+
+//write the spans of a buffer to the file and empty it (its capacity stays for the next ones)
+static void flushBuffer(trace_buffer* buffer)
+{
+    lock_guard<mutex> lock(file_m);
+    if (trace_file == NULL)
+        return;
+
+    if (!buffer->named)
+    {
+        fprintf(trace_file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+                first_record ? "" : ",\n", buffer->tid, buffer->tid);
+        first_record = false;
+        buffer->named = true;
+    }
+
+    for (size_t i = 0; i < buffer->events.size(); i++)
+    {
+        trace_event &event = buffer->events[i];
+        fprintf(trace_file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld",
+                event.name, event.category, buffer->tid, event.start_us, event.duration_us);
+
+        if (event.detail != "")
+            fprintf(trace_file, ",\"args\":{\"detail\":\"%s\"}", jsonEscape(event.detail).c_str());
+
+        fprintf(trace_file, "}");
+    }
+
+    if (ferror(trace_file))
+        write_failed = true;
+    buffer->events.clear();
+}
+
+void trace_span(const char* name, const char* category, long long start_us, long long end_us, const char* detail)
+{
+    if (!trace_enabled)
+        return;
+
+    trace_buffer* buffer = getLocalBuffer();
+    trace_event event = {name, category, start_us, end_us - start_us, detail};
+    buffer->events.push_back(event);
+    if (buffer->events.size() >= TRACE_FLUSH_EVENTS)
+        flushBuffer(buffer);
+}
+
+bool trace_start(string path)
+{
+    lock_guard<mutex> lock(file_m);
+    trace_file = fopen(path.c_str(), "w");
+    if (trace_file == NULL)
+        return false;
+
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    trace_enabled = true;
+    return true;
+}
+
+bool trace_finish()
+{
+    if (!trace_enabled)
+        return true;
+
+    trace_enabled = false;
+    {
+        lock_guard<mutex> lock(buffers_m);
+        for (size_t b = 0; b < buffers.size(); b++)
+            if (!buffers[b]->events.empty())
+                flushBuffer(buffers[b].get());
+    }
+
+    lock_guard<mutex> lock(file_m);
+    fprintf(trace_file, "\n]}\n");
+    bool written = !write_failed && !ferror(trace_file);
+    written = (fclose(trace_file) == 0) && written;
+    trace_file = NULL;
+
+    return written;
+}
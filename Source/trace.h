@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <chrono>
+
+using namespace std;
+
+//Timeline recording (enabled with --trace=file)
+//Spans are appended to a buffer owned by the recording thread (no locking on the hot path) and written in Chrome
+//Trace Event JSON, which can be opened in Perfetto (https://ui.perfetto.dev) or chrome://tracing. A buffer holding
+//TRACE_FLUSH_EVENTS spans is written to the file by its thread and starts over, the rest is written by
+//trace_finish(), so a long run keeps a bounded number of spans in memory. The buffer of a thread that has exited is
+//taken over by the next new thread (its spans keep the same tid).
+//format reference: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+
+#define TRACE_FLUSH_EVENTS 4096
+
+extern bool trace_enabled;
+
+bool trace_start(string path); //create the file and start recording, false if it cannot be created
+long long trace_now(); //microseconds since program start, 0 when tracing is off
+long long trace_timestamp(chrono::steady_clock::time_point t);
+void trace_span(const char* name, const char* category, long long start_us, long long end_us, const char* detail = ""); //detail is copied only while tracing
+bool trace_finish(); //write what is left and end the file, false if any of it could not be written
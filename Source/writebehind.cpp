@@ -0,0 +1,355 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include "writebehind.h"
+#include "netio.h"
+#include "trace.h"
+#include "journal.h"
+#include "budget.h"
+#include "shard.h"
+
+//ref to WriteFile: https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-writefile
+//ref to FlushFileBuffers: https://learn.microsoft.com/en-us/windows/win32/api/fileapi/nf-fileapi-flushfilebuffers
+
+using namespace std;
+
+extern mutex m; //console lock, defined in client.cpp
+
+int write_behind_threads = 0;
+long long fsync_every_bytes = 0;
+
+struct write_buffer
+{
+    int len;
+    int pool;                   //index of the pool it goes back to
+    char data[WRITE_BEHIND_BUFFER_BYTES];
+};
+
+struct write_behind_file
+{
+    HANDLE handle;
+    string path;
+    write_behind_group* group;  //NULL = not waited for on its own
+    int writer;                 //index of the writer thread that owns every write of this file
+    write_buffer* current;      //buffer the receiving thread is filling, NULL = take one from the pool first
+    long long unflushed;        //bytes written since the last FlushFileBuffers (writer side)
+    bool failed;                //a write failed, the rest of the file is dropped (writer side)
+};
+
+struct write_job
+{
+    write_behind_file* file;
+    write_buffer* buffer;       //NULL = every write is queued, close the file
+};
+
+struct writer_queue
+{
+    mutex queue_m;
+    condition_variable queue_cv;
+    deque<write_job> jobs;
+    bool stopping = false;
+    thread worker;
+};
+
+//one pool per shard (shard.h), so receivers on different cores do not share its lock, each on its own cache lines
+struct alignas(64) buffer_pool
+{
+    vector<write_buffer*> free_buffers;
+    int allocated = 0;          //buffers are created on demand, up to poolCapacity()
+    int capacity = 0;           //its share from shareWriteBehindBuffers(), 0 = an even share
+    memory_reservation memory;
+    mutex pool_m;
+    condition_variable pool_cv;
+};
+
+static buffer_pool pools[MAX_SHARDS];
+
+//the buffers are split between the shards, every one gets at least one
+static int poolCapacity(const buffer_pool &pool)
+{
+    if (pool.capacity > 0)
+        return pool.capacity;
+    return (max)(1, WRITE_BEHIND_POOL_BUFFERS / shardCount());
+}
+
+static vector<unique_ptr<writer_queue>> writers;
+static mutex writers_m;
+static int next_writer = 0;
+
+static long long pending_jobs = 0;
+static mutex pending_m;
+static condition_variable pending_cv;
+
+//take a free buffer from the pool of the calling thread's shard, waits for a writer to return one when the whole pool is queued
+static write_buffer* acquireBuffer()
+{
+    int index = currentShard();
+    buffer_pool &pool = pools[index];
+    unique_lock<mutex> lock(pool.pool_m);
+    //the pool grows while the memory budget (budget.h) allows, its first buffer is always there so writing never stops
+    if (pool.free_buffers.empty() && pool.allocated < poolCapacity(pool) &&
+        (pool.allocated == 0 || budgetTryReserve(pool.memory, WRITE_BEHIND_BUFFER_BYTES)))
+    {
+        if (pool.allocated == 0)
+            budgetCharge(pool.memory, WRITE_BEHIND_BUFFER_BYTES);
+        pool.allocated++;
+        lock.unlock();
+
+        write_buffer* buffer = new write_buffer();
+        buffer->len = 0;
+        buffer->pool = index;
+        return buffer;
+    }
+
+    if (pool.free_buffers.empty())
+    {
+        long long wait_start = trace_now();
+        pool.pool_cv.wait(lock, [&pool] { return !pool.free_buffers.empty(); });
+        trace_span("write_backpressure", "disk", wait_start, trace_now());
+    }
+
+    write_buffer* buffer = pool.free_buffers.back();
+    pool.free_buffers.pop_back();
+    buffer->len = 0;
+    return buffer;
+}
+
+static void releaseBuffer(write_buffer* buffer)
+{
+    buffer_pool &pool = pools[buffer->pool];
+    lock_guard<mutex> lock(pool.pool_m);
+    pool.free_buffers.push_back(buffer);
+    pool.pool_cv.notify_one();
+}
+
+static void writeBuffer(write_behind_file* file, write_buffer* buffer)
+{
+    long long write_start = trace_now();
+
+    int written = 0;
+    while (!file->failed && written < buffer->len)
+    {
+        DWORD byte_written = 0;
+        if (!WriteFile(file->handle, buffer->data + written, buffer->len - written, &byte_written, NULL) || byte_written == 0)
+            file->failed = true;
+
+        written += byte_written;
+    }
+
+    //several buffers share one flush, the disk sees a few large barriers instead of one per write
+    file->unflushed += written;
+    if (fsync_every_bytes > 0 && file->unflushed >= fsync_every_bytes)
+    {
+        FlushFileBuffers(file->handle);
+        file->unflushed = 0;
+    }
+
+    trace_span("disk_write", "disk", write_start, trace_now(), file->path.c_str());
+}
+
+static void finishFile(write_behind_file* file)
+{
+    if (fsync_every_bytes > 0 && file->unflushed > 0)
+        FlushFileBuffers(file->handle);
+
+    CloseHandle(file->handle);
+
+    if (file->failed)
+    {
+        m.lock();
+        console() << "Failed to write '" << file->path << "' to disk.\n";
+        m.unlock();
+    }
+
+    if (file->group != NULL)
+    {
+        lock_guard<mutex> lock(file->group->group_m);
+        file->group->failed = file->group->failed || file->failed;
+        file->group->open_files--;
+        if (file->group->open_files == 0)
+            file->group->group_cv.notify_all();
+    }
+
+    delete file;
+}
+
+static void writerLoop(writer_queue* queue)
+{
+    while (true)
+    {
+        unique_lock<mutex> lock(queue->queue_m);
+        queue->queue_cv.wait(lock, [queue] { return !queue->jobs.empty() || queue->stopping; });
+        if (queue->jobs.empty()) //stopping and nothing left to write
+            return;
+
+        write_job job = queue->jobs.front();
+        queue->jobs.pop_front();
+        lock.unlock();
+
+        if (job.buffer != NULL)
+        {
+            writeBuffer(job.file, job.buffer);
+            releaseBuffer(job.buffer);
+        }
+        else
+            finishFile(job.file);
+
+        lock_guard<mutex> pending_lock(pending_m);
+        pending_jobs--;
+        if (pending_jobs == 0)
+            pending_cv.notify_all();
+    }
+}
+
+static void queueJob(write_behind_file* file, write_buffer* buffer)
+{
+    {
+        lock_guard<mutex> pending_lock(pending_m);
+        pending_jobs++;
+    }
+
+    writer_queue* queue = writers[file->writer].get();
+    lock_guard<mutex> lock(queue->queue_m);
+    queue->jobs.push_back({file, buffer});
+    queue->queue_cv.notify_one();
+}
+
+//returns NULL if the file cannot be created
+write_behind_file* openWriteBehind(string path, write_behind_group* group)
+{
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    write_behind_file* file = new write_behind_file();
+    file->handle = handle;
+    file->path = path;
+    file->group = group;
+    file->current = NULL;
+    file->unflushed = 0;
+    file->failed = false;
+
+    if (group != NULL)
+    {
+        lock_guard<mutex> group_lock(group->group_m);
+        group->open_files++;
+    }
+
+    lock_guard<mutex> lock(writers_m);
+    if (writers.empty()) //the writer threads start with the first file
+    {
+        for (int i = 0; i < max(1, write_behind_threads); i++)
+        {
+            writers.push_back(unique_ptr<writer_queue>(new writer_queue()));
+            writers.back()->worker = thread(writerLoop, writers.back().get());
+        }
+    }
+
+    file->writer = next_writer;
+    next_writer = (next_writer + 1) % (int)writers.size();
+
+    return file;
+}
+
+//receive up to max_bytes straight into the file's current buffer, returns the same values as recvSome
+int recvIntoWriteBehind(write_behind_file* file, SOCKET sock, long long max_bytes)
+{
+    if (file->current == NULL)
+        file->current = acquireBuffer();
+
+    write_buffer* buffer = file->current;
+    int space = WRITE_BEHIND_BUFFER_BYTES - buffer->len;
+    int byte_recv = recvSome(sock, buffer->data + buffer->len, (int)min((long long)space, max_bytes));
+    if (byte_recv <= 0)
+        return byte_recv;
+
+    digestBody(buffer->data + buffer->len, byte_recv);
+    buffer->len += byte_recv;
+    if (buffer->len == WRITE_BEHIND_BUFFER_BYTES) //full: hand it to the writer, the next receive takes a fresh one
+    {
+        queueJob(file, buffer);
+        file->current = NULL;
+    }
+
+    return byte_recv;
+}
+
+//queue the last partial buffer and the close, the file is closed by its writer once everything is on disk
+void closeWriteBehind(write_behind_file* file)
+{
+    if (file->current != NULL && file->current->len > 0)
+        queueJob(file, file->current);
+    else if (file->current != NULL)
+        releaseBuffer(file->current);
+
+    file->current = NULL;
+    queueJob(file, NULL);
+}
+
+//wait until every queued write and close has finished
+void waitWriteBehind()
+{
+    unique_lock<mutex> lock(pending_m);
+    pending_cv.wait(lock, [] { return pending_jobs == 0; });
+}
+
+bool waitWriteBehindGroup(write_behind_group* group)
+{
+    unique_lock<mutex> lock(group->group_m);
+    group->group_cv.wait(lock, [group] { return group->open_files == 0; });
+    return !group->failed;
+}
+
+//a pool above its new share keeps the buffers it has, it just does not create more
+void shareWriteBehindBuffers(const vector<size_t> &shard_workers)
+{
+    size_t total = 0;
+    for (size_t k = 0; k < shard_workers.size(); k++)
+        total += shard_workers[k];
+
+    for (size_t k = 0; k < shard_workers.size() && k < MAX_SHARDS; k++)
+    {
+        lock_guard<mutex> lock(pools[k].pool_m);
+        if (total == 0)
+            pools[k].capacity = 0;
+        else
+            pools[k].capacity = (max)(1, (int)(WRITE_BEHIND_POOL_BUFFERS * shard_workers[k] / total));
+    }
+}
+
+//drain the queues, stop the writer threads and free the pool
+void stopWriteBehind()
+{
+    waitWriteBehind();
+
+    lock_guard<mutex> lock(writers_m);
+    for (size_t i = 0; i < writers.size(); i++)
+    {
+        {
+            lock_guard<mutex> queue_lock(writers[i]->queue_m);
+            writers[i]->stopping = true;
+        }
+        writers[i]->queue_cv.notify_one();
+        writers[i]->worker.join();
+    }
+    writers.clear();
+    next_writer = 0;
+
+    for (int k = 0; k < MAX_SHARDS; k++)
+    {
+        lock_guard<mutex> pool_lock(pools[k].pool_m);
+        for (size_t i = 0; i < pools[k].free_buffers.size(); i++)
+            delete pools[k].free_buffers[i];
+        pools[k].free_buffers.clear();
+        pools[k].allocated = 0;
+        budgetRelease(pools[k].memory);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "client.h"
+
+//Write-behind disk stage (--write-behind=N)
+//Receiving threads fill buffers taken from a fixed pool and queue them to N disk-writer threads, so the socket keeps
+//being read while the disk is busy. When every buffer is queued, the receiver waits for a writer to hand one back
+//(backpressure), which bounds the memory in flight to WRITE_BEHIND_POOL_BUFFERS * WRITE_BEHIND_BUFFER_BYTES, or to
+//what the memory budget (budget.h) leaves for the pool. With --shards every shard has its own share of the pool, in
+//proportion to the workers fetchAll() gives it (an even share until then).
+//All writes of one file go to the same writer, so they reach the disk in order.
+//The files of one fetch share a group (fetch.h), the fetch waits for the group before the journal records it as done.
+
+#define WRITE_BEHIND_BUFFER_BYTES (256 << 10)
+#define WRITE_BEHIND_POOL_BUFFERS 64
+
+extern int write_behind_threads;        //disk-writer threads, 0 = write on the receiving thread (--write-behind)
+extern long long fsync_every_bytes;     //FlushFileBuffers after this many bytes of a file, 0 = leave it to the OS (--fsync-every)
+
+struct write_behind_file;
+
+//files whose writes are waited for together, e.g. those of one fetch
+struct write_behind_group
+{
+    int open_files = 0;         //opened and not closed by their writer yet
+    bool failed = false;        //a write of one of them failed
+    mutex group_m;
+    condition_variable group_cv;
+};
+
+write_behind_file* openWriteBehind(string path, write_behind_group* group = NULL);
+int recvIntoWriteBehind(write_behind_file* file, SOCKET sock, long long max_bytes);
+void closeWriteBehind(write_behind_file* file);
+void waitWriteBehind();
+bool waitWriteBehindGroup(write_behind_group* group); //until every file of the group is on disk, false if a write failed
+void shareWriteBehindBuffers(const vector<size_t> &shard_workers); //buffers per shard by its workers, at least one each
+void stopWriteBehind();